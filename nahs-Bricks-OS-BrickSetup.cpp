@@ -2,7 +2,6 @@
 #include <nahs-Bricks-OS.h>
 #include <nahs-Bricks-Lib-SerHelp.h>
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
 #include <ESP8266WebServer.h>
 
 const char *ap_ssid = "BrickSetup";
@@ -49,6 +48,7 @@ void NahsBricksOSBrickSetup::handover() {
         String input_str = "";
         while (true) {
           setupServer.handleClient();
+          BricksOS.handleConfigResetRequest();
           input_str = SerHelp.readLine(false);
           if (input_str != String('\n')) break;
         }
@@ -127,7 +127,8 @@ void NahsBricksOSBrickSetup::showBrickInfo() {
   Serial.print("/");
   Serial.println(RTCmem.getSpaceTotal());
   Serial.print("SketchMD5: ");
-  Serial.println(ESP.getSketchMD5());
+  Serial.println(BricksOS.getSketchMD5());
+  BricksOS.printHeapStats();
   Serial.println("Features:");
   FeatureAll.printBrickSetupFeatureList();
   Serial.println("Versions:");
@@ -150,6 +151,7 @@ void NahsBricksOSBrickSetup::showRuntimeData() {
   Serial.println();
   BricksOS.printRTCdata();
   FeatureAll.printRTCdata();
+  BricksOS.printTrace();
 }
 
 void NahsBricksOSBrickSetup::setIdent() {
@@ -164,6 +166,20 @@ void NahsBricksOSBrickSetup::configWifi() {
   BricksOS.setWifiSSID(SerHelp.readLine());
   Serial.print("Password: ");
   BricksOS.setWifiPass(SerHelp.readLine());
+  Serial.print("Static IP (empty for DHCP): ");
+  String ip = SerHelp.readLine();
+  if (ip == "") {
+    BricksOS.setStaticIP("", "", "", "");
+    Serial.print("Cache DHCP lease for (s, 0 to disable): ");
+    BricksOS.setLeaseCache(SerHelp.readLine().toInt());
+    return;
+  }
+  Serial.print("Gateway: ");
+  String gateway = SerHelp.readLine();
+  Serial.print("Netmask: ");
+  String subnet = SerHelp.readLine();
+  Serial.print("DNS (empty for Gateway): ");
+  BricksOS.setStaticIP(ip, gateway, subnet, SerHelp.readLine());
 }
 
 void NahsBricksOSBrickSetup::testWifi() {
@@ -211,7 +227,8 @@ void NahsBricksOSBrickSetup::testBricksServer() {
   Serial.print("Sending Test Data... ");
   DynamicJsonDocument out_json(1024);
   out_json["test"] = "val";
-  DynamicJsonDocument in_json = BricksOS.transmitToBrickServer(out_json);
+  DynamicJsonDocument in_json(1024);
+  BricksOS.transmitToBrickServer(&out_json, &in_json);
 
   if(in_json.containsKey("s")) {
     if(in_json["s"] == 0) Serial.println("Success");
@@ -234,6 +251,11 @@ const char brickSetup_index_html[] PROGMEM = R"rawliteral(
   <form action="/" method="post">
     SSID: <input type="text" name="ssid"><br />
     PSK: <input type="password" name="psk"><br />
+    Static IP: <input type="text" name="ip"> (empty for DHCP)<br />
+    Gateway: <input type="text" name="gw"><br />
+    Netmask: <input type="text" name="nm"><br />
+    DNS: <input type="text" name="dns"><br />
+    Cache DHCP lease (s): <input type="text" name="lc" value="0"><br />
     Server: <input type="text" name="server"><br />
     Port: <input type="text" name="port" value="8081"><br />
     Ident: <input type="text" name="ident"><br />
@@ -254,9 +276,11 @@ void NahsBricksOSBrickSetup::webSetupHandler() {
   if (setupServer.method() == HTTP_POST) {
     BricksOS.setWifiSSID(setupServer.arg("ssid"));
     BricksOS.setWifiPass(setupServer.arg("psk"));
+    BricksOS.setStaticIP(setupServer.arg("ip"), setupServer.arg("gw"), setupServer.arg("nm"), setupServer.arg("dns"));
+    BricksOS.setLeaseCache(setupServer.arg("lc").toInt());
     BricksOS.setBrickServerURL(setupServer.arg("server"), setupServer.arg("port").toInt());
     BricksOS.setIdent(setupServer.arg("ident"));
-    FSmem.write();
+    BricksOS.writeFSmem();
     RTCmem.destroy();
     setupServer.send(200, "text/html", brickSetup_saved_html);
   }
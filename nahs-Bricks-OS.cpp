@@ -1,24 +1,201 @@
 #include <nahs-Bricks-OS.h>
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
-#include <ESP8266WebServer.h>
-#include <ESP8266httpUpdate.h>
+#include <WiFiUdp.h>
+#include <Updater.h>
+#include <MD5Builder.h>
+#include <eboot_command.h>
+#include <EEPROM.h>
 #include <nahs-Bricks-OS-BrickSetup.h>
 #include <nahs-Bricks-Lib-SerHelp.h>
 
-ESP8266WebServer server(80);
+WiFiServer activatorServer(80);
+WiFiUDP brickUdp;  // used for transmissions and Activator events via UDP
+
+const char* phaseNames[] = {"begin", "start", "deliver", "wifi", "transmit", "feedback", "persist", "activator"};
+
+/*
+Print that collects everything written to it and passes it on to the client in chunks
+*/
+class ChunkedClientPrint : public Print {
+    private:
+        Client& _client;
+        uint8_t _buffer[128];
+        size_t _used;
+    public:
+        size_t sent = 0;  // bytes passed on to the client
+        ChunkedClientPrint(Client& client) : _client(client), _used(0) {}
+        size_t write(uint8_t c) override {
+            _buffer[_used++] = c;
+            if (_used == sizeof(_buffer)) flushChunk();
+            return 1;
+        }
+        using Print::write;
+        void flushChunk() {
+            if (_used > 0) sent += _client.write(_buffer, _used);
+            _used = 0;
+        }
+};
+
+/*
+Stream that passes reads on to a client until deadline (millis) and counts the bytes read
+reads wait for the next byte until the deadline has passed (or the client is closed), so the whole exchange is bound by it and not only the wait for each byte
+*/
+class CountingStream : public Stream {
+    private:
+        Client& _client;
+        uint32_t _deadline;
+        bool expired() { return (int32_t)(_deadline - millis()) <= 0; }
+        bool waitByte() {
+            while (_client.available() == 0) {
+                if (expired() || !_client.connected()) return false;
+                delay(1);
+            }
+            return !expired();
+        }
+    public:
+        size_t received = 0;
+        CountingStream(Client& client, uint32_t deadline) : _client(client), _deadline(deadline) {
+            setTimeout(0);  // waiting is done by read and peek
+        }
+        int available() override { return expired() ? 0 : _client.available(); }
+        int read() override {
+            if (!waitByte()) return -1;
+            int c = _client.read();
+            if (c >= 0) received++;
+            return c;
+        }
+        int peek() override { return waitByte() ? _client.peek() : -1; }
+        size_t write(uint8_t c) override { return _client.write(c); }
+};
+
+/*
+helper that adds data to a FNV-1a hash
+*/
+static void hashBytes(uint32_t* hash, const void* data, size_t len) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i) {
+        *hash ^= bytes[i];
+        *hash *= 16777619UL;
+    }
+}
+
+/*
+Print that hashes everything written to it (FNV-1a)
+*/
+class HashPrint : public Print {
+    public:
+        uint32_t hash = 2166136261UL;
+        size_t write(uint8_t c) override {
+            hashBytes(&hash, &c, 1);
+            return 1;
+        }
+};
+
+/*
+helper that reads one line of a HTTP head (without line ending), overlong lines get truncated
+*/
+static size_t readHttpLine(Stream& stream, char* line, size_t size) {
+    size_t len = 0;
+    char c;
+    while (stream.readBytes(&c, 1) == 1 && c != '\n') {
+        if (c != '\r' && len < size - 1) line[len++] = c;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+/*
+helper that reads the header lines of a HTTP message up to the empty line in front of the body
+*/
+static void readHttpHeaders(Stream& stream, size_t* contentLength, bool* msgPack) {
+    char line[64];
+    while (readHttpLine(stream, line, sizeof(line)) > 0) {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) *contentLength = atoi(line + 15);
+        else if (strncasecmp(line, "Content-Type:", 13) == 0) *msgPack = strstr(line + 13, "msgpack") != nullptr;
+    }
+}
 
 /*
-ISR that listens to falling-edges during BrickSetup
+helper that writes the header of a datagram (CoAP-style: version 1, type, no token, code and message ID) followed by the payload marker
+*/
+static void writeUdpHeader(WiFiUDP& udp, uint8_t type, uint8_t code, uint16_t messageId) {
+    uint8_t header[5] = {(uint8_t)(0x40 | (type << 4)), code, (uint8_t)(messageId >> 8), (uint8_t)messageId, 0xff};
+    udp.write(header, sizeof(header));
+}
+
+/*
+helper that writes a HTTP response with doc as body (encoded as MessagePack or JSON) to client
+*/
+static void sendHttpResponse(WiFiClient& client, int code, JsonDocument& doc, bool msgPack) {
+    ChunkedClientPrint response(client);
+    response.print(F("HTTP/1.0 "));
+    response.print(code);
+    response.print(F(" \r\nContent-Type: "));
+    response.print(msgPack ? F("application/msgpack") : F("text/json"));
+    response.print(F("\r\nContent-Length: "));
+    response.print(msgPack ? measureMsgPack(doc) : measureJson(doc));
+    response.print(F("\r\nConnection: close\r\n\r\n"));
+    if (msgPack) serializeMsgPack(doc, response);
+    else serializeJson(doc, response);
+    response.flushChunk();
+}
+
+volatile uint32_t configResetEdges = 0;  // number of falling edges of the setup pin, only written by configResetISR
+volatile uint32_t configResetEdgeTime = 0;  // millis of the last falling edge of the setup pin
+
+/*
+helper that passes size bytes of the running sketch, starting at address, on to the OTA partition
+the flash is read in aligned chunks, as flashRead needs aligned addresses
+*/
+static bool copySketchToUpdate(uint32_t address, uint32_t size) {
+    uint32_t buffer[66];
+    while (size > 0) {
+        uint32_t skip = address & 3UL;
+        uint32_t len = min(size, (uint32_t)256);
+        if (!ESP.flashRead(address - skip, buffer, (skip + len + 3) & ~3UL)) return false;
+        if (Update.write((uint8_t*)buffer + skip, len) != len) return false;
+        address += len;
+        size -= len;
+    }
+    return true;
+}
+
+/*
+ISR that listens to falling-edges during BrickSetup, it only records them to be handled by handleConfigResetRequest
 */
 IRAM_ATTR void configResetISR() {
-    noInterrupts();
-    BricksOS.handleConfigResetRequest();
-    interrupts();
+    configResetEdgeTime = millis();
+    configResetEdges++;
 }
 
 NahsBricksOS::NahsBricksOS() {
     _writeFSmemRequested = false;
+    _FSdataTouched = false;
+    _FSdataChecksum = 0;
+    _leaseCacheUsed = false;
+    _hostIPFromCache = false;
+    _wifiStarted = false;
+    _transmitDue = false;
+    _transmitWake = false;
+    memset(&_config, 0, sizeof(_config));
+    _wifiStart = 0;
+    _attemptStart = 0;
+    _apTried = -1;
+    _configResetState = RESET_IDLE;
+    _configResetStep = 0;
+    _configResetNext = 0;
+    _configResetEdgesSeen = 0;
+    _trace = nullptr;
+    _traceUsed = 0;
+    _traceTruncated = false;
+    _traceUptime = 0;
+    _traceWifiStatus = 255;
+    _traceKeep = false;
+    _udpStarted = false;
+    _udpActivatorSeen = false;
+    _udpActivatorId = 0;
+    _phaseStart = 0;
+    memset(_phaseTimes, 0, sizeof(_phaseTimes));
 }
 
 /*
@@ -32,9 +209,16 @@ void NahsBricksOS::setSetupPin(uint8_t pin) {
 used to handover the main-process to BrickOS, this function is never returning
 */
 void NahsBricksOS::handover() {
+    //------------------------------------------
+    // FSmem is loaded already, so the wake is decided (and WiFi started) before anything gets initialized
+    buildConfig();
+    if (_config.ssid[0] != '\0' && _config.host[0] != '\0') decideWake();
+
     //------------------------------------------
     // initialize variables on all features
     begin();
+    if (_config.trace) startTrace();
+    markPhase(PHASE_BEGIN);
 
     //------------------------------------------
     // execute otaUpdate if requested
@@ -48,7 +232,7 @@ void NahsBricksOS::handover() {
     // check if BrickSetup needs to be entered
     pinMode(_setupPin, INPUT_PULLUP);
     delay(1);
-    if (digitalRead(_setupPin) == LOW || FSdata["ssid"] == "" || FSdata["url"] == "") {
+    if (digitalRead(_setupPin) == LOW || _config.ssid[0] == '\0' || _config.host[0] == '\0') {
         pinMode(LED_BUILTIN, OUTPUT);
         digitalWrite(LED_BUILTIN, HIGH);
         attachInterrupt(digitalPinToInterrupt(_setupPin), configResetISR, FALLING);
@@ -57,100 +241,199 @@ void NahsBricksOS::handover() {
 
     //------------------------------------------
     // start all backgroud processes
-    connectWifi();
     FeatureAll.start();
+    markPhase(PHASE_START);
 
     //------------------------------------------
     // prepare json document to be transmitted to BrickServer
     DynamicJsonDocument out_json(2048);
     FeatureAll.deliver(&out_json);
+    shadowDelivery(&out_json);
+
+    //------------------------------------------
+    // on wakes not sure to transmit: skip unchanged readings and keep the others in backlog until transmission is due
+    // WiFi is only started this late if the reading turns out to need a transmission after all
+    if (!_transmitWake) {
+        bool changed = deliveryChanged();
+        if (!_transmitDue || (!changed && getBacklogCount() == 0)) {
+            bool fits = backlogFits(&out_json);
+            if (!changed || fits) {
+                if (changed) {
+                    pushBacklog(&out_json);
+                    recordDelivery();
+                }
+                traceDoc(TRACE_OUT, &out_json);
+                markPhase(PHASE_DELIVER);
+                FeatureAll.end();
+                sleepAndRestart(getCycleDelay());
+            }
+        }
+        connectWifi();
+    }
 
     //------------------------------------------
     // deliver ident if it is set and Brick just initalized
-    if (!RTCmem.isValid() && FSdata["id"] != "") {
-        out_json["id"].set(FSdata["id"]);
+    if (!RTCmem.isValid() && _config.ident[0] != '\0') {
+        out_json["id"] = (const char*)_config.ident;
     }
 
     //------------------------------------------
-    // deliver sketchMD5 if requested
-    if (RTCdata->sketchMD5Requested) {
-        RTCdata->sketchMD5Requested = false;
-        out_json["m"].set(ESP.getSketchMD5());
+    // deliver sketchMD5 if requested, or unrequested on first cycle of a newly flashed sketch if enabled (begin keeps the latter as request)
+    if (RTCdata->sketchMD5Requested) out_json["m"] = getSketchMD5();
+
+    //------------------------------------------
+    // deliver phase timings of previous cycle and FSmem write statistics if enabled
+    if (RTCmem.isValid() && _config.phaseTimings) {
+        JsonArray pt = out_json.createNestedArray("pt");
+        for (uint8_t i = 0; i < PHASE_COUNT; ++i) pt.add(RTCdata->phaseTimes[i]);
+        JsonArray fw = out_json.createNestedArray("fw");
+        fw.add(RTCdata->fsWrites);
+        fw.add(RTCdata->fsWritesSkipped);
+        fw.add(RTCdata->fsWriteTime);
+        JsonArray wb = out_json.createNestedArray("wb");
+        wb.add(RTCdata->wireSent);
+        wb.add(RTCdata->wireReceived);
     }
 
     //------------------------------------------
-    // wait for wifi
-    waitWifi();
+    // deliver count of failed cycles since last successful transmission
+    if (RTCdata->failures > 0) out_json["fc"] = RTCdata->failures;
 
     //------------------------------------------
-    // submit data
-    DynamicJsonDocument in_json = transmitToBrickServer(out_json);
+    // deliver progress of staged OTA update
+    if (RTCdata->stageActive) {
+        JsonArray su = out_json.createNestedArray("su");
+        su.add(RTCdata->stageDone);
+        su.add(FSdata["ss"].as<uint32_t>());
+    }
 
     //------------------------------------------
-    // process feedback from BrickServer
-    FeatureAll.feedback(&in_json);
+    // deliver count of documents that overflowed
+    uint16_t docOverflowsDelivered = RTCdata->docOverflows;
+    if (docOverflowsDelivered > 0) out_json["do"] = docOverflowsDelivered;
 
     //------------------------------------------
-    // evaluate own requests
-    if (in_json.containsKey("r")) {
-        for (JsonVariant value : in_json["r"].as<JsonArray>()) {
-            switch(value.as<uint8_t>()) {
-                case 11:
-                    RTCdata->sketchMD5Requested = true;
-                    break;
-                case 12:
-                    RTCdata->otaUpdateRequested = true;
-                    break;
-                case 14:
-                    FSdata["id"] = "";
-                    requestFSmemWrite();
-                    break;
-            }
-        }
+    // deliver heap statistics if requested
+    bool heapStatsDelivered = false;
+#if BRICKS_OS_HEAP_STATS
+    heapStatsDelivered = RTCheapStats->heapStatsRequested;
+    if (heapStatsDelivered) {
+        JsonArray hs = out_json.createNestedArray("hs");
+        hs.add(RTCheapStats->heapMin);
+        hs.add(RTCheapStats->blockMin);
+        hs.add(RTCheapStats->fragMax);
+        hs.add(RTCheapStats->stackMin);
+        hs.add(RTCheapStats->heapMinPhase);
+        hs.add(RTCheapStats->outDocMax);
+        hs.add(RTCheapStats->inDocMax);
     }
+#endif
 
     //------------------------------------------
-    // write RTCmem
-    RTCmem.write();
+    // deliver readings of previous cycles that could not be transmitted
+    uint8_t backlogDelivered = deliverBacklog(&out_json);
+    recordDoc(&out_json, false);
+    traceDoc(TRACE_OUT, &out_json);
+    markPhase(PHASE_DELIVER);
+
+    //------------------------------------------
+    // wait for wifi
+    bool connected = waitWifi();
+    markPhase(PHASE_WIFI);
+
+    //------------------------------------------
+    // submit data, if the cycle is still within it's time budget
+    DynamicJsonDocument in_json(1024);
+    bool transmitted = connected && millis() < cycleTimeout && transmitToBrickServer(&out_json, &in_json);
+    recordDoc(&in_json, true);
+    if (transmitted) traceDoc(TRACE_IN, &in_json);
+    markPhase(PHASE_TRANSMIT);
 
     //------------------------------------------
-    // write FSmem
-    if (_writeFSmemRequested) {
-        _writeFSmemRequested = false;
-        FSmem.write();
+    // drop cached DHCP lease if BrickServer could not be reached with it
+    if (!transmitted && _leaseCacheUsed) RTCdata->leaseIP = 0;
+
+    //------------------------------------------
+    // give up on this cycle if BrickServer could not be reached, but keep it's reading in backlog
+    if (!transmitted) {
+        out_json.remove("id");
+        out_json.remove("m");
+        out_json.remove("pt");
+        out_json.remove("fw");
+        out_json.remove("wb");
+        out_json.remove("fc");
+        out_json.remove("do");
+        out_json.remove("hs");
+        out_json.remove("su");
+        out_json.remove("bl");
+        pushBacklog(&out_json);
+        sleepWithBackoff();
     }
+    RTCdata->failures = 0;
+    RTCdata->wakes = 0;
+    RTCdata->docOverflows -= docOverflowsDelivered;
+    if (heapStatsDelivered) resetHeapStats();
+    RTCdata->sketchMD5Requested = false;
+    RTCdata->heartbeatRequested = false;
+    RTCdata->lastTransmit = getUptime();
+    recordDelivery();
+    dropBacklog(backlogDelivered);
+
+    //------------------------------------------
+    // upload trace of this cycle (and the one of a failed or slow cycle) if requested
+    if (RTCdata->traceUploadRequested && uploadTrace()) RTCdata->traceUploadRequested = false;
+
+    //------------------------------------------
+    // process feedback from BrickServer
+    FeatureAll.feedback(&in_json);
+
+    //------------------------------------------
+    // evaluate own requests and settings
+    evaluateFeedback(&in_json);
+    markPhase(PHASE_FEEDBACK);
 
     //------------------------------------------
     // end all features
     FeatureAll.end();
 
     //------------------------------------------
-    // start up the Activator
-    server.on("/", std::bind(&NahsBricksOS::handleActivator, this));
-    server.onNotFound(std::bind(&NahsBricksOS::handleActivatorNotFound, this));
-    server.begin();
+    // continue staging an OTA update, within it's time budget
+    if (RTCdata->stageActive) stageOtaUpdate();
 
     //------------------------------------------
-    // now wait if any Activator events come in
-    _activatorEventReceived = false;
-    for (uint8_t i = 0; i < FeatureAll.getDelay(); ++i) {
-        server.handleClient();
-        if (_activatorEventReceived) {
-            while (server.client().connected()) yield();
-            break;
+    // start up the Activator, light sleep is used while waiting for events
+    activatorServer.begin();
+    activatorServer.setNoDelay(true);
+    WiFi.setSleepMode(WIFI_LIGHT_SLEEP);
+
+    //------------------------------------------
+    // now serve Activator events until the next cycle is due (or the short window of deep-sleep mode expires) or BrickServer marks it done, each event extends the window
+    _activatorDone = false;
+    uint32_t cycleEnd = millis() + getCycleDelay();
+    uint32_t windowEnd = cycleEnd;
+    if (_config.deepSleep && (int32_t)(windowEnd - millis()) > deepSleepWindow) windowEnd = millis() + deepSleepWindow;
+    if (_config.udpPort != 0) startUdp();
+    while (!_activatorDone && (int32_t)(windowEnd - millis()) > 0) {
+        bool received = handleActivator();
+        if (_config.udpPort != 0) received |= handleActivatorUdp();
+        if (received && (int32_t)(windowEnd - millis()) < activatorExtension) {
+            windowEnd = millis() + activatorExtension;
         }
-        delay(1000);
+        delay(activatorPoll);
     }
+    markPhase(PHASE_ACTIVATOR);
 
     //------------------------------------------
-    // write RTCmem again just in case an activator changed some content
-    RTCmem.write();
+    // in deep-sleep mode the rest of the cycle is spent in deep-sleep
+    if (_config.deepSleep && (int32_t)(cycleEnd - millis()) > 0) sleepAndRestart(cycleEnd - millis());
 
     //------------------------------------------
-    // write FSmem again just in case an activator changed some content
-    if (_writeFSmemRequested) {
-        FSmem.write();
-    }
+    // advance uptime by the time spent in this cycle
+    RTCdata->uptime = getUptime();
+
+    //------------------------------------------
+    // write FSmem and RTCmem once, including everything changed by Activator events
+    commitMem();
 
     //------------------------------------------
     // lets self-reset to start over again
@@ -161,66 +444,375 @@ void NahsBricksOS::handover() {
 helper to start the WiFi Connection
 */
 void NahsBricksOS::connectWifi() {
+    _wifiStarted = true;
+    _wifiStart = millis();
     WiFi.forceSleepWake();  // power up wifi module
     delay(1);
     WiFi.persistent(false);  // disable wifi persistence (this will not automatically store and load wifi connection from flash)
     WiFi.mode(WIFI_STA);  // set station mode
-    if(RTCmem.isValid()) {
-        // Try connecting to previous used AP
-        WiFi.begin(FSdata["ssid"].as<const char*>(), FSdata["pass"].as<const char*>(), RTCdata->channel, RTCdata->ap_mac, true);
+    _leaseCacheUsed = false;
+    if (_config.ip != 0) {
+        // Use permanent static IP
+        WiFi.config(IPAddress(_config.ip), IPAddress(_config.gateway), IPAddress(_config.subnet), IPAddress(_config.dns));
+    }
+    else if (RTCmem.isValid() && RTCdata->leaseIP != 0 && getUptime() - RTCdata->leaseStart < _config.leaseCache) {
+        // Reuse cached DHCP lease
+        WiFi.config(IPAddress(RTCdata->leaseIP), IPAddress(RTCdata->leaseGateway), IPAddress(RTCdata->leaseSubnet), IPAddress(RTCdata->leaseDNS));
+        _leaseCacheUsed = true;
+    }
+    _attemptStart = _wifiStart;
+    _apTried = RTCmem.isValid() ? pickAP() : -1;
+    if (_apTried >= 0) {
+        // Try connecting to best of the previous used APs
+        WiFi.begin(_config.ssid, _config.pass, RTCdata->aps[_apTried].channel, RTCdata->aps[_apTried].bssid, true);
     }
     else {
         // Connect with WiFi-Discover
-        WiFi.begin(FSdata["ssid"].as<const char*>(), FSdata["pass"].as<const char*>());
+        WiFi.begin(_config.ssid, _config.pass);
     }
 }
 
 /*
 helper that waits for WiFi Connection (and saves connection info for later runs)
+gives up and returns false if the connection could not be established within wifiTimeout or the cycle budget
 */
-void NahsBricksOS::waitWifi() {
-    if(RTCmem.isValid()) { // WiFi quick connect is tried
-        uint8_t retries = 0;
-        while (WiFi.status() != WL_CONNECTED) {
-            ++retries;
-            if (retries > 200) {
-                // Quick connect is not working, reset and try normal connect
-                WiFi.disconnect();
-                delay(10);
-                WiFi.forceSleepBegin();
-                delay(10);
-                WiFi.forceSleepWake();
-                delay(10);
-                WiFi.begin(FSdata["ssid"].as<const char*>(), FSdata["pass"].as<const char*>());
-                break;
+bool NahsBricksOS::waitWifi() {
+    if (_apTried >= 0 && !waitWifiStatus(getQuickConnectTimeout(_apTried)) && !wifiTimedOut()) {
+        // Quick connect is not working, reset and try the best AP found on the channels of known APs
+        failAP(_apTried);
+        restartWifi();
+        uint8_t bssid[6];
+        uint8_t channel;
+        bool found = scanKnownChannels(bssid, &channel);
+        _attemptStart = millis();
+        if (found) {
+            WiFi.begin(_config.ssid, _config.pass, channel, bssid, true);
+            if (!waitWifiStatus(quickConnectMax) && !wifiTimedOut()) {
+                // Still not working, reset and try normal connect
+                restartWifi();
+                _attemptStart = millis();
+                WiFi.begin(_config.ssid, _config.pass);
             }
-            delay(10);
         }
+        else {
+            WiFi.begin(_config.ssid, _config.pass);
+        }
+    }
+    while (WiFi.status() != WL_CONNECTED) {
+        traceWifi();
+        if (wifiTimedOut()) return false;
+        delay(10);
     }
-    while (WiFi.status() != WL_CONNECTED) delay(10);
+    traceWifi();
 
     // save AP info for later use
-    RTCdata->channel = WiFi.channel();
-    memcpy(RTCdata->ap_mac, WiFi.BSSID(), 6);
+    recordAP(millis() - _attemptStart);
+
+    // save DHCP lease for later use
+    if (!_leaseCacheUsed && _config.ip == 0 && _config.leaseCache > 0) {
+        RTCdata->leaseIP = WiFi.localIP();
+        RTCdata->leaseGateway = WiFi.gatewayIP();
+        RTCdata->leaseSubnet = WiFi.subnetMask();
+        RTCdata->leaseDNS = WiFi.dnsIP();
+        RTCdata->leaseStart = getUptime();
+    }
+    return true;
+}
+
+/*
+helper that waits up to timeout ms (but not beyond wifiTimeout or cycleTimeout) for the WiFi connection, returns true if connected
+*/
+bool NahsBricksOS::waitWifiStatus(uint32_t timeout) {
+    uint32_t start = millis();
+    while (WiFi.status() != WL_CONNECTED) {
+        traceWifi();
+        if (millis() - start > timeout || wifiTimedOut()) return false;
+        delay(10);
+    }
+    traceWifi();
+    return true;
+}
+
+/*
+helper that returns true if the time to establish the WiFi connection is up
+*/
+bool NahsBricksOS::wifiTimedOut() {
+    return millis() - _wifiStart > wifiTimeout || millis() > cycleTimeout;
+}
+
+/*
+helper that resets the WiFi module after a failed attempt to connect, a cached DHCP lease is given up as it might be the problem
+*/
+void NahsBricksOS::restartWifi() {
+    WiFi.disconnect();
+    delay(10);
+    WiFi.forceSleepBegin();
+    delay(10);
+    WiFi.forceSleepWake();
+    delay(10);
+    if (_leaseCacheUsed) {
+        // cached DHCP lease might be the problem, fall back to DHCP
+        WiFi.config(0U, 0U, 0U);
+        RTCdata->leaseIP = 0;
+        _leaseCacheUsed = false;
+    }
+}
+
+/*
+helper that returns the index of the AP candidate to be tried first by quick connect (-1 if there is none)
+candidates are ranked by their consecutive failures first and by their average association time second
+*/
+int8_t NahsBricksOS::pickAP() {
+    int8_t best = -1;
+    for (uint8_t i = 0; i < BRICKS_OS_AP_CANDIDATES; ++i) {
+        _APcandidate* ap = &RTCdata->aps[i];
+        if (ap->channel == 0) continue;
+        if (best < 0 || ap->fails < RTCdata->aps[best].fails || (ap->fails == RTCdata->aps[best].fails && ap->assocTime < RTCdata->aps[best].assocTime)) best = i;
+    }
+    return best;
+}
+
+/*
+helper that returns the ms a quick connect to the given AP candidate is given, based on it's average association time
+*/
+uint16_t NahsBricksOS::getQuickConnectTimeout(uint8_t candidate) {
+    uint16_t assocTime = RTCdata->aps[candidate].assocTime;
+    if (assocTime == 0 || RTCdata->aps[candidate].fails > 0) return quickConnectMax;
+    return constrain((uint32_t)assocTime * 2 + quickConnectMargin, (uint32_t)quickConnectMin, (uint32_t)quickConnectMax);
+}
+
+/*
+helper that scans the channels of all AP candidates for the configured SSID, the strongest AP found (except the one that just failed) is returned in bssid and channel
+returns false if none was found
+*/
+bool NahsBricksOS::scanKnownChannels(uint8_t* bssid, uint8_t* channel) {
+    int32_t bestRSSI = INT32_MIN;
+    for (uint8_t i = 0; i < BRICKS_OS_AP_CANDIDATES; ++i) {
+        uint8_t ch = RTCdata->aps[i].channel;
+        if (ch == 0) continue;
+        bool scanned = false;
+        for (uint8_t j = 0; j < i; ++j) scanned |= RTCdata->aps[j].channel == ch;
+        if (scanned) continue;
+        int8_t count = WiFi.scanNetworks(false, false, ch, (uint8_t*)_config.ssid);
+        for (int8_t n = 0; n < count; ++n) {
+            if (_apTried >= 0 && memcmp(WiFi.BSSID(n), RTCdata->aps[_apTried].bssid, 6) == 0) continue;
+            if (WiFi.RSSI(n) > bestRSSI) {
+                bestRSSI = WiFi.RSSI(n);
+                memcpy(bssid, WiFi.BSSID(n), 6);
+                *channel = WiFi.channel(n);
+            }
+        }
+        WiFi.scanDelete();
+    }
+    return bestRSSI != INT32_MIN;
+}
+
+/*
+helper that records the AP just connected to with the time the connection took, the AP replaces the worst candidate if it is not known yet
+*/
+void NahsBricksOS::recordAP(uint32_t assocTime) {
+    const uint8_t* bssid = WiFi.BSSID();
+    int8_t slot = -1;
+    for (uint8_t i = 0; i < BRICKS_OS_AP_CANDIDATES; ++i) {
+        if (RTCdata->aps[i].channel != 0 && memcmp(RTCdata->aps[i].bssid, bssid, 6) == 0) slot = i;
+    }
+    bool known = slot >= 0;
+    if (!known) {
+        // take an unused candidate, or the one with most failures and longest association time
+        slot = 0;
+        for (uint8_t i = 1; i < BRICKS_OS_AP_CANDIDATES; ++i) {
+            _APcandidate* ap = &RTCdata->aps[i];
+            _APcandidate* worst = &RTCdata->aps[slot];
+            if (worst->channel == 0) break;
+            if (ap->channel == 0 || ap->fails > worst->fails || (ap->fails == worst->fails && ap->assocTime > worst->assocTime)) slot = i;
+        }
+    }
+    _APcandidate* ap = &RTCdata->aps[slot];
+    if (assocTime > 65535) assocTime = 65535;
+    ap->assocTime = known ? (ap->assocTime * 3 + assocTime) / 4 : assocTime;
+    memcpy(ap->bssid, bssid, 6);
+    ap->channel = WiFi.channel();
+    ap->fails = 0;
+}
+
+/*
+helper that records a failed quick connect to the given AP candidate, it gets forgotten after apFailsMax consecutive failures
+*/
+void NahsBricksOS::failAP(uint8_t candidate) {
+    _APcandidate* ap = &RTCdata->aps[candidate];
+    if (++ap->fails >= apFailsMax) ap->channel = 0;
+}
+
+/*
+helper to transmit a json_document to BrickServer and receive the answer into in_json, returns true on success
+if BrickServer has a UDP port configured the transmission is tried via UDP first, HTTP is the fallback
+UDP is skipped (except for every 16th cycle) after udpFailsMax cycles in a row it failed
+*/
+bool NahsBricksOS::transmitToBrickServer(JsonDocument* out_json, DynamicJsonDocument* in_json) {
+    if (out_json->isNull()) out_json->to<JsonObject>();
+    RTCdata->wireSent = 0;
+    RTCdata->wireReceived = 0;
+    if (_config.udpPort != 0) {
+        bool tryUdp = RTCdata->udpFails < udpFailsMax || RTCdata->udpFails % 16 == 0;
+        if (tryUdp && transmitUdp(out_json, in_json)) {
+            RTCdata->udpFails = 0;
+            return true;
+        }
+        RTCdata->udpFails++;
+    }
+    return transmitHttp(out_json, in_json);
+}
+
+/*
+helper that binds the UDP socket to BrickServer's UDP port, answers and Activator events are received on it
+*/
+void NahsBricksOS::startUdp() {
+    if (_udpStarted) return;
+    _udpStarted = brickUdp.begin(_config.udpPort) == 1;
+}
+
+/*
+helper to transmit a json_document to BrickServer via UDP (CoAP-style confirmable POST) and receive the answer into in_json, returns true on success
+the datagram is retransmitted with doubled timeout until an acknowledgement with the same message ID comes in, the format of it's payload is taken from it's first byte
+*/
+bool NahsBricksOS::transmitUdp(JsonDocument* out_json, DynamicJsonDocument* in_json) {
+    bool msgPack = _config.msgPack;
+    size_t len = msgPack ? measureMsgPack(*out_json) : measureJson(*out_json);
+    IPAddress serverIP;
+    if (len > udpPayloadMax || !resolveBrickServer(&serverIP, false)) return false;
+    startUdp();
+    if (!_udpStarted) return false;
+    uint16_t messageId = ++RTCdata->udpMessageId;
+    uint32_t timeout = udpTimeout;
+    for (uint8_t attempt = 0; attempt <= udpRetransmits; ++attempt) {
+        //------------------------------------------
+        // send the request as confirmable POST
+        brickUdp.beginPacket(serverIP, _config.udpPort);
+        writeUdpHeader(brickUdp, 0, 0x02, messageId);
+        if (msgPack) serializeMsgPack(*out_json, brickUdp);
+        else serializeJson(*out_json, brickUdp);
+        if (!brickUdp.endPacket()) return false;
+        countWire(5 + len, 0);
+
+        //------------------------------------------
+        // wait for the acknowledgement, other datagrams (and those not coming from BrickServer) are dropped
+        uint32_t start = millis();
+        while (millis() - start < timeout) {
+            size_t received = brickUdp.parsePacket();
+            if (received == 0) {
+                delay(1);
+                continue;
+            }
+            if (brickUdp.remoteIP() != serverIP || brickUdp.remotePort() != _config.udpPort) continue;
+            uint8_t header[4];
+            if (brickUdp.read(header, 4) != 4 || header[0] != 0x60 || (uint16_t)(header[2] << 8 | header[3]) != messageId) continue;
+            countWire(0, received);
+            if (header[1] != 0x44) return false;  // 2.04 Changed is the only success
+
+            //------------------------------------------
+            // parse the payload into a document sized by it's length
+            if (brickUdp.peek() == 0xff) brickUdp.read();
+            size_t payload = brickUdp.available();
+            size_t capacity = payload > 0 ? getDocCapacity(payload, true) : in_json->capacity();
+            if (capacity == 0) {
+                if (RTCdata->docOverflows < 65535) RTCdata->docOverflows++;
+                in_json->clear();
+                return false;
+            }
+            if (capacity != in_json->capacity()) *in_json = DynamicJsonDocument(capacity);
+            in_json->clear();
+            if (payload == 0) return true;
+            DeserializationError error = brickUdp.peek() == '{' ? deserializeJson(*in_json, brickUdp) : deserializeMsgPack(*in_json, brickUdp);
+            if (error) {
+                if (error == DeserializationError::NoMemory && RTCdata->docOverflows < 65535) RTCdata->docOverflows++;
+                in_json->clear();
+                return false;
+            }
+            return true;
+        }
+        timeout *= 2;
+    }
+    return false;
+}
+
+/*
+helper that adds bytes sent and received to the wire statistics of the current transmission
+*/
+void NahsBricksOS::countWire(size_t sent, size_t received) {
+    RTCdata->wireSent = min((size_t)65535, RTCdata->wireSent + sent);
+    RTCdata->wireReceived = min((size_t)65535, RTCdata->wireReceived + received);
 }
 
 /*
-helper to transmit a json_document to BrickServer and receive the answer also as json_document
+helper to transmit a json_document to BrickServer via HTTP and receive the answer into in_json
+the request body is streamed straight from out_json to the socket (as MessagePack if configured, JSON otherwise) and the answer is parsed straight from it, returns true on success
+in_json is resized to the answer's Content-Length, an answer too large to be parsed is counted as overflow, leaves in_json empty and fails the transmission
 */
-DynamicJsonDocument NahsBricksOS::transmitToBrickServer(DynamicJsonDocument out_json) {
-    String httpPayload;
-    httpPayload.reserve(2048);  // Prevent RAM fragmentation
-    if (out_json.isNull()) httpPayload = "{}";
-    else serializeJson(out_json, httpPayload);
+bool NahsBricksOS::transmitHttp(JsonDocument* out_json, DynamicJsonDocument* in_json) {
+    bool msgPack = _config.msgPack;
+    in_json->clear();
     WiFiClient client;
-    HTTPClient http;
-    http.begin(client, FSdata["url"].as<String>());
-    http.addHeader("Content-Type", "application/json");
-    http.POST(httpPayload);
-    DynamicJsonDocument in_json(1024);
-    deserializeJson(in_json, http.getStream());
-    http.end();
-    return in_json;
+    client.setTimeout(httpTimeout);
+    uint32_t deadline = millis() + httpTimeout;
+    IPAddress serverIP;
+    bool connected = resolveBrickServer(&serverIP, false) && client.connect(serverIP, _config.port);
+    if (!connected && _hostIPFromCache) {
+        // cached IP might be outdated, resolve again
+        connected = resolveBrickServer(&serverIP, true) && client.connect(serverIP, _config.port);
+    }
+    if (!connected) return false;
+
+    //------------------------------------------
+    // send request, Content-Length is measured in advance so no copy of the body is needed
+    ChunkedClientPrint request(client);
+    request.print(F("POST / HTTP/1.0\r\nHost: "));
+    request.print(_config.host);
+    request.print(':');
+    request.print(_config.port);
+    if (msgPack) request.print(F("\r\nContent-Type: application/msgpack\r\nAccept: application/msgpack"));
+    else request.print(F("\r\nContent-Type: application/json"));
+    request.print(F("\r\nContent-Length: "));
+    request.print(msgPack ? measureMsgPack(*out_json) : measureJson(*out_json));
+    request.print(F("\r\nConnection: close\r\n\r\n"));
+    if (msgPack) serializeMsgPack(*out_json, request);
+    else serializeJson(*out_json, request);
+    request.flushChunk();
+    countWire(request.sent, 0);
+
+    //------------------------------------------
+    // read status code and headers, the format of the answer is taken from it's Content-Type
+    CountingStream answer(client, deadline);
+    char line[64];
+    readHttpLine(answer, line, sizeof(line));
+    int status = (strncmp(line, "HTTP/1.", 7) == 0 && strlen(line) > 9) ? atoi(line + 9) : 0;
+    size_t contentLength = 0;
+    msgPack = false;
+    readHttpHeaders(answer, &contentLength, &msgPack);
+    countWire(0, answer.received);
+    if ((int32_t)(deadline - millis()) <= 0) {
+        client.stop();
+        return false;
+    }
+
+    //------------------------------------------
+    // size in_json by the answer's length and parse it, an answer that does not fit fails the transmission (requests in it would get lost otherwise)
+    size_t capacity = contentLength > 0 ? getDocCapacity(contentLength, msgPack) : in_json->capacity();
+    if (capacity == 0) {
+        if (RTCdata->docOverflows < 65535) RTCdata->docOverflows++;
+        client.stop();
+        return false;
+    }
+    if (capacity != in_json->capacity()) *in_json = DynamicJsonDocument(capacity);
+    answer.received = 0;
+    DeserializationError error = msgPack ? deserializeMsgPack(*in_json, answer) : deserializeJson(*in_json, answer);
+    countWire(0, answer.received);
+    client.stop();
+    if (error) {
+        if (error == DeserializationError::NoMemory && RTCdata->docOverflows < 65535) RTCdata->docOverflows++;
+        in_json->clear();
+        return false;
+    }
+    return status == 200;
 }
 
 /*
@@ -232,6 +824,92 @@ void NahsBricksOS::printRTCdata() {
     SerHelp.printlnBool(RTCdata->sketchMD5Requested);
     Serial.print("  otaUpdateRequested: ");
     SerHelp.printlnBool(RTCdata->otaUpdateRequested);
+    Serial.println("  phaseTimes (us):");
+    for (uint8_t i = 0; i < PHASE_COUNT; ++i) {
+        Serial.print("    ");
+        Serial.print(phaseNames[i]);
+        Serial.print(": ");
+        Serial.println(RTCdata->phaseTimes[i]);
+    }
+    Serial.print("  uptime: ");
+    Serial.println(RTCdata->uptime);
+    Serial.println("  APs (channel/avg. association ms/fails):");
+    for (uint8_t i = 0; i < BRICKS_OS_AP_CANDIDATES; ++i) {
+        if (RTCdata->aps[i].channel == 0) continue;
+        Serial.print("   ");
+        for (uint8_t j = 0; j < 6; ++j) {
+            Serial.print(j == 0 ? " " : ":");
+            if (RTCdata->aps[i].bssid[j] < 0x10) Serial.print("0");
+            Serial.print(RTCdata->aps[i].bssid[j], HEX);
+        }
+        Serial.print(": ");
+        Serial.print(RTCdata->aps[i].channel);
+        Serial.print("/");
+        Serial.print(RTCdata->aps[i].assocTime);
+        Serial.print("/");
+        Serial.println(RTCdata->aps[i].fails);
+    }
+    Serial.print("  leaseIP: ");
+    Serial.println(IPAddress(RTCdata->leaseIP));
+    Serial.print("  leaseStart: ");
+    Serial.println(RTCdata->leaseStart);
+    Serial.print("  failures: ");
+    Serial.println(RTCdata->failures);
+    Serial.print("  wakes: ");
+    Serial.println(RTCdata->wakes);
+    Serial.print("  heartbeatRequested: ");
+    SerHelp.printlnBool(RTCdata->heartbeatRequested);
+    Serial.print("  lastTransmit: ");
+    Serial.println(RTCdata->lastTransmit);
+    Serial.print("  shadowHash: ");
+    Serial.println(RTCdata->shadowHash, HEX);
+    Serial.print("  hostIP: ");
+    Serial.print(IPAddress(RTCdata->hostIP));
+    Serial.print(" (resolved at ");
+    Serial.print(RTCdata->hostResolved);
+    Serial.println(")");
+    Serial.print("  docOverflows: ");
+    Serial.println(RTCdata->docOverflows);
+#if BRICKS_OS_HEAP_STATS
+    Serial.print("  heapStatsRequested: ");
+    SerHelp.printlnBool(RTCheapStats->heapStatsRequested);
+#endif
+    Serial.print("  wake slot (at/period/drift ppm): ");
+    Serial.print(RTCdata->slotAt);
+    Serial.print("/");
+    Serial.print(RTCdata->slotPeriod);
+    Serial.print("/");
+    Serial.println(RTCdata->slotDrift);
+    Serial.print("  traceUploadRequested: ");
+    SerHelp.printlnBool(RTCdata->traceUploadRequested);
+    Serial.print("  traceKept: ");
+    SerHelp.printlnBool(RTCdata->traceKept);
+    Serial.print("  staged OTA update: ");
+    if (RTCdata->stageActive) {
+        Serial.print(RTCdata->stageDone);
+        Serial.print("/");
+        Serial.println(FSdata["ss"].as<uint32_t>());
+    }
+    else Serial.println("none");
+    Serial.print("  FSmem writes (done/skipped/last us): ");
+    Serial.print(RTCdata->fsWrites);
+    Serial.print("/");
+    Serial.print(RTCdata->fsWritesSkipped);
+    Serial.print("/");
+    Serial.println(RTCdata->fsWriteTime);
+    Serial.print("  last transmission (bytes sent/received): ");
+    Serial.print(RTCdata->wireSent);
+    Serial.print("/");
+    Serial.println(RTCdata->wireReceived);
+#if BRICKS_OS_BACKLOG_SIZE > 0
+    Serial.print("  backlog: ");
+    Serial.print(RTCbacklog->count);
+    Serial.print(" readings, ");
+    Serial.print(RTCbacklog->used);
+    Serial.print("/");
+    Serial.print(sizeof(RTCbacklog->data));
+    Serial.println(" bytes");
+#endif
     Serial.println();
 }
 
@@ -246,11 +924,80 @@ void NahsBricksOS::printFSdata() {
     Serial.println(FSdata["pass"].as<String>());
     Serial.print("  BrickServer-URL: ");
     Serial.println(FSdata["url"].as<String>());
+    Serial.print("  Static-IP: ");
+    Serial.println(FSdata["ip"].as<String>());
+    Serial.print("  Static-Gateway: ");
+    Serial.println(FSdata["gw"].as<String>());
+    Serial.print("  Static-Netmask: ");
+    Serial.println(FSdata["nm"].as<String>());
+    Serial.print("  Static-DNS: ");
+    Serial.println(FSdata["dns"].as<String>());
+    Serial.print("  DHCP-LeaseCache (s): ");
+    Serial.println(FSdata["lc"].as<uint32_t>());
     Serial.print("  Ident: ");
     Serial.println(FSdata["id"].as<String>());
+    Serial.print("  PhaseTimings: ");
+    SerHelp.printlnBool(FSdata["tm"].as<bool>());
+    Serial.print("  MessagePack: ");
+    SerHelp.printlnBool(FSdata["mp"].as<bool>());
+    Serial.print("  BrickServer-UDP-Port: ");
+    Serial.println(FSdata["up"].as<uint16_t>());
+    Serial.print("  Trace: ");
+    SerHelp.printlnBool(FSdata["tc"].as<bool>());
+    Serial.print("  DeepSleep: ");
+    SerHelp.printlnBool(FSdata["ds"].as<bool>());
+    Serial.print("  TransmitEveryWakes: ");
+    Serial.println(FSdata["bn"].as<uint8_t>());
+    Serial.print("  SketchMD5-Unrequested: ");
+    SerHelp.printlnBool(FSdata["mo"].as<bool>());
+    Serial.print("  SketchMD5-Cache: ");
+    Serial.print(FSdata["md5"].as<String>());
+    Serial.print(" (");
+    Serial.print(FSdata["md5k"].as<uint32_t>(), HEX);
+    Serial.println(")");
+    Serial.print("  MaxSilence (s): ");
+    Serial.println(FSdata["ms"].as<uint32_t>());
+    Serial.print("  SuppressionTolerances: ");
+    serializeJson(FSdata["st"], Serial);
+    Serial.println();
     Serial.println();
 }
 
+/*
+prints current and worst recorded heap statistics to Serial
+*/
+void NahsBricksOS::printHeapStats() {
+    Serial.print("Heap free/max block/fragmentation: ");
+    Serial.print(ESP.getFreeHeap());
+    Serial.print("/");
+    Serial.print(ESP.getMaxFreeBlockSize());
+    Serial.print("/");
+    Serial.print(ESP.getHeapFragmentation());
+    Serial.println("%");
+    Serial.print("Stack free: ");
+    Serial.println(ESP.getFreeContStack());
+    if (!RTCmem.isValid()) return;
+#if BRICKS_OS_HEAP_STATS
+    Serial.print("Worst heap free/max block/fragmentation: ");
+    Serial.print(RTCheapStats->heapMin);
+    Serial.print(" (at ");
+    Serial.print(phaseNames[RTCheapStats->heapMinPhase]);
+    Serial.print(")/");
+    Serial.print(RTCheapStats->blockMin);
+    Serial.print("/");
+    Serial.print(RTCheapStats->fragMax);
+    Serial.println("%");
+    Serial.print("Worst stack free: ");
+    Serial.println(RTCheapStats->stackMin);
+    Serial.print("Max document usage out/in: ");
+    Serial.print(RTCheapStats->outDocMax);
+    Serial.print("/");
+    Serial.println(RTCheapStats->inDocMax);
+#endif
+    Serial.print("Document overflows: ");
+    Serial.println(RTCdata->docOverflows);
+}
+
 /*
 helper to return copyright year
 */
@@ -263,6 +1010,7 @@ helper to set SSID
 */
 void NahsBricksOS::setWifiSSID(String ssid) {
     FSdata["ssid"] = ssid;
+    touchFSdata();
 }
 
 /*
@@ -270,6 +1018,7 @@ helper to set WiFi Password
 */
 void NahsBricksOS::setWifiPass(String pass) {
     FSdata["pass"] = pass;
+    touchFSdata();
 }
 
 /*
@@ -277,6 +1026,26 @@ helper to set BrickServer's URL
 */
 void NahsBricksOS::setBrickServerURL(String host, long port) {
     FSdata["url"] = "http://" + host + ":" + String(port);
+    touchFSdata();
+}
+
+/*
+helper to set a permanent static IP, an empty ip switches back to DHCP
+*/
+void NahsBricksOS::setStaticIP(String ip, String gateway, String subnet, String dns) {
+    FSdata["ip"] = ip;
+    FSdata["gw"] = gateway;
+    FSdata["nm"] = subnet;
+    FSdata["dns"] = dns;
+    touchFSdata();
+}
+
+/*
+helper to set the max age (in seconds) a DHCP lease is reused for, 0 disables the lease cache
+*/
+void NahsBricksOS::setLeaseCache(uint32_t maxAge) {
+    FSdata["lc"] = maxAge;
+    touchFSdata();
 }
 
 /*
@@ -284,6 +1053,29 @@ helper to set Identity-String of Brick
 */
 void NahsBricksOS::setIdent(String ident) {
     FSdata["id"] = ident;
+    touchFSdata();
+}
+
+/*
+helper that returns the MD5 of the running sketch
+it is only calculated once per flashed sketch and cached in FSmem, the cache is dropped by OTA updates and on cold boot if the sketch's fingerprint changed
+*/
+String NahsBricksOS::getSketchMD5() {
+    if (FSdata["md5"] == "") {
+        FSdata["md5"] = ESP.getSketchMD5();
+        touchFSdata();
+    }
+    return FSdata["md5"].as<String>();
+}
+
+/*
+helper that drops the cached SketchMD5 (persisted right away) before the running sketch gets replaced by an OTA update
+*/
+void NahsBricksOS::forgetSketchMD5() {
+    FSdata["md5"] = "";
+    FSdata["md5k"] = 0;
+    touchFSdata();
+    writeFSmem();
 }
 
 /*
@@ -294,34 +1086,73 @@ void NahsBricksOS::requestFSmemWrite() {
 }
 
 /*
-helper that destroys Brick's configuration if called for four times
+helper that writes FSmem, but only if a write was requested by a feature or BrickOS's config actually changed
+returns true if FSmem got written
 */
-void NahsBricksOS::handleConfigResetRequest() {
-    configResetRequestsCount++;
-    //------------------------------------------
-    // debounce the input signal
-    unsigned long ms = millis() + 400; while (ms > millis()) {}
+bool NahsBricksOS::writeFSmem() {
+    bool changed = _FSdataTouched && getFSdataChecksum() != _FSdataChecksum;
+    if (_FSdataTouched && !changed && !_writeFSmemRequested && RTCdata->fsWritesSkipped < 65535) RTCdata->fsWritesSkipped++;
+    _FSdataTouched = false;
+    if (!changed && !_writeFSmemRequested) return false;
+    _writeFSmemRequested = false;
+    uint32_t start = micros();
+    FSmem.write();
+    RTCdata->fsWriteTime = micros() - start;
+    if (RTCdata->fsWrites < 65535) RTCdata->fsWrites++;
+    _FSdataChecksum = getFSdataChecksum();
+    return true;
+}
 
-    //------------------------------------------
-    // blink the onboard led twice to show the reset request counter incremented
-    for (uint8_t i = 0; i < 2; ++i) {
-        ms = millis() + 50; while (ms > millis()) {}
-        digitalWrite(LED_BUILTIN, LOW);
-        ms = millis() + 50; while (ms > millis()) {}
-        digitalWrite(LED_BUILTIN, HIGH);
-    }
+/*
+helper that handles requests to reset the config without blocking, it has to be called repeatedly by BrickSetup's loop
+each falling edge of the setup pin (as recorded by configResetISR) is debounced and acknowledged by blinking the onboard led twice
+on the 4th request the config is destroyed and the Brick restarts
+*/
+void NahsBricksOS::handleConfigResetRequest() {
+    if (_configResetState != RESET_IDLE && (int32_t)(millis() - _configResetNext) < 0) return;
+    switch (_configResetState) {
+        case RESET_IDLE:
+            if (configResetEdges == _configResetEdgesSeen) return;
+            _configResetNext = configResetEdgeTime + configResetDebounce;
+            _configResetState = RESET_DEBOUNCE;
+            break;
+        case RESET_DEBOUNCE:
+            //------------------------------------------
+            // edges within the debounce time are bounces of the same request
+            _configResetEdgesSeen = configResetEdges;
+            configResetRequestsCount++;
+            _configResetStep = 0;
+            _configResetNext = millis() + 50;
+            _configResetState = RESET_BLINK;
+            break;
+        case RESET_BLINK:
+            //------------------------------------------
+            // blink the onboard led twice to show the reset request counter incremented
+            digitalWrite(LED_BUILTIN, (_configResetStep % 2 == 0) ? LOW : HIGH);
+            _configResetNext = millis() + 50;
+            if (++_configResetStep < 4) break;
+            if (configResetRequestsCount < 4) {
+                _configResetState = RESET_IDLE;
+                break;
+            }
 
-    //------------------------------------------
-    // if reset request counter is 4 or higher light up long to show the config is now destroyed and the brick is going to restart
-    if (configResetRequestsCount >= 4) {
-        FSmem.destroy();
-        FSmem.write();
-        RTCmem.destroy();
-        ms = millis() + 50; while (ms > millis()) {}
-        digitalWrite(LED_BUILTIN, LOW);
-        ms = millis() + 1500; while (ms > millis()) {}
-        digitalWrite(LED_BUILTIN, HIGH);
-        ESP.restart();
+            //------------------------------------------
+            // if reset request counter is 4 or higher destroy the config, the led lights up long to show the brick is going to restart
+            FSmem.destroy();
+            FSmem.write();
+            RTCmem.destroy();
+            _configResetStep = 0;
+            _configResetNext = millis() + 50;
+            _configResetState = RESET_DESTROYED;
+            break;
+        case RESET_DESTROYED:
+            if (_configResetStep++ == 0) {
+                digitalWrite(LED_BUILTIN, LOW);
+                _configResetNext = millis() + 1500;
+                break;
+            }
+            digitalWrite(LED_BUILTIN, HIGH);
+            ESP.restart();
     }
 }
 
@@ -333,36 +1164,181 @@ void NahsBricksOS::begin() {
     if (!FSdata.containsKey("pass")) FSdata["pass"] = "";
     if (!FSdata.containsKey("url")) FSdata["url"] = "";
     if (!FSdata.containsKey("id")) FSdata["id"] = "";
+    if (!FSdata.containsKey("tm")) FSdata["tm"] = false;
+    if (!FSdata.containsKey("ip")) FSdata["ip"] = "";
+    if (!FSdata.containsKey("gw")) FSdata["gw"] = "";
+    if (!FSdata.containsKey("nm")) FSdata["nm"] = "";
+    if (!FSdata.containsKey("dns")) FSdata["dns"] = "";
+    if (!FSdata.containsKey("lc")) FSdata["lc"] = 0;
+    if (!FSdata.containsKey("mp")) FSdata["mp"] = false;
+    if (!FSdata.containsKey("bn")) FSdata["bn"] = 1;
+    if (!FSdata.containsKey("ms")) FSdata["ms"] = 0;
+    if (!FSdata.containsKey("mo")) FSdata["mo"] = false;
+    if (!FSdata.containsKey("md5")) FSdata["md5"] = "";
+    if (!FSdata.containsKey("md5k")) FSdata["md5k"] = 0;
+    if (!FSdata.containsKey("ds")) FSdata["ds"] = false;
+    if (!FSdata.containsKey("tc")) FSdata["tc"] = false;
+    if (!FSdata.containsKey("up")) FSdata["up"] = 0;
+    if (!FSdata.containsKey("ss")) FSdata["ss"] = 0;
+    if (!FSdata.containsKey("sm")) FSdata["sm"] = "";
     if (!RTCmem.isValid()) {
+        memset(RTCdata->aps, 0, sizeof(RTCdata->aps));
         RTCdata->sketchMD5Requested = false;
         RTCdata->otaUpdateRequested = false;
+        memset(RTCdata->phaseTimes, 0, sizeof(RTCdata->phaseTimes));
+        RTCdata->uptime = 0;
+        RTCdata->leaseIP = 0;
+        RTCdata->failures = 0;
+        RTCdata->wakes = 0;
+        RTCdata->heartbeatRequested = false;
+        RTCdata->lastTransmit = 0;
+        RTCdata->shadowHash = 0;
+        RTCdata->shadowCount = 0;
+        RTCdata->fsWrites = 0;
+        RTCdata->fsWritesSkipped = 0;
+        RTCdata->fsWriteTime = 0;
+        RTCdata->hostIP = 0;
+        RTCdata->docOverflows = 0;
+        resetHeapStats();
+        RTCdata->slotPeriod = 0;
+        RTCdata->slotAt = 0;
+        RTCdata->slotDrift = 0;
+        RTCdata->traceUploadRequested = false;
+        RTCdata->traceKept = false;
+        RTCdata->stageActive = false;
+        RTCdata->udpMessageId = random(65536);  // a new life must not repeat the message IDs of the previous one
+        RTCdata->udpFails = 0;
+        RTCdata->wireSent = 0;
+        RTCdata->wireReceived = 0;
+#if BRICKS_OS_BACKLOG_SIZE > 0
+        RTCbacklog->count = 0;
+        RTCbacklog->used = 0;
+#endif
+
+        //------------------------------------------
+        // apart from OTA updates (which drop the cached SketchMD5) a sketch only gets replaced by flashing it, which is a cold boot
+        // so only here the sketch is checked for being newly flashed, the unrequested delivery of it's MD5 is kept as request until it got transmitted
+        uint32_t fingerprint = getSketchFingerprint();
+        if (FSdata["md5k"].as<uint32_t>() != fingerprint) {
+            FSdata["md5"] = "";
+            FSdata["md5k"] = fingerprint;
+            touchFSdata();
+            RTCdata->sketchMD5Requested = FSdata["mo"].as<bool>();
+        }
     }
+    buildConfig();
+    _FSdataChecksum = getFSdataChecksum();
     FeatureAll.begin();
 }
 
 /*
-helper that allows async data receiving from BrickServer
+helper that allows async data receiving from BrickServer, serves one pending Activator request if there is any
+requests are answered in the format (MessagePack or JSON) they are sent in, returns true if an event got received
+an event containing "dn": true marks the Activator window as done
+the body is parsed straight from the socket into a document sized by it's Content-Length, too large events are rejected with 413
 */
-void NahsBricksOS::handleActivator() {
-    if (server.method() != HTTP_POST) {
-        server.send(405, "text/json", "{\"s\": 2, \"m\": \"wrong method\"}");
+bool NahsBricksOS::handleActivator() {
+    WiFiClient client = activatorServer.available();
+    if (!client) return false;
+    client.setTimeout(1000);
+
+    //------------------------------------------
+    // read request line and headers
+    char line[64];
+    readHttpLine(client, line, sizeof(line));
+    size_t contentLength = 0;
+    bool msgPack = false;
+    readHttpHeaders(client, &contentLength, &msgPack);
+    char* path = strchr(line, ' ');
+
+    //------------------------------------------
+    // evaluate request
+    StaticJsonDocument<64> answer;
+    if (path == nullptr || strncmp(path, " /", 2) != 0 || (path[2] != ' ' && path[2] != '?')) {
+        answer["s"] = 1;
+        answer["m"] = "wrong url";
+        sendHttpResponse(client, 404, answer, msgPack);
+    }
+    else if (strncmp(line, "POST ", 5) != 0) {
+        answer["s"] = 2;
+        answer["m"] = "wrong method";
+        sendHttpResponse(client, 405, answer, msgPack);
     }
     else {
-        DynamicJsonDocument in_json(1024);
-        deserializeJson(in_json, server.arg("plain"));
+        size_t capacity = contentLength > 0 ? getDocCapacity(contentLength, msgPack) : defaultDocSize;
+        DeserializationError error = DeserializationError::NoMemory;
+        DynamicJsonDocument in_json(capacity);
+        if (capacity > 0 && in_json.capacity() > 0) {
+            error = msgPack ? deserializeMsgPack(in_json, client) : deserializeJson(in_json, client);
+        }
+        if (error == DeserializationError::NoMemory) {
+            if (RTCdata->docOverflows < 65535) RTCdata->docOverflows++;
+            answer["s"] = 3;
+            answer["m"] = "too large";
+            sendHttpResponse(client, 413, answer, msgPack);
+            client.stop();
+            return false;
+        }
+        recordDoc(&in_json, true);
+        traceDoc(TRACE_ACTIVATOR, &in_json);
         FeatureAll.feedback(&in_json);
-        server.send(200, "text/json", "{\"s\": 0}");
-        _activatorEventReceived = true;
+        evaluateFeedback(&in_json);
+        if (in_json["dn"].as<bool>()) _activatorDone = true;
+        answer["s"] = 0;
+        sendHttpResponse(client, 200, answer, msgPack);
+        client.stop();
+        return true;
     }
+    client.stop();
+    return false;
 }
 
+
 /*
-helper to handle Activator requests to wrong path/url
+helper that serves one pending Activator event received via UDP (CoAP-style confirmable POST), returns true if an event got received
+events are acknowledged with 2.04 (or 4.13 if too large), retransmissions of the last event are only acknowledged again
 */
-void NahsBricksOS::handleActivatorNotFound() {
-    server.send(404, "text/json", "{\"s\": 1, \"m\": \"wrong url\"}");
-}
+bool NahsBricksOS::handleActivatorUdp() {
+    if (!_udpStarted || brickUdp.parsePacket() == 0) return false;
+    uint8_t header[4];
+    if (brickUdp.read(header, 4) != 4 || header[0] != 0x40 || header[1] != 0x02) return false;
+    uint16_t messageId = header[2] << 8 | header[3];
+    IPAddress remoteIP = brickUdp.remoteIP();
+    uint16_t remotePort = brickUdp.remotePort();
+    bool repeated = _udpActivatorSeen && messageId == _udpActivatorId;
+    uint8_t code = 0x44;
+    if (!repeated) {
+        if (brickUdp.peek() == 0xff) brickUdp.read();
+        size_t payload = brickUdp.available();
+        size_t capacity = payload > 0 ? getDocCapacity(payload, true) : defaultDocSize;
+        DynamicJsonDocument in_json(capacity);
+        DeserializationError error = DeserializationError::NoMemory;
+        if (capacity > 0 && in_json.capacity() > 0) {
+            error = brickUdp.peek() == '{' ? deserializeJson(in_json, brickUdp) : deserializeMsgPack(in_json, brickUdp);
+        }
+        if (error == DeserializationError::NoMemory) {
+            if (RTCdata->docOverflows < 65535) RTCdata->docOverflows++;
+            code = 0x8d;
+        }
+        else {
+            recordDoc(&in_json, true);
+            traceDoc(TRACE_ACTIVATOR, &in_json);
+            FeatureAll.feedback(&in_json);
+            evaluateFeedback(&in_json);
+            if (in_json["dn"].as<bool>()) _activatorDone = true;
+            _udpActivatorSeen = true;
+            _udpActivatorId = messageId;
+        }
+    }
 
+    //------------------------------------------
+    // acknowledge the event without payload
+    brickUdp.beginPacket(remoteIP, remotePort);
+    uint8_t ack[4] = {0x60, code, header[2], header[3]};
+    brickUdp.write(ack, sizeof(ack));
+    brickUdp.endPacket();
+    return code == 0x44 && !repeated;
+}
 
 /*
 helper to handle firmware otaUpdate
@@ -371,25 +1347,1024 @@ void NahsBricksOS::handleOtaUpdate() {
     RTCdata->otaUpdateRequested = false;
 
     //------------------------------------------
-    // connect and wait for WiFi in one go, as nothing can be done in between
-    connectWifi();
-    waitWifi();
+    // connect (if not already done) and wait for WiFi in one go, as nothing can be done in between
+    if (!_wifiStarted) connectWifi();
+    if (!waitWifi()) {
+        RTCdata->otaUpdateRequested = true;
+        sleepWithBackoff();
+    }
+
+    //------------------------------------------
+    // resolve BrickServer while the cached IP in RTCmem is still valid
+    IPAddress serverIP;
+    bool resolved = resolveBrickServer(&serverIP, false);
+
+    //------------------------------------------
+    // the cached SketchMD5 belongs to the sketch about to be replaced
+    forgetSketchMD5();
 
     //------------------------------------------
     // invalidating all RTC data to be sure the next boot is initializing all variables from scratch
     RTCmem.destroy();
 
     //------------------------------------------
-    // executing the OTA Update
-    ESPhttpUpdate.setLedPin(LED_BUILTIN, LOW);
-    WiFiClient client;
-    ESPhttpUpdate.update(client, FSdata["url"].as<String>() + "/ota");
+    // executing the OTA Update, by a patch against the running sketch if BrickServer has one, by the full image otherwise
+    pinMode(LED_BUILTIN, OUTPUT);
+    digitalWrite(LED_BUILTIN, LOW);
+    if (resolved && !handleDeltaUpdate(serverIP)) handleFullUpdate(serverIP);
+    digitalWrite(LED_BUILTIN, HIGH);
 
     //------------------------------------------
     // rebooting the ESP
     ESP.restart();
 }
 
+/*
+helper that updates the firmware by the full image, fetched from <url>/ota (with BrickServer's configured host name as Host header)
+the image is streamed into the OTA partition and only activated (followed by a restart) if it's MD5 matches the x-MD5 header (if BrickServer sends one), returns false if the update failed
+*/
+bool NahsBricksOS::handleFullUpdate(IPAddress serverIP) {
+    WiFiClient client;
+    client.setTimeout(httpTimeout);
+    if (!client.connect(serverIP, _config.port)) return false;
+
+    //------------------------------------------
+    // request the image, with the headers of ESPhttpUpdate BrickServer might rely on
+    ChunkedClientPrint request(client);
+    request.print(F("GET /ota HTTP/1.0\r\nHost: "));
+    request.print(_config.host);
+    request.print(':');
+    request.print(_config.port);
+    request.print(F("\r\nUser-Agent: ESP8266-http-Update\r\nx-ESP8266-mode: sketch\r\nx-ESP8266-sketch-md5: "));
+    request.print(getSketchMD5());
+    request.print(F("\r\nConnection: close\r\n\r\n"));
+    request.flushChunk();
+
+    //------------------------------------------
+    // read status and the headers describing the image
+    char line[64];
+    readHttpLine(client, line, sizeof(line));
+    int status = (strncmp(line, "HTTP/1.", 7) == 0 && strlen(line) > 9) ? atoi(line + 9) : 0;
+    size_t contentLength = 0;
+    char md5[33] = {0};
+    while (readHttpLine(client, line, sizeof(line)) > 0) {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atoi(line + 15);
+        else if (strncasecmp(line, "x-MD5: ", 7) == 0) strlcpy(md5, line + 7, sizeof(md5));
+    }
+    if (status != 200 || contentLength == 0 || !Update.begin(contentLength) || (strlen(md5) == 32 && !Update.setMD5(md5))) {
+        client.stop();
+        if (Update.isRunning()) Update.end();
+        Update.clearError();
+        return false;
+    }
+
+    //------------------------------------------
+    // stream the image into the OTA partition, end verifies it and it is only activated on success
+    bool ok = Update.writeStream(client) == contentLength;
+    client.stop();
+    if (ok && Update.end()) ESP.restart();
+    if (Update.isRunning()) Update.end();
+    Update.clearError();
+    return false;
+}
+
+/*
+helper that updates the firmware by a patch against the running sketch, fetched from <url>/ota/delta/<sketch MD5>
+the patch consists of it's header (patchMagic, size of new image, MD5 of new image as 32 hex chars) followed by operations:
+  1: copy (address and length, 4 bytes each) from the running sketch
+  2: insert (length as 2 bytes) the bytes following
+the new image is streamed into the OTA partition and only activated (followed by a restart) if it's MD5 matches, returns false if the update failed
+*/
+bool NahsBricksOS::handleDeltaUpdate(IPAddress serverIP) {
+    WiFiClient client;
+    client.setTimeout(httpTimeout);
+    if (!client.connect(serverIP, _config.port)) return false;
+
+    //------------------------------------------
+    // request the patch, BrickServer answers with 200 only if it has one for the running sketch
+    ChunkedClientPrint request(client);
+    request.print(F("GET /ota/delta/"));
+    request.print(getSketchMD5());
+    request.print(F(" HTTP/1.0\r\nHost: "));
+    request.print(_config.host);
+    request.print(':');
+    request.print(_config.port);
+    request.print(F("\r\nConnection: close\r\n\r\n"));
+    request.flushChunk();
+    char line[64];
+    readHttpLine(client, line, sizeof(line));
+    int status = (strncmp(line, "HTTP/1.", 7) == 0 && strlen(line) > 9) ? atoi(line + 9) : 0;
+    size_t contentLength = 0;
+    bool msgPack = false;
+    readHttpHeaders(client, &contentLength, &msgPack);
+    uint32_t magic = 0;
+    uint32_t size = 0;
+    char md5[33] = {0};
+    if (status != 200 || client.readBytes((uint8_t*)&magic, 4) != 4 || magic != patchMagic || client.readBytes((uint8_t*)&size, 4) != 4 || client.readBytes(md5, 32) != 32) {
+        client.stop();
+        return false;
+    }
+
+    //------------------------------------------
+    // apply the patch while streaming it into the OTA partition
+    if (!Update.begin(size) || !Update.setMD5(md5)) {
+        client.stop();
+        return false;
+    }
+    uint32_t sketchSize = ESP.getSketchSize();
+    bool ok = true;
+    uint8_t buffer[256];
+    while (ok && Update.remaining() > 0) {
+        uint8_t op = 0;
+        ok = client.readBytes(&op, 1) == 1;
+        if (ok && op == 1) {
+            uint32_t address = 0;
+            uint32_t len = 0;
+            ok = client.readBytes((uint8_t*)&address, 4) == 4 && client.readBytes((uint8_t*)&len, 4) == 4;
+            ok = ok && address + len <= sketchSize && len <= Update.remaining() && copySketchToUpdate(address, len);
+        }
+        else if (ok && op == 2) {
+            uint16_t len = 0;
+            ok = client.readBytes((uint8_t*)&len, 2) == 2 && len <= Update.remaining();
+            while (ok && len > 0) {
+                size_t chunk = min((size_t)len, sizeof(buffer));
+                ok = client.readBytes(buffer, chunk) == chunk && Update.write(buffer, chunk) == chunk;
+                len -= chunk;
+            }
+        }
+        else ok = false;
+    }
+    client.stop();
+
+    //------------------------------------------
+    // end verifies the MD5 of the new image, it is only activated on success
+    if (ok && Update.end()) ESP.restart();
+    if (Update.isRunning()) Update.end();
+    Update.clearError();
+    return false;
+}
+
+/*
+helper that stages an OTA update in the free flash area behind the running sketch, one flash sector per request (ranged GET /ota)
+it is continued each cycle for at most stageBudget ms, once the whole image is staged and it's MD5 matches it gets activated (followed by a restart)
+*/
+void NahsBricksOS::stageOtaUpdate() {
+    uint32_t start = millis();
+    while (FSdata["ss"].as<uint32_t>() == 0 || RTCdata->stageDone < FSdata["ss"].as<uint32_t>()) {
+        if (millis() - start > stageBudget || !stageChunk(getStageAddress())) return;
+        if (!RTCdata->stageActive) return;
+    }
+
+    //------------------------------------------
+    // verify the whole image, a mismatch starts staging over again
+    uint32_t address = getStageAddress();
+    uint32_t size = FSdata["ss"];
+    MD5Builder md5;
+    md5.begin();
+    uint32_t buffer[64];
+    for (uint32_t offset = 0; offset < size; offset += sizeof(buffer)) {
+        uint32_t len = min(size - offset, (uint32_t)sizeof(buffer));
+        ESP.flashRead(address + offset, buffer, (len + 3) & ~3UL);
+        md5.add((uint8_t*)buffer, len);
+    }
+    md5.calculate();
+    if (strcasecmp(md5.toString().c_str(), FSdata["sm"].as<const char*>()) != 0) {
+        FSdata["ss"] = 0;
+        touchFSdata();
+        RTCdata->stageDone = 0;
+        return;
+    }
+
+    //------------------------------------------
+    // the cached SketchMD5 belongs to the sketch about to be replaced
+    forgetSketchMD5();
+
+    //------------------------------------------
+    // invalidate all RTC data first, the eboot command lives in RTC memory as well and must not be touched after it got written
+    RTCmem.destroy();
+
+    //------------------------------------------
+    // let eboot copy the staged image over the running sketch on next boot
+    eboot_command command;
+    memset(&command, 0, sizeof(command));
+    command.action = ACTION_COPY_RAW;
+    command.args[0] = address;
+    command.args[1] = 0;
+    command.args[2] = size;
+    eboot_command_write(&command);
+    ESP.restart();
+}
+
+/*
+helper that downloads and stages the next chunk (one flash sector) of the OTA update, returns false if it failed
+the first chunk tells the size and MD5 of the image, if they change later on staging starts over again
+each chunk is verified by reading it back from flash (and by it's x-Chunk-MD5 header, if BrickServer sends one)
+*/
+bool NahsBricksOS::stageChunk(uint32_t address) {
+    WiFiClient client;
+    client.setTimeout(httpTimeout);
+    IPAddress serverIP;
+    if (!resolveBrickServer(&serverIP, false) || !client.connect(serverIP, _config.port)) return false;
+    uint32_t done = RTCdata->stageDone;
+    ChunkedClientPrint request(client);
+    request.print(F("GET /ota HTTP/1.0\r\nHost: "));
+    request.print(_config.host);
+    request.print(':');
+    request.print(_config.port);
+    request.print(F("\r\nRange: bytes="));
+    request.print(done);
+    request.print('-');
+    request.print(done + FLASH_SECTOR_SIZE - 1);
+    request.print(F("\r\nConnection: close\r\n\r\n"));
+    request.flushChunk();
+
+    //------------------------------------------
+    // read status and the headers describing the chunk
+    char line[64];
+    readHttpLine(client, line, sizeof(line));
+    int status = (strncmp(line, "HTTP/1.", 7) == 0 && strlen(line) > 9) ? atoi(line + 9) : 0;
+    unsigned long first = 0, last = 0, total = 0;
+    char imageMD5[33] = {0};
+    char chunkMD5[33] = {0};
+    while (readHttpLine(client, line, sizeof(line)) > 0) {
+        if (strncasecmp(line, "Content-Range: bytes ", 21) == 0) sscanf(line + 21, "%lu-%lu/%lu", &first, &last, &total);
+        else if (strncasecmp(line, "x-MD5: ", 7) == 0) strlcpy(imageMD5, line + 7, sizeof(imageMD5));
+        else if (strncasecmp(line, "x-Chunk-MD5: ", 13) == 0) strlcpy(chunkMD5, line + 13, sizeof(chunkMD5));
+    }
+    if (status != 206 || total == 0 || strlen(imageMD5) != 32) {
+        client.stop();
+        return false;
+    }
+
+    //------------------------------------------
+    // take size and MD5 of the image (kept in FSdata, so they are only written when they change), start over if they changed
+    if (total != FSdata["ss"].as<uint32_t>() || strcasecmp(imageMD5, FSdata["sm"].as<const char*>()) != 0) {
+        FSdata["ss"] = total;
+        FSdata["sm"] = imageMD5;
+        touchFSdata();
+        RTCdata->stageDone = 0;
+        client.stop();
+        if (getStageAddress() == 0) RTCdata->stageActive = false;  // image does not fit into free flash area
+        return RTCdata->stageActive;
+    }
+    uint32_t len = last - first + 1;
+    if (first != done || last < first || len != min((uint32_t)total - done, (uint32_t)FLASH_SECTOR_SIZE)) {
+        client.stop();
+        return false;
+    }
+
+    //------------------------------------------
+    // receive the chunk and verify it, if BrickServer sent it's MD5
+    uint32_t* buffer = (uint32_t*)malloc(FLASH_SECTOR_SIZE);
+    if (buffer == nullptr) {
+        client.stop();
+        return false;
+    }
+    memset(buffer, 0xff, FLASH_SECTOR_SIZE);
+    bool ok = client.readBytes((uint8_t*)buffer, len) == len;
+    client.stop();
+    if (ok && strlen(chunkMD5) == 32) {
+        MD5Builder check;
+        check.begin();
+        check.add((uint8_t*)buffer, len);
+        check.calculate();
+        ok = strcasecmp(check.toString().c_str(), chunkMD5) == 0;
+    }
+
+    //------------------------------------------
+    // write the chunk into it's sector and verify it by reading it back
+    ok = ok && ESP.flashEraseSector((address + done) / FLASH_SECTOR_SIZE) && ESP.flashWrite(address + done, buffer, (len + 3) & ~3UL);
+    uint32_t readBack[16];
+    for (uint32_t offset = 0; ok && offset < len; offset += sizeof(readBack)) {
+        uint32_t part = min(len - offset, (uint32_t)sizeof(readBack));
+        ok = ESP.flashRead(address + done + offset, readBack, (part + 3) & ~3UL) && memcmp(readBack, (uint8_t*)buffer + offset, part) == 0;
+    }
+    free(buffer);
+    if (ok) RTCdata->stageDone += len;
+    return ok;
+}
+
+/*
+helper that returns the flash address the OTA update gets staged at (0 if it does not fit into the free flash area)
+like Update does, the image is placed at the end of the free flash area, directly in front of the filesystem
+*/
+uint32_t NahsBricksOS::getStageAddress() {
+    uint32_t sketchEnd = (ESP.getSketchSize() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t freeEnd = sketchEnd + ESP.getFreeSketchSpace();
+    uint32_t size = (FSdata["ss"].as<uint32_t>() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    if (size > freeEnd - sketchEnd) return 0;
+    return freeEnd - size;
+}
+
+/*
+helper that ends a cycle which failed to reach BrickServer, this function is never returning
+the trace of the cycle is kept in EEPROM, the Brick sleeps with radio turned off for FeatureAll.getDelay() seconds, doubled with each consecutive failure up to backoffMax
+a random jitter is added, so Bricks that failed together do not retry together
+*/
+void NahsBricksOS::sleepWithBackoff() {
+    if (RTCdata->failures < 255) RTCdata->failures++;
+    _traceKeep = true;
+    uint32_t backoff = max((uint32_t)FeatureAll.getDelay(), (uint32_t)1) << min(RTCdata->failures - 1, 12);
+    if (backoff > backoffMax) backoff = backoffMax;
+    FeatureAll.end();
+    sleepAndRestart(backoff * 1000 + random(backoff * 10 * jitterPercent + 1));
+}
+
+/*
+helper that persists all state and sleeps with radio turned off for the given ms before starting over again, this function is never returning
+in deep-sleep mode the ESP sleeps in deep-sleep (at most ESP.deepSleepMax()) and starts over on wake, RTCmem is kept
+*/
+void NahsBricksOS::sleepAndRestart(uint32_t ms) {
+    //------------------------------------------
+    // turn off radio
+    WiFi.disconnect(true);
+    WiFi.forceSleepBegin();
+
+    //------------------------------------------
+    // persist state, the uptime already includes the time to be slept
+    RTCdata->uptime = getUptime() + (ms + 500) / 1000;
+    commitMem();
+
+    //------------------------------------------
+    // sleep and start over again
+    if (_config.deepSleep) ESP.deepSleep(min((uint64_t)ms * 1000, ESP.deepSleepMax()));
+    delay(ms);
+    ESP.restart();
+}
+
+/*
+helper that returns the ms until the next cycle is due
+that is the next wake slot if BrickServer assigned one, FeatureAll.getDelay() seconds plus a random jitter otherwise
+*/
+uint32_t NahsBricksOS::getCycleDelay() {
+    if (RTCdata->slotPeriod == 0) {
+        uint32_t delayMs = max((uint32_t)FeatureAll.getDelay(), (uint32_t)1) * 1000;
+        return delayMs + random(delayMs / 100 * jitterPercent + 1);
+    }
+
+    //------------------------------------------
+    // the slots are counted on the Brick's uptime, so the period gets corrected by the measured drift
+    uint32_t period = (uint64_t)RTCdata->slotPeriod * (1000000 + RTCdata->slotDrift) / 1000;
+    uint64_t now = (uint64_t)RTCdata->uptime * 1000 + millis();
+    uint64_t slot = (uint64_t)RTCdata->slotAt * 1000;
+    if (slot > now) return slot - now;
+    return period - (now - slot) % period;
+}
+
+/*
+helper that takes a wake slot assigned by BrickServer as seconds until the slot (in) and seconds between slots (period), a period of 0 removes the assignment
+if the previous assignment was long enough ago, the difference to the slot the Brick expected is used to correct the drift of it's uptime
+*/
+void NahsBricksOS::assignWakeSlot(int32_t in, uint16_t period) {
+    if (period == 0) {
+        RTCdata->slotPeriod = 0;
+        return;
+    }
+    uint32_t now = getUptime();
+    uint32_t slot = now + in;
+    if (RTCdata->slotPeriod == period && (int32_t)(now - RTCdata->slotAt) >= driftSyncMin) {
+        int64_t periodMs = (int64_t)period * (1000000 + RTCdata->slotDrift) / 1000;
+        int64_t delta = ((int64_t)(slot - RTCdata->slotAt) * 1000) % periodMs;
+        if (delta > periodMs / 2) delta -= periodMs;
+        else if (delta < -periodMs / 2) delta += periodMs;
+        int32_t drift = RTCdata->slotDrift + delta * 1000 / (now - RTCdata->slotAt);
+        RTCdata->slotDrift = constrain(drift, -driftMax, driftMax);
+    }
+    RTCdata->slotPeriod = period;
+    RTCdata->slotAt = slot;
+}
+
+/*
+helper that evaluates the requests (r) and settings of BrickServer meant for BrickOS
+*/
+void NahsBricksOS::evaluateFeedback(JsonDocument* in_json) {
+    if (in_json->containsKey("r")) {
+        for (JsonVariant value : (*in_json)["r"].as<JsonArray>()) {
+            switch(value.as<uint8_t>()) {
+                case 11:
+                    RTCdata->sketchMD5Requested = true;
+                    break;
+                case 12:
+                    RTCdata->otaUpdateRequested = true;
+                    break;
+                case 14:
+                    FSdata["id"] = "";
+                    touchFSdata();
+                    break;
+                case 15:
+                    FSdata["tm"] = true;
+                    touchFSdata();
+                    break;
+                case 16:
+                    FSdata["tm"] = false;
+                    touchFSdata();
+                    break;
+                case 17:
+                    FSdata["mp"] = true;
+                    touchFSdata();
+                    break;
+                case 18:
+                    FSdata["mp"] = false;
+                    touchFSdata();
+                    break;
+                case 19:
+                    RTCdata->heartbeatRequested = true;
+                    break;
+                case 20:
+                    FSdata["mo"] = true;
+                    touchFSdata();
+                    break;
+                case 21:
+                    FSdata["mo"] = false;
+                    touchFSdata();
+                    break;
+#if BRICKS_OS_HEAP_STATS
+                case 22:
+                    RTCheapStats->heapStatsRequested = true;
+                    break;
+#endif
+                case 23:
+                    FSdata["ds"] = true;
+                    touchFSdata();
+                    break;
+                case 24:
+                    FSdata["ds"] = false;
+                    touchFSdata();
+                    break;
+                case 25:
+                    FSdata["tc"] = true;
+                    touchFSdata();
+                    break;
+                case 26:
+                    FSdata["tc"] = false;
+                    touchFSdata();
+                    break;
+                case 27:
+                    RTCdata->traceUploadRequested = true;
+                    break;
+                case 28:
+                    if (!RTCdata->stageActive) {
+                        RTCdata->stageActive = true;
+                        RTCdata->stageDone = 0;
+                        FSdata["ss"] = 0;
+                        FSdata["sm"] = "";
+                        touchFSdata();
+                    }
+                    break;
+                case 29:
+                    RTCdata->stageActive = false;
+                    break;
+            }
+        }
+    }
+
+    //------------------------------------------
+    // take wake slot assigned by BrickServer as [s until slot, period in s]
+    if (in_json->containsKey("ws")) {
+        assignWakeSlot((*in_json)["ws"][0].as<int32_t>(), (*in_json)["ws"][1].as<uint16_t>());
+    }
+
+    //------------------------------------------
+    // evaluate own settings
+    if (in_json->containsKey("bn") && (*in_json)["bn"].as<uint8_t>() != FSdata["bn"].as<uint8_t>()) {
+        FSdata["bn"] = max((*in_json)["bn"].as<uint8_t>(), (uint8_t)1);
+        touchFSdata();
+    }
+    if (in_json->containsKey("up") && (*in_json)["up"].as<uint16_t>() != FSdata["up"].as<uint16_t>()) {
+        FSdata["up"] = (*in_json)["up"].as<uint16_t>();
+        touchFSdata();
+    }
+    if (in_json->containsKey("ms") && (*in_json)["ms"].as<uint32_t>() != FSdata["ms"].as<uint32_t>()) {
+        FSdata["ms"] = (*in_json)["ms"].as<uint32_t>();
+        touchFSdata();
+    }
+    if (in_json->containsKey("st") && (*in_json)["st"].as<JsonVariantConst>() != FSdata["st"].as<JsonVariantConst>()) {
+        FSdata["st"].set((*in_json)["st"]);
+        touchFSdata();
+    }
+}
+
+/*
+helper that creates the shadow of a delivery in _shadow, the tolerance of each top-level key is taken from FSdata
+*/
+void NahsBricksOS::shadowDelivery(JsonDocument* out_json) {
+    _shadow.hash = 2166136261UL;
+    _shadow.count = 0;
+    for (JsonPairConst kv : out_json->as<JsonObjectConst>()) {
+        hashBytes(&_shadow.hash, kv.key().c_str(), strlen(kv.key().c_str()));
+        scanDelivery(kv.value(), FSdata["st"][kv.key().c_str()].as<float>());
+    }
+}
+
+/*
+helper that adds value to the shadow in _shadow, numbers with tolerance are kept as values, everything else is hashed
+this function recurses into objects and arrays
+*/
+void NahsBricksOS::scanDelivery(JsonVariantConst value, float tolerance) {
+    if (value.is<JsonObjectConst>()) {
+        hashBytes(&_shadow.hash, "{", 1);
+        for (JsonPairConst kv : value.as<JsonObjectConst>()) {
+            hashBytes(&_shadow.hash, kv.key().c_str(), strlen(kv.key().c_str()));
+            scanDelivery(kv.value(), tolerance);
+        }
+        hashBytes(&_shadow.hash, "}", 1);
+    }
+    else if (value.is<JsonArrayConst>()) {
+        hashBytes(&_shadow.hash, "[", 1);
+        for (JsonVariantConst item : value.as<JsonArrayConst>()) scanDelivery(item, tolerance);
+        hashBytes(&_shadow.hash, "]", 1);
+    }
+    else if (tolerance > 0 && value.is<float>() && _shadow.count < BRICKS_OS_SHADOW_VALUES) {
+        _shadow.values[_shadow.count] = value.as<float>();
+        _shadow.tolerances[_shadow.count++] = tolerance;
+        hashBytes(&_shadow.hash, "#", 1);
+    }
+    else if (value.is<const char*>()) {
+        hashBytes(&_shadow.hash, value.as<const char*>(), strlen(value.as<const char*>()) + 1);
+    }
+    else if (value.is<bool>()) {
+        hashBytes(&_shadow.hash, value.as<bool>() ? "t" : "f", 1);
+    }
+    else if (value.isNull()) {
+        hashBytes(&_shadow.hash, "n", 1);
+    }
+    else {
+        double number = value.as<double>();
+        hashBytes(&_shadow.hash, &number, sizeof(number));
+    }
+}
+
+/*
+helper that compares the shadow of the current reading with the last recorded one
+returns true if any value differs more than it's tolerance, or if change-suppression is disabled
+*/
+bool NahsBricksOS::deliveryChanged() {
+    if (_config.maxSilence == 0) return true;
+    if (_shadow.hash != RTCdata->shadowHash || _shadow.count != RTCdata->shadowCount) return true;
+    for (uint8_t i = 0; i < _shadow.count; ++i) {
+        if (fabs(_shadow.values[i] - RTCdata->shadowValues[i]) > _shadow.tolerances[i]) return true;
+    }
+    return false;
+}
+
+/*
+helper that keeps the shadow of the current reading in RTCmem as the last recorded one
+*/
+void NahsBricksOS::recordDelivery() {
+    RTCdata->shadowHash = _shadow.hash;
+    RTCdata->shadowCount = _shadow.count;
+    memcpy(RTCdata->shadowValues, _shadow.values, sizeof(RTCdata->shadowValues));
+}
+
+/*
+helper that returns true if a delivery fits into the RTCmem backlog without dropping older readings, always false if the backlog is disabled
+*/
+bool NahsBricksOS::backlogFits(JsonDocument* out_json) {
+#if BRICKS_OS_BACKLOG_SIZE > 0
+    return RTCbacklog->used + 5 + measureMsgPack(*out_json) <= sizeof(RTCbacklog->data);
+#else
+    return false;
+#endif
+}
+
+/*
+helper that returns the number of readings in the RTCmem backlog
+*/
+uint8_t NahsBricksOS::getBacklogCount() {
+#if BRICKS_OS_BACKLOG_SIZE > 0
+    return RTCbacklog->count;
+#else
+    return 0;
+#endif
+}
+
+/*
+helper that keeps a delivery, which could not be transmitted, in the RTCmem backlog
+the oldest readings are dropped if there is not enough space left
+*/
+void NahsBricksOS::pushBacklog(JsonDocument* out_json) {
+#if BRICKS_OS_BACKLOG_SIZE > 0
+    size_t len = measureMsgPack(*out_json);
+    if (len > 255 || 5 + len > sizeof(RTCbacklog->data)) return;
+    while (RTCbacklog->used + 5 + len > sizeof(RTCbacklog->data)) dropBacklog(1);
+    uint8_t* entry = RTCbacklog->data + RTCbacklog->used;
+    uint32_t uptime = getUptime();
+    memcpy(entry, &uptime, 4);
+    entry[4] = len;
+    serializeMsgPack(*out_json, entry + 5, len);
+    RTCbacklog->used += 5 + len;
+    RTCbacklog->count++;
+#endif
+}
+
+/*
+helper that adds the readings of the RTCmem backlog to out_json as "bl", each as [age in s, delivery]
+returns the number of readings added, readings not fitting into out_json (measured in advance) stay for later cycles
+*/
+uint8_t NahsBricksOS::deliverBacklog(JsonDocument* out_json) {
+#if BRICKS_OS_BACKLOG_SIZE > 0
+    if (RTCbacklog->count == 0) return 0;
+    JsonArray bl = out_json->createNestedArray("bl");
+    DynamicJsonDocument reading(512);
+    uint32_t now = getUptime();
+    uint16_t offset = 0;
+    uint8_t added = 0;
+    while (added < RTCbacklog->count) {
+        uint8_t* entry = RTCbacklog->data + offset;
+        uint32_t uptime;
+        memcpy(&uptime, entry, 4);
+        deserializeMsgPack(reading, (const char*)(entry + 5), entry[4]);
+
+        //------------------------------------------
+        // measure before adding, so a reading that does not fit is not counted as overflow of out_json
+        size_t needed = reading.memoryUsage() + JSON_ARRAY_SIZE(1) + JSON_ARRAY_SIZE(2);
+        if (out_json->memoryUsage() + needed > out_json->capacity()) break;
+        JsonArray item = bl.createNestedArray();
+        item.add(now - uptime);
+        item.add(reading.as<JsonObject>());
+        offset += 5 + entry[4];
+        ++added;
+    }
+    if (added == 0) out_json->remove("bl");
+    return added;
+#else
+    return 0;
+#endif
+}
+
+/*
+helper that drops the given count of oldest readings from the RTCmem backlog
+*/
+void NahsBricksOS::dropBacklog(uint8_t count) {
+#if BRICKS_OS_BACKLOG_SIZE > 0
+    if (count > RTCbacklog->count) count = RTCbacklog->count;
+    uint16_t offset = 0;
+    for (uint8_t i = 0; i < count; ++i) offset += 5 + RTCbacklog->data[offset + 4];
+    memmove(RTCbacklog->data, RTCbacklog->data + offset, RTCbacklog->used - offset);
+    RTCbacklog->used -= offset;
+    RTCbacklog->count -= count;
+#endif
+}
+
+/*
+helper that returns a fingerprint of the running sketch (a hash of all of it's words) to detect a newly flashed sketch
+any rebuild changes it, but it is still much cheaper than the sketch's MD5
+*/
+uint32_t NahsBricksOS::getSketchFingerprint() {
+    uint32_t size = ESP.getSketchSize();
+    uint32_t buffer[64];
+    uint32_t hash = 2166136261UL ^ size;
+    for (uint32_t address = 0; address < size; address += sizeof(buffer)) {
+        uint32_t len = min(size - address, (uint32_t)sizeof(buffer));
+        memset(buffer, 0, sizeof(buffer));
+        ESP.flashRead(address, buffer, (len + 3) & ~3UL);
+        for (uint8_t i = 0; i < (len + 3) / 4; ++i) {
+            hash ^= buffer[i];
+            hash *= 16777619UL;
+        }
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/*
+helper that marks BrickOS's config as possibly changed, so it is checked for changes on next writeFSmem (and the typed config is updated)
+*/
+void NahsBricksOS::touchFSdata() {
+    _FSdataTouched = true;
+    buildConfig();
+}
+
+/*
+helper that returns a checksum of BrickOS's config
+*/
+uint32_t NahsBricksOS::getFSdataChecksum() {
+    HashPrint checksum;
+    serializeMsgPack(FSdata, checksum);
+    return checksum.hash;
+}
+
+/*
+helper that persists FSmem (if needed) and RTCmem once at the end of a cycle, the time this takes is kept as persist phase
+the trace goes to EEPROM only if the cycle failed or was slow, so regular cycles do not wear the flash
+*/
+void NahsBricksOS::commitMem() {
+    uint32_t start = micros();
+    writeFSmem();
+    _phaseTimes[PHASE_PERSIST] = micros() - start;
+    memcpy(RTCdata->phaseTimes, _phaseTimes, sizeof(_phaseTimes));
+    if (_trace != nullptr && _traceKeep) writeTrace();
+    RTCmem.write();
+}
+
+/*
+helper that starts recording a trace of this cycle, the trace is kept in RAM (until writeTrace if the cycle failed or was slow)
+*/
+void NahsBricksOS::startTrace() {
+    _trace = (uint8_t*)malloc(BRICKS_OS_TRACE_SIZE);
+    _traceUsed = 0;
+    _traceTruncated = false;
+    _traceUptime = getUptime();
+}
+
+/*
+helper that appends an entry as type (1 byte), millis (4 bytes), length (2 bytes) and data to the trace
+returns a pointer to the data of the entry, data is only copied into it if given (nullptr if the entry did not fit or nothing is recorded)
+*/
+uint8_t* NahsBricksOS::traceRecord(uint8_t type, const void* data, uint16_t len) {
+    if (_trace == nullptr) return nullptr;
+    if (_traceUsed + 7 + len > BRICKS_OS_TRACE_SIZE) {
+        _traceTruncated = true;
+        return nullptr;
+    }
+    uint8_t* entry = _trace + _traceUsed;
+    uint32_t now = millis();
+    entry[0] = type;
+    memcpy(entry + 1, &now, 4);
+    memcpy(entry + 5, &len, 2);
+    if (data != nullptr) memcpy(entry + 7, data, len);
+    _traceUsed += 7 + len;
+    return entry + 7;
+}
+
+/*
+helper that appends a document (MessagePack encoded) to the trace
+*/
+void NahsBricksOS::traceDoc(uint8_t type, JsonDocument* doc) {
+    if (_trace == nullptr) return;
+    size_t len = measureMsgPack(*doc);
+    uint8_t* body = len <= 65535 ? traceRecord(type, nullptr, len) : nullptr;
+    if (body != nullptr) serializeMsgPack(*doc, body, len);
+    else _traceTruncated = true;
+}
+
+/*
+helper that appends the WiFi status to the trace, if it changed since it got recorded last
+*/
+void NahsBricksOS::traceWifi() {
+    uint8_t status = WiFi.status();
+    if (_trace == nullptr || status == _traceWifiStatus) return;
+    _traceWifiStatus = status;
+    traceRecord(TRACE_WIFI, &status, 1);
+}
+
+/*
+helper that writes the trace of this cycle to EEPROM, replacing the one kept before
+*/
+void NahsBricksOS::writeTrace() {
+    _TraceHeader header = {traceMagic, _traceUsed, _traceTruncated, _traceUptime};
+    beginEEPROM();
+    EEPROM.put(BRICKS_OS_EEPROM_OFFSET, header);
+    memcpy(EEPROM.getDataPtr() + BRICKS_OS_EEPROM_OFFSET + sizeof(header), _trace, _traceUsed);
+    EEPROM.end();
+    RTCdata->traceKept = true;
+}
+
+/*
+helper that uploads the trace kept in EEPROM (if it is not uploaded yet) and the trace of this cycle recorded so far to BrickServer
+returns true if all of them got accepted (or if there is none)
+*/
+bool NahsBricksOS::uploadTrace() {
+    //------------------------------------------
+    // the trace of a failed or slow cycle goes first
+    if (RTCdata->traceKept) {
+        _TraceHeader header;
+        beginEEPROM();
+        EEPROM.get(BRICKS_OS_EEPROM_OFFSET, header);
+        bool valid = header.magic == traceMagic && header.used <= BRICKS_OS_TRACE_SIZE;
+        bool accepted = !valid || postTrace(&header, EEPROM.getConstDataPtr() + BRICKS_OS_EEPROM_OFFSET + sizeof(header));
+        EEPROM.end();
+        if (!accepted) return false;
+        RTCdata->traceKept = false;
+    }
+
+    //------------------------------------------
+    // followed by the one of this cycle, straight from RAM
+    if (_trace == nullptr) return true;
+    _TraceHeader header = {traceMagic, _traceUsed, _traceTruncated, _traceUptime};
+    return postTrace(&header, _trace);
+}
+
+/*
+helper that posts a trace (header and entries) to BrickServer as POST /trace, returns true if it got accepted
+*/
+bool NahsBricksOS::postTrace(const _TraceHeader* header, const uint8_t* data) {
+    WiFiClient client;
+    client.setTimeout(httpTimeout);
+    IPAddress serverIP;
+    if (!resolveBrickServer(&serverIP, false) || !client.connect(serverIP, _config.port)) return false;
+    ChunkedClientPrint request(client);
+    request.print(F("POST /trace HTTP/1.0\r\nHost: "));
+    request.print(_config.host);
+    request.print(':');
+    request.print(_config.port);
+    request.print(F("\r\nContent-Type: application/octet-stream\r\nContent-Length: "));
+    request.print(sizeof(*header) + header->used);
+    request.print(F("\r\nConnection: close\r\n\r\n"));
+    request.write((const uint8_t*)header, sizeof(*header));
+    request.write(data, header->used);
+    request.flushChunk();
+    char line[64];
+    readHttpLine(client, line, sizeof(line));
+    client.stop();
+    return strncmp(line, "HTTP/1.", 7) == 0 && strlen(line) > 9 && atoi(line + 9) == 200;
+}
+
+/*
+prints the trace kept in EEPROM (the one of the last failed or slow cycle) to Serial as hex dump (header included)
+*/
+void NahsBricksOS::printTrace() {
+    _TraceHeader header;
+    beginEEPROM();
+    EEPROM.get(BRICKS_OS_EEPROM_OFFSET, header);
+    if (header.magic != traceMagic || header.used > BRICKS_OS_TRACE_SIZE) {
+        Serial.println("trace: none");
+        EEPROM.end();
+        return;
+    }
+    Serial.print("trace: ");
+    Serial.print(header.used);
+    Serial.print(" bytes of failed or slow cycle at uptime ");
+    Serial.print(header.uptime);
+    Serial.println(header.truncated ? " (truncated)" : "");
+    const uint8_t* data = EEPROM.getConstDataPtr() + BRICKS_OS_EEPROM_OFFSET;
+    for (size_t i = 0; i < sizeof(header) + header.used; ++i) {
+        if (data[i] < 0x10) Serial.print("0");
+        Serial.print(data[i], HEX);
+        if (i % 32 == 31) Serial.println();
+    }
+    Serial.println();
+    EEPROM.end();
+}
+
+/*
+helper that stores the time spent since the previous mark as duration of the given phase
+*/
+void NahsBricksOS::markPhase(uint8_t phase) {
+    uint32_t now = micros();
+    _phaseTimes[phase] = now - _phaseStart;
+    if (phase <= PHASE_TRANSMIT && millis() > traceSlowCycle) _traceKeep = true;
+    recordHeap(phase);
+    uint8_t entry[5] = {phase};
+    memcpy(entry + 1, &_phaseTimes[phase], 4);
+    traceRecord(TRACE_PHASE, entry, sizeof(entry));
+    _phaseStart = micros();
+}
+
+/*
+helper that keeps the worst heap and stack values seen at the end of the given phase in RTCmem (if heap statistics are enabled)
+*/
+void NahsBricksOS::recordHeap(uint8_t phase) {
+#if BRICKS_OS_HEAP_STATS
+    uint32_t heap = ESP.getFreeHeap();
+    if (heap < RTCheapStats->heapMin) {
+        RTCheapStats->heapMin = heap;
+        RTCheapStats->heapMinPhase = phase;
+    }
+    uint32_t block = ESP.getMaxFreeBlockSize();
+    if (block < RTCheapStats->blockMin) RTCheapStats->blockMin = block;
+    uint8_t frag = ESP.getHeapFragmentation();
+    if (frag > RTCheapStats->fragMax) RTCheapStats->fragMax = frag;
+    uint32_t stack = ESP.getFreeContStack();
+    if (stack < RTCheapStats->stackMin) RTCheapStats->stackMin = stack;
+#endif
+}
+
+/*
+helper that keeps the highest memory usage of sent or received documents (if heap statistics are enabled) and counts the document if it overflowed
+*/
+void NahsBricksOS::recordDoc(JsonDocument* doc, bool received) {
+#if BRICKS_OS_HEAP_STATS
+    uint16_t* usageMax = received ? &RTCheapStats->inDocMax : &RTCheapStats->outDocMax;
+    size_t usage = doc->memoryUsage();
+    if (usage > *usageMax) *usageMax = min(usage, (size_t)65535);
+#endif
+    if (doc->overflowed() && RTCdata->docOverflows < 65535) RTCdata->docOverflows++;
+}
+
+/*
+helper that starts recording of heap statistics over again
+*/
+void NahsBricksOS::resetHeapStats() {
+#if BRICKS_OS_HEAP_STATS
+    RTCheapStats->heapStatsRequested = false;
+    RTCheapStats->heapMin = 65535;
+    RTCheapStats->heapMinPhase = PHASE_BEGIN;
+    RTCheapStats->blockMin = 65535;
+    RTCheapStats->fragMax = 0;
+    RTCheapStats->stackMin = 65535;
+    RTCheapStats->outDocMax = 0;
+    RTCheapStats->inDocMax = 0;
+#endif
+}
+
+/*
+helper that copies a string into a fixed size buffer, it gets truncated if it does not fit
+*/
+static void copyConfigString(char* buffer, size_t size, const char* value) {
+    if (value == nullptr) value = "";
+    strlcpy(buffer, value, size);
+}
+
+/*
+helper that builds the typed config from FSdata
+*/
+void NahsBricksOS::buildConfig() {
+    memset(&_config, 0, sizeof(_config));
+    copyConfigString(_config.ssid, sizeof(_config.ssid), FSdata["ssid"].as<const char*>());
+    copyConfigString(_config.pass, sizeof(_config.pass), FSdata["pass"].as<const char*>());
+    copyConfigString(_config.ident, sizeof(_config.ident), FSdata["id"].as<const char*>());
+
+    //------------------------------------------
+    // split BrickServer's URL into host and port
+    const char* url = FSdata["url"] | "";
+    if (strncmp(url, "http://", 7) == 0) url += 7;
+    size_t hostLen = strcspn(url, ":/");
+    strlcpy(_config.host, url, min(hostLen + 1, sizeof(_config.host)));
+    _config.port = (url[hostLen] == ':') ? atoi(url + hostLen + 1) : 80;
+
+    //------------------------------------------
+    // permanent static IP is only used if IP, gateway and netmask are valid
+    IPAddress ip, gateway, subnet, dns;
+    if (ip.fromString(FSdata["ip"] | "") && gateway.fromString(FSdata["gw"] | "") && subnet.fromString(FSdata["nm"] | "")) {
+        if (!dns.fromString(FSdata["dns"] | "")) dns = gateway;
+        _config.ip = ip;
+        _config.gateway = gateway;
+        _config.subnet = subnet;
+        _config.dns = dns;
+    }
+
+    _config.leaseCache = FSdata["lc"].as<uint32_t>();
+    _config.maxSilence = FSdata["ms"].as<uint32_t>();
+    _config.transmitEvery = FSdata["bn"].as<uint8_t>();
+    _config.msgPack = FSdata["mp"].as<bool>();
+    _config.phaseTimings = FSdata["tm"].as<bool>();
+    _config.deepSleep = FSdata["ds"].as<bool>();
+    _config.trace = FSdata["tc"].as<bool>();
+    _config.udpPort = FSdata["up"].as<uint16_t>();
+}
+
+/*
+helper that begins EEPROM with the whole sector, as committing erases all of it and writes back only the bytes begun with (the sketch's EEPROM data would get lost otherwise)
+*/
+void NahsBricksOS::beginEEPROM() {
+    static_assert(BRICKS_OS_EEPROM_OFFSET + sizeof(_TraceHeader) + BRICKS_OS_TRACE_SIZE <= SPI_FLASH_SEC_SIZE, "trace does not fit into EEPROM");
+    EEPROM.begin(SPI_FLASH_SEC_SIZE);
+}
+
+/*
+helper that resolves the IP of BrickServer, served from RTCmem cache while it is younger than dnsCacheTTL (unless fresh is set)
+returns false if the host could not be resolved
+*/
+bool NahsBricksOS::resolveBrickServer(IPAddress* ip, bool fresh) {
+    _hostIPFromCache = false;
+    if (ip->fromString(_config.host)) return true;
+    if (!fresh && RTCmem.isValid() && RTCdata->hostIP != 0 && getUptime() - RTCdata->hostResolved < dnsCacheTTL) {
+        *ip = RTCdata->hostIP;
+        _hostIPFromCache = true;
+        return true;
+    }
+    RTCdata->hostIP = 0;
+    if (!WiFi.hostByName(_config.host, *ip)) return false;
+    RTCdata->hostIP = *ip;
+    RTCdata->hostResolved = getUptime();
+    return true;
+}
+
+/*
+helper that returns the capacity of a JsonDocument needed to parse a body of contentLength bytes
+returns 0 if a document of that capacity would not fit into the largest free heap block (minus heapReserve)
+*/
+size_t NahsBricksOS::getDocCapacity(size_t contentLength, bool msgPack) {
+    size_t capacity = contentLength * (msgPack ? BRICKS_OS_DOC_FACTOR_MSGPACK : BRICKS_OS_DOC_FACTOR_JSON);
+    if (capacity < defaultDocSize) capacity = defaultDocSize;
+    size_t available = ESP.getMaxFreeBlockSize();
+    if (available <= heapReserve + contentLength) return 0;
+    if (capacity > available - heapReserve) capacity = available - heapReserve;
+    return capacity;
+}
+
+/*
+helper that decides if this wake is sure to transmit, only then WiFi is started right away (otherwise the radio is kept off)
+a due wake is sure to transmit unless it might be suppressed, which is only known after the delivery (and never if readings are waiting in backlog)
+without backlog every wake is due, as there is nowhere to keep the readings of sampling wakes
+*/
+void NahsBricksOS::decideWake() {
+    if (RTCdata->wakes < 255) RTCdata->wakes++;
+    bool valid = RTCmem.isValid();
+    _transmitDue = !valid || RTCdata->wakes >= _config.transmitEvery || BRICKS_OS_BACKLOG_SIZE == 0;
+    bool forced = !valid || RTCdata->otaUpdateRequested || RTCdata->sketchMD5Requested || RTCdata->heartbeatRequested || (_config.maxSilence > 0 && getUptime() - RTCdata->lastTransmit >= _config.maxSilence);
+    _transmitWake = forced || (_transmitDue && (_config.maxSilence == 0 || getBacklogCount() > 0));
+    if (_transmitWake) connectWifi();
+    else WiFi.forceSleepBegin();
+}
+
+/*
+helper that returns the seconds the Brick has been running since RTCmem got initialized (including the current cycle)
+*/
+uint32_t NahsBricksOS::getUptime() {
+    return RTCdata->uptime + (millis() + 500) / 1000;
+}
+
 
 //------------------------------------------
 // globally predefined variable
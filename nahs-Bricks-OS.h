@@ -6,29 +6,226 @@
 #include <nahs-Bricks-Lib-FSmem.h>
 #include <nahs-Bricks-Feature-All.h>
 
+#ifndef BRICKS_OS_BACKLOG_SIZE
+#define BRICKS_OS_BACKLOG_SIZE 128  // bytes of RTCmem used to keep readings that could not be transmitted (0 disables the backlog, and with it sampling wakes)
+#endif
+
+#ifndef BRICKS_OS_HEAP_STATS
+#define BRICKS_OS_HEAP_STATS 0  // 1 keeps heap statistics (delivered by request 22) in RTCmem
+#endif
+
+#ifndef BRICKS_OS_SHADOW_VALUES
+#define BRICKS_OS_SHADOW_VALUES 8  // number of values with tolerance kept in RTCmem to detect unchanged readings
+#endif
+
+#ifndef BRICKS_OS_AP_CANDIDATES
+#define BRICKS_OS_AP_CANDIDATES 3  // number of APs (with their connection history) kept in RTCmem for quick connect
+#endif
+
+#ifndef BRICKS_OS_EEPROM_OFFSET
+#define BRICKS_OS_EEPROM_OFFSET 0  // first byte of EEPROM used by BrickOS for the trace (only written if the trace is enabled)
+#endif
+
+#ifndef BRICKS_OS_TRACE_SIZE
+#define BRICKS_OS_TRACE_SIZE 2048  // bytes of RAM (while recording) and EEPROM used for the trace of a cycle (EEPROM only keeps the one of the last failed or slow cycle)
+#endif
+
+#ifndef BRICKS_OS_DOC_FACTOR_JSON
+#define BRICKS_OS_DOC_FACTOR_JSON 8  // capacity of a received JsonDocument per byte of JSON body
+#endif
+
+#ifndef BRICKS_OS_DOC_FACTOR_MSGPACK
+#define BRICKS_OS_DOC_FACTOR_MSGPACK 16  // capacity of a received JsonDocument per byte of MessagePack body (it is denser than JSON)
+#endif
+
 class NahsBricksOS {
     private:
         static const uint8_t version = 3;
         static const uint16_t copyrightYear = 2023;
+        static const uint16_t wifiTimeout = 10000;  // ms after connectWifi the WiFi connection has to be established
+        static const uint16_t quickConnectMin = 500;  // ms a quick connect to a known AP is given at least
+        static const uint16_t quickConnectMax = 2000;  // ms a quick connect to a known AP is given at most (and if it has no history)
+        static const uint16_t quickConnectMargin = 200;  // ms added to twice the average association time of an AP for it's quick connect
+        static const uint8_t apFailsMax = 3;  // consecutive failed quick connects after which an AP is forgotten
+        static const uint16_t httpTimeout = 5000;  // ms the exchange with BrickServer may take
+        static const uint16_t cycleTimeout = 20000;  // ms after boot the transmission to BrickServer has to be started
+        static const uint16_t backoffMax = 3600;  // s a Brick sleeps at most after failed cycles
+        static const uint16_t dnsCacheTTL = 3600;  // s the resolved IP of BrickServer is reused for
+        static const uint16_t activatorPoll = 10;  // ms between polls for Activator events
+        static const uint16_t activatorExtension = 5000;  // ms the Activator window stays open at least after an event
+        static const uint16_t deepSleepWindow = 1000;  // ms the Activator window stays open in deep-sleep mode
+        static const uint16_t defaultDocSize = 1024;  // capacity of a received JsonDocument if the body's size is unknown, and the least one it gets
+        static const uint16_t heapReserve = 4096;  // bytes of heap kept free when sizing a received JsonDocument
+        static const uint8_t jitterPercent = 10;  // max random extension in % of cycles without assigned wake slot
+        static const uint16_t driftSyncMin = 600;  // s between two slot assignments at least to measure the drift
+        static const int32_t driftMax = 50000;  // ppm the measured drift is limited to
+        static const uint16_t configResetDebounce = 400;  // ms after a falling edge of the setup pin further edges are taken as bounces
+        static const uint32_t traceMagic = 0x42435401;  // marks a valid trace in EEPROM, last byte is the format version
+        static const uint16_t traceSlowCycle = 5000;  // ms a cycle may take until it's transmission is done, the trace of a slower one is kept in EEPROM
+        static const uint32_t patchMagic = 0x42445001;  // marks a firmware patch, last byte is the format version
+        static const uint16_t stageBudget = 2000;  // ms each cycle may spend on staging an OTA update
+        static const uint16_t udpTimeout = 250;  // ms to wait for the answer to a datagram, doubled with each retransmission
+        static const uint8_t udpRetransmits = 2;  // number of retransmissions of a datagram before falling back to HTTP
+        static const uint8_t udpFailsMax = 3;  // consecutive cycles that failed via UDP after which UDP is only tried every 16th cycle
+        static const uint16_t udpPayloadMax = 1024;  // bytes a datagram's payload may have, larger transmissions are done via HTTP
+        enum _Phase : uint8_t {  // phases of a cycle as timed by markPhase
+            PHASE_BEGIN,  // boot and begin of all features
+            PHASE_START,  // connectWifi and start of all features
+            PHASE_DELIVER,  // deliver of all features
+            PHASE_WIFI,  // waiting for WiFi connection
+            PHASE_TRANSMIT,  // transmitting to BrickServer
+            PHASE_FEEDBACK,  // processing feedback of BrickServer
+            PHASE_PERSIST,  // writing FSmem and RTCmem (once at the end of a cycle)
+            PHASE_ACTIVATOR,  // Activator window
+            PHASE_COUNT
+        };
+        enum _TraceType : uint8_t {  // types of trace entries
+            TRACE_PHASE,  // end of a phase: phase (1 byte) and it's duration in us (4 bytes)
+            TRACE_WIFI,  // WiFi status changed: new status (1 byte)
+            TRACE_OUT,  // out_json as MessagePack
+            TRACE_IN,  // answer of BrickServer as MessagePack
+            TRACE_ACTIVATOR,  // Activator event as MessagePack
+        };
+        typedef struct {
+            uint32_t magic;  // traceMagic if a trace is kept
+            uint16_t used;  // bytes of trace entries following the header
+            bool truncated;  // trace did not fit into BRICKS_OS_TRACE_SIZE
+            uint32_t uptime;  // uptime the traced cycle started at
+        } _TraceHeader;
+        enum _ConfigResetState : uint8_t {  // states of handleConfigResetRequest
+            RESET_IDLE,  // waiting for a falling edge of the setup pin
+            RESET_DEBOUNCE,  // waiting for the setup pin to settle
+            RESET_BLINK,  // blinking the onboard led to acknowledge the request
+            RESET_DESTROYED,  // config is destroyed, lighting up the onboard led before the restart
+        };
+        typedef struct {
+            uint8_t bssid[6];  // MAC-Address of AP
+            uint8_t channel;  // WiFi-Channel of AP (0 if candidate is unused)
+            uint16_t assocTime;  // average time in ms the connection to this AP took
+            uint8_t fails;  // number of consecutive failed quick connects to this AP
+        } _APcandidate;
         typedef struct {
-            uint8_t channel;  // WiFi-Channel to be used
-            uint8_t ap_mac[6];  // MAC-Address of AP to be used
+            _APcandidate aps[BRICKS_OS_AP_CANDIDATES];  // APs used before, tried for quick connect
             bool sketchMD5Requested;
             bool otaUpdateRequested;
+            uint32_t phaseTimes[PHASE_COUNT];  // duration of each phase of previous cycle in us
+            uint32_t uptime;  // seconds the Brick has been running since RTCmem got initialized
+            uint32_t leaseIP;  // cached DHCP lease (0 if none is cached)
+            uint32_t leaseGateway;
+            uint32_t leaseSubnet;
+            uint32_t leaseDNS;
+            uint32_t leaseStart;  // uptime the cached DHCP lease was obtained at
+            uint8_t failures;  // number of consecutive cycles that failed to reach BrickServer
+            uint8_t wakes;  // number of wakes since last transmission
+            bool heartbeatRequested;  // next wake has to transmit, even if reading did not change
+            uint32_t lastTransmit;  // uptime of last successful transmission
+            uint32_t shadowHash;  // hash of last recorded reading, without values with tolerance
+            uint8_t shadowCount;  // number of values with tolerance in last recorded reading
+            float shadowValues[BRICKS_OS_SHADOW_VALUES];  // values with tolerance of last recorded reading
+            uint16_t fsWrites;  // number of FSmem writes
+            uint16_t fsWritesSkipped;  // number of FSmem writes skipped as BrickOS's config did not change
+            uint32_t fsWriteTime;  // duration of last FSmem write in us
+            uint32_t hostIP;  // cached resolved IP of BrickServer (0 if none is cached)
+            uint32_t hostResolved;  // uptime the cached IP of BrickServer got resolved at
+            uint16_t docOverflows;  // number of documents that overflowed (or were too large to be parsed)
+            uint16_t slotPeriod;  // s between wake slots assigned by BrickServer (0 if none is assigned)
+            uint32_t slotAt;  // uptime of the last assigned wake slot
+            int32_t slotDrift;  // ppm the Brick's uptime runs fast (or slow if negative) compared to BrickServer
+            bool traceUploadRequested;  // next transmitting cycle has to upload it's trace (and the one kept in EEPROM)
+            bool traceKept;  // EEPROM keeps a trace that is not uploaded yet
+            bool stageActive;  // OTA update is being staged (size and MD5 of the image are kept in FSdata)
+            uint32_t stageDone;  // bytes of the image already staged
+            uint16_t udpMessageId;  // message ID of the last datagram sent to BrickServer
+            uint8_t udpFails;  // number of consecutive transmissions not done via UDP
+            uint16_t wireSent;  // bytes sent by the last transmission (HTTP head and body, or all datagrams)
+            uint16_t wireReceived;  // bytes received by the last transmission (HTTP head and body, or acknowledgement)
         } _RTCdata;
         _RTCdata* RTCdata = RTCmem.registerData<_RTCdata>();
+#if BRICKS_OS_BACKLOG_SIZE > 0
+        typedef struct {
+            uint8_t count;  // number of readings in data
+            uint16_t used;  // bytes used in data
+            uint8_t data[BRICKS_OS_BACKLOG_SIZE];  // readings, each as uptime (4 bytes), length (1 byte) and MessagePack encoded delivery
+        } _RTCbacklog;
+        _RTCbacklog* RTCbacklog = RTCmem.registerData<_RTCbacklog>();
+#endif
+#if BRICKS_OS_HEAP_STATS
+        typedef struct {
+            bool heapStatsRequested;  // next transmission has to deliver the heap statistics
+            uint16_t heapMin;  // lowest free heap seen at the end of a phase
+            uint8_t heapMinPhase;  // phase heapMin was seen at
+            uint16_t blockMin;  // lowest max free heap block seen at the end of a phase
+            uint8_t fragMax;  // highest heap fragmentation in % seen at the end of a phase
+            uint16_t stackMin;  // lowest free stack (high-water mark) seen at the end of a phase
+            uint16_t outDocMax;  // highest memory usage of out_json
+            uint16_t inDocMax;  // highest memory usage of a received document
+        } _RTCheapStats;
+        _RTCheapStats* RTCheapStats = RTCmem.registerData<_RTCheapStats>();
+#endif
         JsonObject FSdata = FSmem.registerData("os");
+        typedef struct {
+            char ssid[33];
+            char pass[65];
+            char host[64];  // host of BrickServer's URL
+            char ident[33];
+            uint16_t port;  // port of BrickServer's URL
+            uint32_t ip;  // permanent static IP (0 for DHCP)
+            uint32_t gateway;
+            uint32_t subnet;
+            uint32_t dns;
+            uint32_t leaseCache;  // max age of cached DHCP lease in s
+            uint32_t maxSilence;  // max silence in s for change-suppression
+            uint8_t transmitEvery;  // transmit every N wakes
+            bool msgPack;
+            bool phaseTimings;
+            bool deepSleep;  // sleep in deep-sleep between cycles (needs GPIO16 wired to RST)
+            bool trace;  // record a trace of each cycle
+            uint16_t udpPort;  // UDP port of BrickServer (0 for HTTP only)
+        } _Config;
+        _Config _config;  // typed copy of FSdata, used for all hot-path config reads
         uint8_t _setupPin;
-        bool _activatorEventReceived;
+        bool _activatorDone;
         bool _writeFSmemRequested;
+        bool _FSdataTouched;
+        uint32_t _FSdataChecksum;
+        bool _leaseCacheUsed;
+        bool _hostIPFromCache;
+        bool _wifiStarted;
+        bool _transmitDue;
+        bool _transmitWake;
         int configResetRequestsCount = 0;
+        uint8_t _configResetState;
+        uint8_t _configResetStep;  // led steps done in current state
+        uint32_t _configResetNext;  // millis the current state has to be continued at
+        uint32_t _configResetEdgesSeen;  // number of falling edges of the setup pin already handled
+        uint32_t _wifiStart;
+        uint32_t _attemptStart;  // millis the current attempt to connect to an AP got started at
+        int8_t _apTried;  // index of AP candidate tried by quick connect (-1 if none)
+        uint32_t _phaseStart;
+        uint32_t _phaseTimes[PHASE_COUNT];
+        typedef struct {
+            uint32_t hash;
+            uint8_t count;
+            float values[BRICKS_OS_SHADOW_VALUES];
+            float tolerances[BRICKS_OS_SHADOW_VALUES];
+        } _Shadow;
+        _Shadow _shadow;  // shadow of current reading, as created by scanDelivery
+        uint8_t* _trace;  // trace entries of current cycle (nullptr if not recording)
+        uint16_t _traceUsed;
+        bool _traceTruncated;
+        bool _traceKeep;  // trace of this cycle has to be kept in EEPROM (cycle failed or was slow)
+        uint32_t _traceUptime;
+        uint8_t _traceWifiStatus;  // WiFi status last recorded in trace
+        bool _udpStarted;
+        bool _udpActivatorSeen;  // _udpActivatorId is valid
+        uint16_t _udpActivatorId;  // message ID of the last Activator event received via UDP
     public:
         NahsBricksOS();
         void setSetupPin(uint8_t pin);
         void handover();
         void connectWifi();
-        void waitWifi();
-        DynamicJsonDocument transmitToBrickServer(DynamicJsonDocument out_json);
+        bool waitWifi();
+        bool transmitToBrickServer(JsonDocument* out_json, DynamicJsonDocument* in_json);
     public:  //used by BrickSetup
         void printRTCdata();
         void printFSdata();
@@ -36,14 +233,73 @@ class NahsBricksOS {
         void setWifiSSID(String ssid);
         void setWifiPass(String pass);
         void setBrickServerURL(String host, long port);
+        void setStaticIP(String ip, String gateway, String subnet, String dns);
+        void setLeaseCache(uint32_t maxAge);
         void setIdent(String ident);
+        String getSketchMD5();
         void requestFSmemWrite();
+        bool writeFSmem();
         void handleConfigResetRequest();
+        void printHeapStats();
+        void printTrace();
     private:
         void begin();
-        void handleActivator();
-        void handleActivatorNotFound();
+        bool handleActivator();
+        bool handleActivatorUdp();
+        bool transmitHttp(JsonDocument* out_json, DynamicJsonDocument* in_json);
+        bool transmitUdp(JsonDocument* out_json, DynamicJsonDocument* in_json);
+        void startUdp();
+        void countWire(size_t sent, size_t received);
         void handleOtaUpdate();
+        bool handleFullUpdate(IPAddress serverIP);
+        bool handleDeltaUpdate(IPAddress serverIP);
+        void stageOtaUpdate();
+        bool stageChunk(uint32_t address);
+        uint32_t getStageAddress();
+        void markPhase(uint8_t phase);
+        void recordHeap(uint8_t phase);
+        void recordDoc(JsonDocument* doc, bool received);
+        void resetHeapStats();
+        void startTrace();
+        uint8_t* traceRecord(uint8_t type, const void* data, uint16_t len);
+        void traceDoc(uint8_t type, JsonDocument* doc);
+        void traceWifi();
+        void writeTrace();
+        bool uploadTrace();
+        bool postTrace(const _TraceHeader* header, const uint8_t* data);
+        void buildConfig();
+        void beginEEPROM();
+        void decideWake();
+        int8_t pickAP();
+        uint16_t getQuickConnectTimeout(uint8_t candidate);
+        bool scanKnownChannels(uint8_t* bssid, uint8_t* channel);
+        void recordAP(uint32_t assocTime);
+        void failAP(uint8_t candidate);
+        bool waitWifiStatus(uint32_t timeout);
+        bool wifiTimedOut();
+        void restartWifi();
+        bool resolveBrickServer(IPAddress* ip, bool fresh);
+        size_t getDocCapacity(size_t contentLength, bool msgPack);
+        void sleepWithBackoff();
+        void sleepAndRestart(uint32_t ms);
+        uint32_t getCycleDelay();
+        void assignWakeSlot(int32_t in, uint16_t period);
+        void evaluateFeedback(JsonDocument* in_json);
+        void shadowDelivery(JsonDocument* out_json);
+        void scanDelivery(JsonVariantConst value, float tolerance);
+        bool deliveryChanged();
+        void recordDelivery();
+        uint32_t getSketchFingerprint();
+        void forgetSketchMD5();
+        void touchFSdata();
+        uint32_t getFSdataChecksum();
+        void commitMem();
+        bool backlogFits(JsonDocument* out_json);
+        uint8_t getBacklogCount();
+        void pushBacklog(JsonDocument* out_json);
+        uint8_t deliverBacklog(JsonDocument* out_json);
+        void dropBacklog(uint8_t count);
+        uint32_t getUptime();
 };
 
 #if !defined(NO_GLOBAL_INSTANCES)
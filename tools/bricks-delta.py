@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""
+Creates a firmware patch for the delta OTA update of nahs-Bricks-OS (see PROTOCOL.md)
+
+usage: bricks-delta.py <old firmware.bin> <new firmware.bin> <patch>
+
+BrickServer serves the patch as /ota/delta/<MD5 of old firmware>
+"""
+
+import hashlib
+import struct
+import sys
+
+from bricks_protocol import PATCH_MAGIC
+
+BLOCK = 32  # bytes a match has to be long at least to be copied from the old firmware
+INSERT_MAX = 65535
+
+
+def create_patch(old, new):
+    index = {}
+    for pos in range(len(old) - BLOCK, -1, -1):
+        index[old[pos:pos + BLOCK]] = pos
+
+    ops = bytearray()
+    pending = bytearray()
+
+    def flush_insert():
+        for start in range(0, len(pending), INSERT_MAX):
+            chunk = pending[start:start + INSERT_MAX]
+            ops.extend(struct.pack('<BH', 2, len(chunk)))
+            ops.extend(chunk)
+        pending.clear()
+
+    pos = 0
+    while pos < len(new):
+        match = index.get(new[pos:pos + BLOCK]) if pos + BLOCK <= len(new) else None
+        if match is None:
+            pending.append(new[pos])
+            pos += 1
+            continue
+        length = BLOCK
+        while pos + length < len(new) and match + length < len(old) and new[pos + length] == old[match + length]:
+            length += 1
+        flush_insert()
+        ops.extend(struct.pack('<BII', 1, match, length))
+        pos += length
+    flush_insert()
+
+    header = struct.pack('<II', PATCH_MAGIC, len(new)) + hashlib.md5(new).hexdigest().encode()
+    return header + ops
+
+
+def main():
+    if len(sys.argv) != 4:
+        print(__doc__.strip())
+        sys.exit(1)
+    with open(sys.argv[1], 'rb') as f:
+        old = f.read()
+    with open(sys.argv[2], 'rb') as f:
+        new = f.read()
+    patch = create_patch(old, new)
+    with open(sys.argv[3], 'wb') as f:
+        f.write(patch)
+    print(f'{sys.argv[3]}: {len(patch)} bytes ({len(new)} bytes image), apply on MD5 {hashlib.md5(old).hexdigest()}')
+
+
+if __name__ == '__main__':
+    main()
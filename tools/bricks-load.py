@@ -0,0 +1,532 @@
+#!/usr/bin/env python3
+"""
+Load generator for BrickServer, simulating a fleet of nahs-Bricks-OS Bricks (see PROTOCOL.md)
+
+usage: bricks-load.py [options] <BrickServer URL>
+
+Each simulated Brick runs the cycle of the firmware: it wakes every --delay seconds (with jitter, or aligned to the
+wake slot BrickServer assigned), transmits via UDP (if BrickServer set up, with the firmware's retransmissions and HTTP
+fallback) or HTTP within the firmware's timeouts, backs off exponentially after failures, follows the requests and
+settings of the answer (OTA updates included) and then stays in it's Activator window until the next cycle.
+During the window each Brick listens for Activator events on --activator-port of it's own source IP (and on it's UDP
+socket if UDP is used), events extend the window and one with dn closes it; bricks-server.py --push sends them.
+Throughput, failures and latency percentiles are printed every --report seconds and for the whole run.
+"""
+
+import argparse
+import asyncio
+import ipaddress
+import random
+import resource
+import time
+import urllib.parse
+
+import bricks_protocol as bp
+
+
+class Stats:
+    """collects the outcome of transmissions of all Bricks, per report interval and for the whole run"""
+
+    def __init__(self):
+        self.total = self.Interval()
+        self.interval = self.Interval()
+        self.in_window = 0  # Bricks currently in their Activator window
+        self.in_flight = 0  # transmissions currently waiting for BrickServer
+
+    class Interval:
+        def __init__(self):
+            self.started = time.monotonic()
+            self.counts = {}
+            self.latencies = {}
+            self.window_max = 0
+            self.in_flight_max = 0
+
+    def count(self, key, amount=1):
+        for interval in (self.total, self.interval):
+            interval.counts[key] = interval.counts.get(key, 0) + amount
+
+    def latency(self, transport, seconds):
+        for interval in (self.total, self.interval):
+            interval.latencies.setdefault(transport, []).append(seconds)
+
+    def gauge(self, window=0, flight=0):
+        self.in_window += window
+        self.in_flight += flight
+        for interval in (self.total, self.interval):
+            interval.window_max = max(interval.window_max, self.in_window)
+            interval.in_flight_max = max(interval.in_flight_max, self.in_flight)
+
+    def report(self, interval, title):
+        elapsed = max(time.monotonic() - interval.started, 1e-9)
+        counts = interval.counts
+        print(f'{title}: {counts.get("transmitted", 0) / elapsed:.1f} transmissions/s over {elapsed:.0f}s', flush=True)
+        print('  ' + '  '.join(f'{k}: {v}' for k, v in sorted(counts.items())), flush=True)
+        for transport, values in sorted(interval.latencies.items()):
+            print(f'  {transport} ms {format_percentiles(values)} (n={len(values)})', flush=True)
+        print(f'  max in Activator window: {interval.window_max}  max waiting for BrickServer: {interval.in_flight_max}', flush=True)
+
+    def rotate(self):
+        self.report(self.interval, 'last interval')
+        self.interval = self.Interval()
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def format_percentiles(values):
+    return ' '.join(f'p{p}={percentile(values, p) * 1000:.1f}' for p in (50, 90, 99)) + f' max={max(values) * 1000:.1f}'
+
+
+class UdpClient(asyncio.DatagramProtocol):
+    """UDP socket of a Brick, acknowledgements are handed to the transmission waiting for their message ID, Activator events to the Brick"""
+
+    def __init__(self, brick):
+        self.brick = brick
+        self.transport = None
+        self.waiting = {}
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        message = bp.udp_unpack(data)
+        if message is None:
+            return
+        if message[0] == bp.UDP_ACK and message[2] in self.waiting:
+            future = self.waiting.pop(message[2])
+            if not future.done():
+                future.set_result(message)
+        elif message[0] == bp.UDP_CON and message[1] == bp.UDP_POST:
+            self.brick.activator_datagram(self.transport, message)
+
+
+class Brick:
+    def __init__(self, number, args, stats):
+        self.number = number
+        self.args = args
+        self.stats = stats
+        self.random = random.Random(args.seed * 100003 + number)
+        self.source = str(ipaddress.ip_address('127.1.0.0') + number) if args.source_ips else None
+        self.sketch_md5 = f'{self.random.getrandbits(128):032x}'
+
+        # RTCdata and config of the firmware
+        self.first_cycle = True
+        self.failures = 0
+        self.wakes = 0
+        self.md5_requested = False
+        self.heartbeat = False
+        self.msgpack = False
+        self.deep_sleep = False
+        self.bn = 1
+        self.slot_period = 0
+        self.slot_at = 0.0
+        self.udp_port = args.udp_port
+        self.udp_fails = 0
+        self.udp_message_id = self.random.getrandbits(16)
+        self.udp = None
+        self.udp_activator_id = None
+        self.ota_requested = False
+        self.stage_active = False
+        self.stage_done = 0
+
+        # Activator window
+        self.in_window = False
+        self.activator_done = False
+        self.activator_event_seen = asyncio.Event()
+
+    async def run(self):
+        await asyncio.sleep(self.random.uniform(0, self.args.ramp))
+        try:
+            while True:
+                await asyncio.sleep(await self.cycle())
+        finally:
+            if self.udp is not None:
+                self.udp.transport.close()
+
+    async def cycle(self):
+        """runs one cycle, returns the s until the next one is due"""
+        woke = time.monotonic()
+        self.wakes += 1
+
+        # ------------------------------------------
+        # an OTA update requested by the previous cycle is done on boot
+        if self.ota_requested:
+            self.ota_requested = False
+            await self.ota_update()
+
+        # ------------------------------------------
+        # sampling wakes with an unchanged reading keep the radio off
+        changed = self.random.random() < self.args.change
+        if self.wakes < self.bn and not changed and not self.heartbeat and not self.first_cycle:
+            self.stats.count('skipped')
+            return self.cycle_delay()
+
+        # ------------------------------------------
+        # transmit, a failed cycle backs off exponentially
+        delivery = self.delivery()
+        answer = None
+        if time.monotonic() - woke < bp.CYCLE_TIMEOUT:
+            answer = await self.transmit(delivery)
+        if answer is None:
+            self.stats.count('failed')
+            self.failures = min(self.failures + 1, 255)
+            backoff = min(max(self.args.delay, 1) * 2 ** min(self.failures - 1, 12), bp.BACKOFF_MAX)
+            return backoff * (1 + self.random.uniform(0, bp.JITTER_PERCENT / 100))
+        self.stats.count('transmitted')
+        self.first_cycle = False
+        self.failures = 0
+        self.wakes = 0
+        self.md5_requested = False
+        self.heartbeat = False
+        self.evaluate(answer)
+        if self.stage_active:
+            await self.stage_chunks()
+        return await self.activator_window()
+
+    async def activator_window(self):
+        """serves Activator events until the next cycle is due (or the short window of deep-sleep mode expires) or an event
+        carries dn, each event keeps the window open for at least 5s; returns the s until the next cycle is due"""
+        opened = time.monotonic()
+        cycle_end = opened + self.cycle_delay()
+        window_end = min(cycle_end, opened + bp.DEEP_SLEEP_WINDOW) if self.deep_sleep else cycle_end
+        listener = await self.listen_activator()
+        self.in_window = True
+        self.activator_done = False
+        self.stats.gauge(window=1)
+        try:
+            while not self.activator_done:
+                remaining = window_end - time.monotonic()
+                if remaining <= 0:
+                    break
+                self.activator_event_seen.clear()
+                try:
+                    await asyncio.wait_for(self.activator_event_seen.wait(), remaining)
+                except asyncio.TimeoutError:
+                    break
+                window_end = max(window_end, time.monotonic() + bp.ACTIVATOR_EXTENSION)
+        finally:
+            self.in_window = False
+            self.stats.gauge(window=-1)
+            if listener is not None:
+                listener.close()
+        return max(cycle_end - time.monotonic(), 0)
+
+    def delivery(self):
+        delivery = {}
+        if self.first_cycle:
+            delivery['id'] = f'load-{self.number}'
+        if self.md5_requested:
+            delivery['m'] = self.sketch_md5
+        if self.failures:
+            delivery['fc'] = self.failures
+        if self.stage_active:
+            delivery['su'] = [self.stage_done, self.args.image_size]
+        delivery['t'] = [['28ff%012x' % self.number, round(self.random.uniform(15, 25), 2)]]
+        delivery['b'] = round(self.random.uniform(3.3, 4.2), 2)
+        if self.args.payload:
+            delivery['x'] = 'x' * self.args.payload
+        return delivery
+
+    def cycle_delay(self):
+        """s until the next cycle is due, the next wake slot if BrickServer assigned one"""
+        if self.slot_period == 0:
+            delay = max(self.args.delay, 1)
+            return delay * (1 + self.random.uniform(0, bp.JITTER_PERCENT / 100))
+        now = time.monotonic()
+        return self.slot_period - (now - self.slot_at) % self.slot_period
+
+    # ------------------------------------------
+    # transmission
+
+    async def transmit(self, delivery):
+        body = bp.encode(delivery, self.msgpack)
+        if self.udp_port and len(body) <= bp.UDP_PAYLOAD_MAX and (self.udp_fails < bp.UDP_FAILS_MAX or self.udp_fails % 16 == 0):
+            answer = await self.measured('udp', self.transmit_udp(body))
+            if answer is not None:
+                self.udp_fails = 0
+                return answer
+            self.udp_fails += 1
+            self.stats.count('udp-fallback')
+        elif self.udp_port:
+            self.udp_fails += 1
+        return await self.measured('http', self.transmit_http(body))
+
+    async def measured(self, transport, request):
+        start = time.monotonic()
+        self.stats.gauge(flight=1)
+        try:
+            answer = await request
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError):
+            answer = None
+        finally:
+            self.stats.gauge(flight=-1)
+        if answer is not None:
+            self.stats.latency(transport, time.monotonic() - start)
+        return answer
+
+    async def transmit_http(self, body):
+        async def exchange():
+            status, headers, answer = await self.http_request('POST', '/', {
+                'Content-Type': 'application/msgpack' if self.msgpack else 'application/json',
+                **({'Accept': 'application/msgpack'} if self.msgpack else {}),
+            }, body)
+            if status != 200:
+                return None
+            return bp.decode(answer)
+        return await asyncio.wait_for(exchange(), bp.HTTP_TIMEOUT)
+
+    async def start_udp(self):
+        if self.udp is None:
+            loop = asyncio.get_running_loop()
+            local = (self.source, 0) if self.source else None
+            _, self.udp = await loop.create_datagram_endpoint(lambda: UdpClient(self), local_addr=local, remote_addr=(self.args.host, self.udp_port))
+
+    async def transmit_udp(self, body):
+        await self.start_udp()
+        self.udp_message_id = (self.udp_message_id + 1) & 0xffff
+        datagram = bp.udp_pack(bp.UDP_CON, bp.UDP_POST, self.udp_message_id, body)
+        timeout = bp.UDP_TIMEOUT
+        for attempt in range(bp.UDP_RETRANSMITS + 1):
+            if attempt:
+                self.stats.count('udp-retransmission')
+            future = asyncio.get_running_loop().create_future()
+            self.udp.waiting[self.udp_message_id] = future
+            self.udp.transport.sendto(datagram)
+            try:
+                _, code, _, payload = await asyncio.wait_for(future, timeout)
+            except asyncio.TimeoutError:
+                timeout *= 2
+                continue
+            finally:
+                self.udp.waiting.pop(self.udp_message_id, None)
+            return bp.decode(payload) if code == bp.UDP_CHANGED else None
+        return None
+
+    async def http_request(self, method, path, headers, body=b''):
+        local = (self.source, 0) if self.source else None
+        reader, writer = await asyncio.open_connection(self.args.host, self.args.port, local_addr=local)
+        try:
+            lines = [f'{method} {path} HTTP/1.0', f'Host: {self.args.host}:{self.args.port}', 'Connection: close']
+            lines += [f'{k}: {v}' for k, v in headers.items()]
+            if method == 'POST':
+                lines.append(f'Content-Length: {len(body)}')
+            writer.write(('\r\n'.join(lines) + '\r\n\r\n').encode('latin-1') + body)
+            await writer.drain()
+            status_line = await reader.readline()
+            status = int(status_line.split()[1]) if status_line.startswith(b'HTTP/1.') else 0
+            answer_headers = {}
+            while True:
+                line = await reader.readline()
+                if line in (b'\r\n', b'\n', b''):
+                    break
+                key, _, value = line.decode('latin-1').partition(':')
+                answer_headers[key.strip().lower()] = value.strip()
+            length = int(answer_headers.get('content-length', -1))
+            answer = await reader.readexactly(length) if length >= 0 else await reader.read()
+            return status, answer_headers, answer
+        finally:
+            writer.close()
+
+    # ------------------------------------------
+    # Activator
+
+    async def listen_activator(self):
+        """starts listening for Activator events via HTTP (on the Brick's own source IP) and UDP, returns the HTTP listener"""
+        if self.udp_port:
+            try:
+                await self.start_udp()
+            except OSError:
+                self.stats.count('activator-listen-failed')
+        if not self.args.activator_port or not self.source:
+            return None
+        try:
+            return await asyncio.start_server(self.handle_activator, self.source, self.args.activator_port)
+        except OSError:
+            self.stats.count('activator-listen-failed')
+            return None
+
+    def activator_event(self, event):
+        self.stats.count('activator-event')
+        if isinstance(event, dict):
+            self.evaluate(event)
+            if event.get('dn'):
+                self.stats.count('activator-done')
+                self.activator_done = True
+        self.activator_event_seen.set()
+
+    async def handle_activator(self, reader, writer):
+        """serves one Activator request as the firmware does, answered in the format it is sent in"""
+        try:
+            line = await asyncio.wait_for(reader.readline(), 1)
+            parts = line.decode('latin-1').split()
+            headers = {}
+            while True:
+                header = await asyncio.wait_for(reader.readline(), 1)
+                if header in (b'\r\n', b'\n', b''):
+                    break
+                key, _, value = header.decode('latin-1').partition(':')
+                headers[key.strip().lower()] = value.strip()
+            msgpack = 'msgpack' in headers.get('content-type', '')
+            if len(parts) < 2 or parts[1].partition('?')[0] != '/':
+                status, answer = 404, {'s': 1, 'm': 'wrong url'}
+            elif parts[0] != 'POST':
+                status, answer = 405, {'s': 2, 'm': 'wrong method'}
+            elif not self.in_window:
+                return
+            else:
+                length = int(headers.get('content-length', 0))
+                body = await asyncio.wait_for(reader.readexactly(length), 1) if length else b''
+                self.activator_event(bp.decode(body))
+                status, answer = 200, {'s': 0}
+            body = bp.encode(answer, msgpack)
+            content_type = 'application/msgpack' if msgpack else 'text/json'
+            writer.write(f'HTTP/1.0 {status} \r\nContent-Type: {content_type}\r\nContent-Length: {len(body)}\r\nConnection: close\r\n\r\n'.encode('latin-1') + body)
+            await writer.drain()
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError):
+            self.stats.count('activator-error')
+        finally:
+            writer.close()
+
+    def activator_datagram(self, transport, message):
+        """serves an Activator event received via UDP, a retransmission of the last one is only acknowledged again"""
+        if not self.in_window:
+            return
+        _, _, message_id, payload = message
+        if message_id != self.udp_activator_id:
+            self.udp_activator_id = message_id
+            try:
+                event = bp.decode(payload)
+            except ValueError:
+                event = {}
+            self.activator_event(event)
+        transport.sendto(bp.udp_pack(bp.UDP_ACK, bp.UDP_CHANGED, message_id))
+
+    # ------------------------------------------
+    # answer
+
+    def evaluate(self, answer):
+        if not isinstance(answer, dict):
+            return
+        for code in answer.get('r', []):
+            self.stats.count(f'request-{code}')
+            if code == 11:
+                self.md5_requested = True
+            elif code == 12:
+                self.ota_requested = True
+            elif code == 14:
+                self.first_cycle = False
+            elif code in (17, 18):
+                self.msgpack = code == 17
+            elif code == 19:
+                self.heartbeat = True
+            elif code in (23, 24):
+                self.deep_sleep = code == 23
+            elif code == 28 and not self.stage_active:
+                self.stage_active = True
+                self.stage_done = 0
+            elif code == 29:
+                self.stage_active = False
+        if 'bn' in answer:
+            self.bn = max(int(answer['bn']), 1)
+        if 'ws' in answer:
+            until, period = answer['ws']
+            self.slot_period = period
+            self.slot_at = time.monotonic() + until
+        if 'up' in answer:
+            self.udp_port = int(answer['up'])
+            self.udp_fails = 0
+
+    async def ota_update(self):
+        """fetches the full image as the firmware does on the boot after request 12"""
+        start = time.monotonic()
+        try:
+            status, _, image = await asyncio.wait_for(self.http_request('GET', '/ota', {
+                'User-Agent': 'ESP8266-http-Update',
+                'x-ESP8266-mode': 'sketch',
+                'x-ESP8266-sketch-md5': self.sketch_md5,
+            }), bp.HTTP_TIMEOUT * 6)
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError):
+            status, image = 0, b''
+        self.stats.count('ota' if status == 200 else 'ota-failed')
+        if status == 200:
+            self.stats.count('ota-bytes', len(image))
+            self.stats.latency('ota', time.monotonic() - start)
+            self.first_cycle = True  # RTCmem gets destroyed by the update
+
+    async def stage_chunks(self):
+        """stages the OTA image in ranged chunks of one flash sector for at most 2s, as the firmware does"""
+        start = time.monotonic()
+        while self.stage_active and time.monotonic() - start < 2:
+            first = self.stage_done
+            try:
+                status, headers, chunk = await asyncio.wait_for(self.http_request('GET', '/ota', {
+                    'Range': f'bytes={first}-{first + 4095}',
+                }), bp.HTTP_TIMEOUT)
+            except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError):
+                return
+            if status != 206:
+                self.stats.count('stage-failed')
+                return
+            total = int(headers.get('content-range', '/0').rpartition('/')[2])
+            self.args.image_size = total
+            self.stage_done += len(chunk)
+            self.stats.count('stage-bytes', len(chunk))
+            if self.stage_done >= total:
+                self.stats.count('staged')
+                self.stage_active = False
+                self.first_cycle = True
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('url', help='BrickServer URL, e.g. http://127.0.0.1:8080')
+    parser.add_argument('--bricks', type=int, default=1000, help='number of simulated Bricks (default 1000)')
+    parser.add_argument('--delay', type=float, default=60, help='s between cycles, as FeatureAll.getDelay() (default 60)')
+    parser.add_argument('--ramp', type=float, help='s over which the Bricks boot (default --delay, 0 simulates a power cut)')
+    parser.add_argument('--duration', type=float, default=300, help='s to run (default 300)')
+    parser.add_argument('--change', type=float, default=1.0, help='probability a reading changed, only matters if BrickServer sets bn (default 1)')
+    parser.add_argument('--payload', type=int, default=0, help='bytes of filler added to each delivery')
+    parser.add_argument('--udp-port', type=int, default=0, help='start with this UDP port of BrickServer (as if it set up before)')
+    parser.add_argument('--activator-port', type=int, default=bp.ACTIVATOR_PORT,
+                        help=f'port each Brick listens on for Activator events during it\'s window, needs --source-ips (default {bp.ACTIVATOR_PORT}, 0 disables it)')
+    parser.add_argument('--source-ips', action=argparse.BooleanOptionalAction, default=None,
+                        help='give each Brick it\'s own source IP out of 127.1.0.0/16 (default if BrickServer is on loopback)')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--report', type=float, default=10, help='s between statistics (default 10)')
+    args = parser.parse_args()
+
+    url = urllib.parse.urlparse(args.url)
+    args.host = url.hostname
+    args.port = url.port or 80
+    args.image_size = 0
+    if args.ramp is None:
+        args.ramp = args.delay
+    if args.source_ips is None:
+        args.source_ips = ipaddress.ip_address(args.host).is_loopback if args.host.replace('.', '').isdigit() else False
+
+    # ------------------------------------------
+    # thousands of Bricks need as many sockets
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+    if hard < args.bricks * 3 + 64:
+        print(f'warning: only {hard} file descriptors available for {args.bricks} Bricks', flush=True)
+
+    stats = Stats()
+    bricks = [asyncio.create_task(Brick(n + 1, args, stats).run()) for n in range(args.bricks)]
+    until = time.monotonic() + args.duration
+    while time.monotonic() < until:
+        await asyncio.sleep(min(args.report, until - time.monotonic()))
+        stats.rotate()
+    for brick in bricks:
+        brick.cancel()
+    await asyncio.gather(*bricks, return_exceptions=True)
+    stats.report(stats.total, 'whole run')
+
+
+if __name__ == '__main__':
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
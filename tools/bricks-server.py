@@ -0,0 +1,369 @@
+#!/usr/bin/env python3
+"""
+BrickServer stand-in for nahs-Bricks-OS (see PROTOCOL.md), to test Bricks and to load-test with bricks-load.py
+
+usage: bricks-server.py [options]
+
+Answers transmissions (POST /, and via UDP if --udp-port is given), serves OTA images (GET /ota, ranged GET /ota
+and GET /ota/delta/<sketch MD5>) and stores uploaded traces (POST /trace). With --push it sends Activator events to
+Bricks in their Activator window (via UDP to Bricks that transmitted via UDP, via HTTP to --push-port otherwise).
+Throughput and latency of the answers and of the Activator events are printed every --report seconds.
+"""
+
+import argparse
+import asyncio
+import hashlib
+import json
+import os
+import random
+import time
+
+import bricks_protocol as bp
+
+
+class Stats:
+    """counts requests by endpoint and keeps the time taken to answer them"""
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.started = time.monotonic()
+        self.counts = {}
+        self.latencies = []
+        self.push_latencies = []
+
+    def record(self, endpoint, latency):
+        self.counts[endpoint] = self.counts.get(endpoint, 0) + 1
+        self.latencies.append(latency)
+
+    def record_push(self, outcome, latency=None):
+        self.counts[outcome] = self.counts.get(outcome, 0) + 1
+        if latency is not None:
+            self.push_latencies.append(latency)
+
+    def report(self):
+        elapsed = max(time.monotonic() - self.started, 1e-9)
+        total = sum(self.counts.values())
+        line = f'{total / elapsed:8.1f} req/s  ' + '  '.join(f'{k}: {v}' for k, v in sorted(self.counts.items()))
+        if self.latencies:
+            line += '  answer ms ' + format_percentiles(self.latencies)
+        if self.push_latencies:
+            line += '  push ms ' + format_percentiles(self.push_latencies)
+        print(line, flush=True)
+        self.reset()
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def format_percentiles(values):
+    return ' '.join(f'p{p}={percentile(values, p) * 1000:.1f}' for p in (50, 90, 99)) + f' max={max(values) * 1000:.1f}'
+
+
+class BrickServer:
+    def __init__(self, args):
+        self.args = args
+        self.stats = Stats()
+        self.pending = {}  # brick (peer IP) -> request codes not delivered yet
+        self.udp_answers = {}  # (peer, message ID) -> (acknowledgement, time sent), a retransmission is answered again within the exchange lifetime
+        self.udp_transport = None
+        self.in_window = {}  # brick (peer IP) -> (time of transmission, UDP peer or None, MessagePack), oldest first
+        self.push_waiting = {}  # (peer, message ID) -> future of an Activator event sent via UDP
+        self.push_message_id = random.getrandbits(16)
+        self.image = None
+        if args.image:
+            with open(args.image, 'rb') as f:
+                self.image = f.read()
+            self.image_md5 = hashlib.md5(self.image).hexdigest()
+
+    def answer(self, brick, delivery):
+        """returns the answer to a transmission: request codes once per brick, settings on every answer"""
+        if self.args.verbose:
+            print(f'{brick}: {json.dumps(delivery)}', flush=True)
+        answer = {}
+        if brick not in self.pending:
+            self.pending[brick] = list(self.args.request)
+        codes = self.pending[brick]
+        self.pending[brick] = []
+        if codes:
+            answer['r'] = codes
+        for key in ('bn', 'ms', 'up'):
+            if getattr(self.args, key) is not None:
+                answer[key] = getattr(self.args, key)
+        if self.args.ws:
+            period = self.args.ws
+            answer['ws'] = [period - int(time.time()) % period, period]
+        return answer
+
+    # ------------------------------------------
+    # HTTP
+
+    async def handle_http(self, reader, writer):
+        start = time.monotonic()
+        brick = writer.get_extra_info('peername')[0]
+        try:
+            line = await asyncio.wait_for(reader.readline(), bp.HTTP_TIMEOUT)
+            method, path = line.decode('latin-1').split()[:2]
+            headers = {}
+            while True:
+                line = await asyncio.wait_for(reader.readline(), bp.HTTP_TIMEOUT)
+                if line in (b'\r\n', b'\n', b''):
+                    break
+                key, _, value = line.decode('latin-1').partition(':')
+                headers[key.strip().lower()] = value.strip()
+            length = int(headers.get('content-length', 0))
+            body = await asyncio.wait_for(reader.readexactly(length), bp.HTTP_TIMEOUT) if length else b''
+            if self.args.delay:
+                await asyncio.sleep(self.args.delay / 1000)
+            endpoint = await self.route(writer, brick, method, path, headers, body)
+            await writer.drain()
+            self.stats.record(endpoint, time.monotonic() - start)
+        except (asyncio.TimeoutError, asyncio.IncompleteReadError, ConnectionError, ValueError):
+            self.stats.record('error', time.monotonic() - start)
+        finally:
+            writer.close()
+
+    async def route(self, writer, brick, method, path, headers, body):
+        if method == 'POST' and path == '/':
+            msgpack = 'msgpack' in headers.get('content-type', '')
+            answer = bp.encode(self.answer(brick, bp.decode(body)), msgpack)
+            self.opened_window(brick, None, msgpack)
+            content_type = 'application/msgpack' if msgpack else 'application/json'
+            respond(writer, 200, {'Content-Type': content_type}, answer)
+            return 'transmission'
+        if method == 'POST' and path == '/trace':
+            self.store_trace(brick, body)
+            respond(writer, 200)
+            return 'trace'
+        if method == 'GET' and path.startswith('/ota/delta/'):
+            patch = os.path.join(self.args.patches, path[len('/ota/delta/'):]) if self.args.patches else None
+            if patch and os.path.isfile(patch):
+                with open(patch, 'rb') as f:
+                    respond(writer, 200, {'Content-Type': 'application/octet-stream'}, f.read())
+            else:
+                respond(writer, 404)
+            return 'ota-delta'
+        if method == 'GET' and path == '/ota':
+            self.serve_image(writer, headers)
+            return 'ota'
+        respond(writer, 404)
+        return 'unknown'
+
+    def serve_image(self, writer, headers):
+        if self.image is None:
+            respond(writer, 404)
+            return
+        size = len(self.image)
+        requested = headers.get('range', '')
+        if not requested.startswith('bytes='):
+            respond(writer, 200, {'Content-Type': 'application/octet-stream', 'x-MD5': self.image_md5}, self.image)
+            return
+        first, _, last = requested[6:].partition('-')
+        first = int(first)
+        last = min(int(last) if last else size - 1, size - 1)
+        if first >= size or last < first:
+            respond(writer, 416, {'Content-Range': f'bytes */{size}'})
+            return
+        chunk = self.image[first:last + 1]
+        respond(writer, 206, {
+            'Content-Type': 'application/octet-stream',
+            'Content-Range': f'bytes {first}-{last}/{size}',
+            'x-MD5': self.image_md5,
+            'x-Chunk-MD5': hashlib.md5(chunk).hexdigest(),
+        }, chunk)
+
+    def store_trace(self, brick, body):
+        header, entries = bp.parse_trace(body)
+        if self.args.traces:
+            os.makedirs(self.args.traces, exist_ok=True)
+            name = f'{brick}-{header["uptime"]}.trace'
+            with open(os.path.join(self.args.traces, name), 'wb') as f:
+                f.write(body)
+        if self.args.verbose:
+            print(f'{brick}: trace of cycle at uptime {header["uptime"]}{" (truncated)" if header["truncated"] else ""}', flush=True)
+            for name, millis, value in entries:
+                print(f'  {millis:8d} {name}: {value}', flush=True)
+
+    # ------------------------------------------
+    # UDP
+
+    def handle_udp(self, transport, datagram, peer):
+        start = time.monotonic()
+        message = bp.udp_unpack(datagram)
+        if message is not None and message[0] == bp.UDP_ACK:
+            future = self.push_waiting.pop((peer, message[2]), None)
+            if future is not None and not future.done():
+                future.set_result(message[1])
+            return
+        if message is None or message[0] != bp.UDP_CON or message[1] != bp.UDP_POST:
+            return
+        _, _, message_id, payload = message
+        self.expire_udp_answers(start)
+        key = (peer, message_id)
+        ack, _ = self.udp_answers.get(key, (None, None))
+        if ack is None:
+            answer = bp.encode(self.answer(peer[0], bp.decode(payload)), payload[:1] != b'{')
+            code = bp.UDP_CHANGED if len(answer) <= bp.UDP_PAYLOAD_MAX else bp.UDP_TOO_LARGE
+            ack = bp.udp_pack(bp.UDP_ACK, code, message_id, answer if code == bp.UDP_CHANGED else b'')
+            self.udp_answers[key] = (ack, start)
+            self.opened_window(peer[0], peer, payload[:1] != b'{')
+        transport.sendto(ack, peer)
+        self.stats.record('transmission-udp', time.monotonic() - start)
+
+    def expire_udp_answers(self, now):
+        """drops the acknowledgements older than the exchange lifetime, they are kept in the order they got sent"""
+        while self.udp_answers:
+            key, (_, sent) = next(iter(self.udp_answers.items()))
+            if now - sent < bp.UDP_EXCHANGE_LIFETIME:
+                break
+            del self.udp_answers[key]
+
+
+    # ------------------------------------------
+    # Activator push
+
+    def opened_window(self, brick, peer, msgpack):
+        """notes a Brick that just got it's answer, so it is in it's Activator window now"""
+        self.in_window.pop(brick, None)
+        self.in_window[brick] = (time.monotonic(), peer, msgpack)
+
+    async def push(self):
+        """sends --push Activator events per second, each to a random Brick that got it's answer within --push-within s"""
+        interval = 1 / self.args.push
+        event_template = json.loads(self.args.push_event)
+        while True:
+            await asyncio.sleep(interval)
+            now = time.monotonic()
+            while self.in_window:
+                brick, (seen, _, _) = next(iter(self.in_window.items()))
+                if now - seen < self.args.push_within:
+                    break
+                del self.in_window[brick]
+            if not self.in_window:
+                self.stats.record_push('push-nobody')
+                continue
+            brick = random.choice(tuple(self.in_window))
+            event = dict(event_template)
+            if random.random() < self.args.push_done:
+                event['dn'] = True
+            asyncio.create_task(self.push_event(brick, event))
+
+    async def push_event(self, brick, event):
+        _, peer, msgpack = self.in_window[brick]
+        body = bp.encode(event, msgpack)
+        start = time.monotonic()
+        try:
+            if peer is not None and self.udp_transport is not None:
+                done = await self.push_udp(peer, body)
+                transport = 'udp'
+            else:
+                done = await asyncio.wait_for(self.push_http(brick, body, msgpack), bp.HTTP_TIMEOUT)
+                transport = 'http'
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError):
+            self.stats.record_push('push-failed')
+            return
+        if not done:
+            self.stats.record_push('push-failed')
+            return
+        self.stats.record_push(f'push-{transport}', time.monotonic() - start)
+        if event.get('dn'):
+            self.in_window.pop(brick, None)
+
+    async def push_http(self, brick, body, msgpack):
+        """sends an Activator event as POST / to the Brick, returns True if it got processed"""
+        reader, writer = await asyncio.open_connection(brick, self.args.push_port)
+        try:
+            content_type = 'application/msgpack' if msgpack else 'application/json'
+            writer.write(f'POST / HTTP/1.0\r\nContent-Type: {content_type}\r\nContent-Length: {len(body)}\r\nConnection: close\r\n\r\n'.encode('latin-1') + body)
+            await writer.drain()
+            status_line = await reader.readline()
+            await reader.read()
+            return status_line.startswith(b'HTTP/1.') and status_line.split()[1:2] == [b'200']
+        finally:
+            writer.close()
+
+    async def push_udp(self, peer, body):
+        """sends an Activator event as confirmable POST with the firmware's retransmissions, returns True if it got acknowledged with 2.04"""
+        self.push_message_id = (self.push_message_id + 1) & 0xffff
+        key = (peer, self.push_message_id)
+        datagram = bp.udp_pack(bp.UDP_CON, bp.UDP_POST, self.push_message_id, body)
+        timeout = bp.UDP_TIMEOUT
+        for _ in range(bp.UDP_RETRANSMITS + 1):
+            future = asyncio.get_running_loop().create_future()
+            self.push_waiting[key] = future
+            self.udp_transport.sendto(datagram, peer)
+            try:
+                return await asyncio.wait_for(future, timeout) == bp.UDP_CHANGED
+            except asyncio.TimeoutError:
+                timeout *= 2
+            finally:
+                self.push_waiting.pop(key, None)
+        return False
+
+
+def respond(writer, status, headers=None, body=b''):
+    reasons = {200: 'OK', 206: 'Partial Content', 404: 'Not Found', 416: 'Range Not Satisfiable'}
+    lines = [f'HTTP/1.0 {status} {reasons.get(status, "")}', f'Content-Length: {len(body)}', 'Connection: close']
+    lines += [f'{k}: {v}' for k, v in (headers or {}).items()]
+    writer.write(('\r\n'.join(lines) + '\r\n\r\n').encode('latin-1') + body)
+
+
+class UdpProtocol(asyncio.DatagramProtocol):
+    def __init__(self, server):
+        self.server = server
+        self.transport = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+        self.server.udp_transport = transport
+
+    def datagram_received(self, data, addr):
+        self.server.handle_udp(self.transport, data, addr)
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=8080, help='HTTP port (default 8080)')
+    parser.add_argument('--udp-port', type=int, help='also answer transmissions via UDP on this port')
+    parser.add_argument('--request', type=int, action='append', default=[], metavar='CODE',
+                        help='request code sent once to each Brick (repeatable): ' + ', '.join(f'{k} {v}' for k, v in bp.REQUESTS.items()))
+    parser.add_argument('--bn', type=int, help='answer with bn (transmit only every N wakes)')
+    parser.add_argument('--ms', type=int, help='answer with ms (max silence in s)')
+    parser.add_argument('--ws', type=int, help='assign wake slots with this period in s')
+    parser.add_argument('--up', type=int, help='answer with up (UDP port, 0 disables UDP)')
+    parser.add_argument('--delay', type=float, default=0, help='ms of simulated processing per request')
+    parser.add_argument('--image', help='firmware image served as /ota')
+    parser.add_argument('--patches', help='directory of patches served as /ota/delta/<sketch MD5>')
+    parser.add_argument('--traces', help='directory uploaded traces are stored in')
+    parser.add_argument('--push', type=float, default=0, help='Activator events per s sent to Bricks in their Activator window (default 0)')
+    parser.add_argument('--push-port', type=int, default=bp.ACTIVATOR_PORT, help=f'port Bricks listen on for Activator events via HTTP (default {bp.ACTIVATOR_PORT})')
+    parser.add_argument('--push-within', type=float, default=bp.DEEP_SLEEP_WINDOW,
+                        help=f's after it\'s answer a Brick is taken to be in it\'s Activator window (default {bp.DEEP_SLEEP_WINDOW:g}, the deep-sleep window)')
+    parser.add_argument('--push-event', default='{}', help='JSON object sent as Activator event (default {})')
+    parser.add_argument('--push-done', type=float, default=0, help='share of Activator events with dn set, closing the window (default 0)')
+    parser.add_argument('--report', type=float, default=10, help='s between statistics (default 10)')
+    parser.add_argument('-v', '--verbose', action='store_true', help='print deliveries and traces')
+    args = parser.parse_args()
+
+    server = BrickServer(args)
+    http = await asyncio.start_server(server.handle_http, args.host, args.port, backlog=4096)
+    if args.udp_port:
+        await asyncio.get_running_loop().create_datagram_endpoint(lambda: UdpProtocol(server), local_addr=(args.host, args.udp_port))
+    print(f'BrickServer stand-in listening on {args.host}:{args.port}' + (f' (UDP {args.udp_port})' if args.udp_port else ''), flush=True)
+    if args.push > 0:
+        asyncio.create_task(server.push())
+    async with http:
+        while True:
+            await asyncio.sleep(args.report)
+            server.stats.report()
+
+
+if __name__ == '__main__':
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,210 @@
+"""
+Definitions of the protocol between nahs-Bricks-OS and BrickServer (see PROTOCOL.md), shared by the tools in this directory
+
+Values mirror the constants of nahs-Bricks-OS.h, keep them in sync when the firmware changes.
+"""
+
+import json
+import struct
+
+# timing of the firmware (s)
+HTTP_TIMEOUT = 5.0  # httpTimeout
+CYCLE_TIMEOUT = 20.0  # cycleTimeout, transmissions are only started within it
+BACKOFF_MAX = 3600  # backoffMax
+JITTER_PERCENT = 10  # jitterPercent
+ACTIVATOR_PORT = 80
+ACTIVATOR_EXTENSION = 5.0  # activatorExtension
+DEEP_SLEEP_WINDOW = 1.0  # deepSleepWindow
+
+# UDP transport
+UDP_TIMEOUT = 0.25  # udpTimeout, doubled with each retransmission
+UDP_RETRANSMITS = 2  # udpRetransmits
+UDP_FAILS_MAX = 3  # udpFailsMax, UDP is then only tried every 16th cycle
+UDP_PAYLOAD_MAX = 1024  # udpPayloadMax
+UDP_EXCHANGE_LIFETIME = 247.0  # s a message ID is kept for deduplication (CoAP's EXCHANGE_LIFETIME), the Brick's IDs may repeat after that
+UDP_CON = 0x40
+UDP_ACK = 0x60
+UDP_POST = 0x02
+UDP_CHANGED = 0x44
+UDP_TOO_LARGE = 0x8d
+UDP_PAYLOAD_MARKER = 0xff
+
+# magics
+TRACE_MAGIC = 0x42435401
+PATCH_MAGIC = 0x42445001
+TRACE_HEADER = struct.Struct('<IH?xI')  # magic, used, truncated, uptime
+
+PHASES = ('begin', 'start', 'deliver', 'wifi', 'transmit', 'feedback', 'persist', 'activator')
+TRACE_TYPES = ('phase', 'wifi', 'out', 'in', 'activator')
+
+# request codes (answer key r)
+REQUESTS = {
+    11: 'deliver sketch MD5',
+    12: 'OTA update',
+    14: 'clear ident',
+    15: 'enable phase timings',
+    16: 'disable phase timings',
+    17: 'enable MessagePack',
+    18: 'disable MessagePack',
+    19: 'force transmission',
+    20: 'enable unrequested sketch MD5',
+    21: 'disable unrequested sketch MD5',
+    22: 'deliver heap statistics',
+    23: 'enable deep-sleep mode',
+    24: 'disable deep-sleep mode',
+    25: 'enable trace',
+    26: 'disable trace',
+    27: 'upload trace',
+    28: 'start staged OTA update',
+    29: 'abort staged OTA update',
+}
+
+
+def udp_pack(msg_type, code, message_id, payload=b''):
+    """returns a CoAP-style datagram (4 byte header, payload marker and payload)"""
+    header = struct.pack('>BBH', msg_type, code, message_id)
+    return header + bytes([UDP_PAYLOAD_MARKER]) + payload if payload else header
+
+
+def udp_unpack(datagram):
+    """returns type, code, message ID and payload of a datagram, None if it is too short"""
+    if len(datagram) < 4:
+        return None
+    msg_type, code, message_id = struct.unpack('>BBH', datagram[:4])
+    payload = datagram[4:]
+    if payload[:1] == bytes([UDP_PAYLOAD_MARKER]):
+        payload = payload[1:]
+    return msg_type, code, message_id, payload
+
+
+def encode(doc, msgpack):
+    """serializes a document as the Brick does, MessagePack or compact JSON"""
+    return msgpack_pack(doc) if msgpack else json.dumps(doc, separators=(',', ':')).encode()
+
+
+def decode(body):
+    """parses a body the way the Brick tells it's format apart, JSON starts with '{'"""
+    if not body:
+        return {}
+    return json.loads(body) if body[:1] == b'{' else msgpack_unpack(body)
+
+
+def msgpack_pack(value):
+    """minimal MessagePack encoder for the types ArduinoJson produces"""
+    if value is None:
+        return b'\xc0'
+    if value is True:
+        return b'\xc3'
+    if value is False:
+        return b'\xc2'
+    if isinstance(value, int):
+        if 0 <= value < 0x80:
+            return struct.pack('B', value)
+        if -32 <= value < 0:
+            return struct.pack('b', value)
+        if 0 <= value <= 0xffffffff:
+            return struct.pack('>BI', 0xce, value)
+        if -0x80000000 <= value < 0:
+            return struct.pack('>Bi', 0xd2, value)
+        return struct.pack('>Bq', 0xd3, value)
+    if isinstance(value, float):
+        return struct.pack('>Bf', 0xca, value)
+    if isinstance(value, str):
+        data = value.encode()
+        if len(data) < 32:
+            return bytes([0xa0 | len(data)]) + data
+        return struct.pack('>BH', 0xda, len(data)) + data
+    if isinstance(value, (list, tuple)):
+        head = bytes([0x90 | len(value)]) if len(value) < 16 else struct.pack('>BH', 0xdc, len(value))
+        return head + b''.join(msgpack_pack(item) for item in value)
+    if isinstance(value, dict):
+        head = bytes([0x80 | len(value)]) if len(value) < 16 else struct.pack('>BH', 0xde, len(value))
+        return head + b''.join(msgpack_pack(str(k)) + msgpack_pack(v) for k, v in value.items())
+    raise TypeError(f'cannot encode {type(value).__name__}')
+
+
+def msgpack_unpack(data):
+    """minimal MessagePack decoder for the types ArduinoJson produces"""
+    value, _ = _unpack(memoryview(data), 0)
+    return value
+
+
+def _unpack(data, pos):
+    b = data[pos]
+    pos += 1
+    if b < 0x80:
+        return b, pos
+    if b >= 0xe0:
+        return b - 0x100, pos
+    if 0xa0 <= b <= 0xbf:
+        return _str(data, pos, b & 0x1f)
+    if 0x90 <= b <= 0x9f:
+        return _array(data, pos, b & 0x0f)
+    if 0x80 <= b <= 0x8f:
+        return _map(data, pos, b & 0x0f)
+    fixed = {0xc0: None, 0xc2: False, 0xc3: True}
+    if b in fixed:
+        return fixed[b], pos
+    scalars = {
+        0xca: '>f', 0xcb: '>d',
+        0xcc: '>B', 0xcd: '>H', 0xce: '>I', 0xcf: '>Q',
+        0xd0: '>b', 0xd1: '>h', 0xd2: '>i', 0xd3: '>q',
+    }
+    if b in scalars:
+        fmt = struct.Struct(scalars[b])
+        return fmt.unpack_from(data, pos)[0], pos + fmt.size
+    lengths = {0xd9: '>B', 0xda: '>H', 0xdb: '>I', 0xdc: '>H', 0xdd: '>I', 0xde: '>H', 0xdf: '>I'}
+    if b in lengths:
+        fmt = struct.Struct(lengths[b])
+        length = fmt.unpack_from(data, pos)[0]
+        pos += fmt.size
+        if b <= 0xdb:
+            return _str(data, pos, length)
+        if b <= 0xdd:
+            return _array(data, pos, length)
+        return _map(data, pos, length)
+    raise ValueError(f'unsupported MessagePack type 0x{b:02x}')
+
+
+def _str(data, pos, length):
+    return bytes(data[pos:pos + length]).decode(), pos + length
+
+
+def _array(data, pos, length):
+    items = []
+    for _ in range(length):
+        item, pos = _unpack(data, pos)
+        items.append(item)
+    return items, pos
+
+
+def _map(data, pos, length):
+    items = {}
+    for _ in range(length):
+        key, pos = _unpack(data, pos)
+        items[key], pos = _unpack(data, pos)
+    return items, pos
+
+
+def parse_trace(data):
+    """returns header (dict) and entries (type name, millis, value) of a trace as uploaded by POST /trace"""
+    magic, used, truncated, uptime = TRACE_HEADER.unpack_from(data)
+    if magic != TRACE_MAGIC:
+        raise ValueError('not a trace')
+    entries = []
+    pos = TRACE_HEADER.size
+    end = min(pos + used, len(data))
+    while pos + 7 <= end:
+        kind, millis, length = struct.unpack_from('<BIH', data, pos)
+        body = bytes(data[pos + 7:pos + 7 + length])
+        pos += 7 + length
+        name = TRACE_TYPES[kind] if kind < len(TRACE_TYPES) else str(kind)
+        if name == 'phase':
+            phase, duration = struct.unpack('<BI', body)
+            value = (PHASES[phase] if phase < len(PHASES) else phase, duration)
+        elif name == 'wifi':
+            value = body[0]
+        else:
+            value = msgpack_unpack(body)
+        entries.append((name, millis, value))
+    return {'used': used, 'truncated': truncated, 'uptime': uptime}, entries
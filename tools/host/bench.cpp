@@ -0,0 +1,381 @@
+/*
+bricks-bench: runs thousands of simulated wake cycles of BrickOS against a simulated BrickServer and WiFi
+reports the simulated time awake and radio-on per kind of cycle, the time of each phase, heap peaks and the bytes on the wire
+all time is simulated (see SimCosts), so the results only depend on the options and the seed
+*/
+
+#include "harness.h"
+#include <chrono>
+
+static const char* usage =
+    "usage: bricks-bench [options]\n"
+    "  --cycles N          wake cycles to run (default 10000)\n"
+    "  --seed N            seed of the simulation (default 1)\n"
+    "  --delay S           s between cycles, as FeatureAll.getDelay() (default 60)\n"
+    "  --change N          reading changes every N wakes (default 1)\n"
+    "  --msgpack           transmit as MessagePack\n"
+    "  --udp               transmit via UDP (BrickServer's UDP port is 5683)\n"
+    "  --bn N              transmit every N wakes (default 1)\n"
+    "  --ms S              max silence for change-suppression (default 0)\n"
+    "  --lease-cache S     reuse the DHCP lease for S seconds (default 0)\n"
+    "  --deep-sleep        sleep in deep-sleep between cycles\n"
+    "  --trace             record a trace of each cycle\n"
+    "  --trace-out FILE    write the trace of the last transmitting cycle to FILE (implies --trace)\n"
+    "  --wifi-fail P       probability of a boot not getting WiFi\n"
+    "  --server-fail P     probability of BrickServer refusing a connection\n"
+    "  --udp-loss P        probability of a datagram getting lost (each direction)\n"
+    "  --answer JSON       keys added to each answer of BrickServer (e.g. '{\"ws\":[30,60]}')\n"
+    "  --request CODES     requests of BrickServer sent once with the first answer (e.g. 11,27)\n"
+    "  --events N          Activator events sent to each cycle (5 s apart)\n"
+    "  --heap BYTES        heap free at setup() (default 40000)\n"
+    "  --setup             configure the Brick through BrickSetup (Serial) on the first boot\n"
+    "  --cost NAME=US      override a simulated duration of SimCosts (e.g. rtt=20000)\n";
+
+struct Options {
+    uint32_t cycles = 10000;
+    uint32_t seed = 1;
+    uint16_t delay = 60;
+    uint32_t change = 1;
+    bool msgPack = false;
+    bool udp = false;
+    uint8_t bn = 1;
+    uint32_t ms = 0;
+    uint32_t leaseCache = 0;
+    bool deepSleep = false;
+    bool trace = false;
+    const char* traceOut = nullptr;
+    double wifiFail = 0;
+    double serverFail = 0;
+    double udpLoss = 0;
+    std::string answer;
+    std::vector<uint8_t> requests;
+    uint8_t events = 0;
+    uint32_t heap = 40000;
+    bool setup = false;
+};
+
+//------------------------------------------
+// simulated durations that can be overridden by --cost
+static const struct {
+    const char* name;
+    uint32_t SimCosts::*cost;
+} costNames[] = {
+    {"boot", &SimCosts::boot}, {"clock", &SimCosts::clock}, {"yield", &SimCosts::yield},
+    {"fsWrite", &SimCosts::fsWrite}, {"fsWriteByte", &SimCosts::fsWriteByte}, {"rtcWrite", &SimCosts::rtcWrite},
+    {"eepromBegin", &SimCosts::eepromBegin}, {"eepromCommit", &SimCosts::eepromCommit},
+    {"flashReadKB", &SimCosts::flashReadKB}, {"flashWriteSector", &SimCosts::flashWriteSector}, {"md5KB", &SimCosts::md5KB},
+    {"featureBegin", &SimCosts::featureBegin}, {"featureStart", &SimCosts::featureStart}, {"featureDeliver", &SimCosts::featureDeliver},
+    {"featureFeedback", &SimCosts::featureFeedback}, {"featureEnd", &SimCosts::featureEnd},
+    {"wake", &SimCosts::wake}, {"assocQuick", &SimCosts::assocQuick}, {"assocFull", &SimCosts::assocFull}, {"dhcp", &SimCosts::dhcp},
+    {"scanChannel", &SimCosts::scanChannel}, {"dns", &SimCosts::dns}, {"rtt", &SimCosts::rtt}, {"wireByte", &SimCosts::wireByte},
+    {"server", &SimCosts::server},
+};
+
+/*
+BrickServer of the benchmark: answers transmissions with "s": 0 (and the configured keys), accepts traces and has no OTA image
+*/
+class BenchServer : public SimServer {
+    private:
+        const Options& _options;
+        bool _requestsSent = false;
+        /*
+        helper that builds the answer to a transmission
+        */
+        std::string answer(bool msgPack) {
+            HostDocument answer;
+            if (_options.answer.empty() || deserializeJson(answer, _options.answer)) answer.to<JsonObject>();
+            answer["s"] = 0;
+            if (!_requestsSent && !_options.requests.empty()) {
+                JsonArray r = answer.createNestedArray("r");
+                for (uint8_t code : _options.requests) r.add(code);
+                _requestsSent = true;
+            }
+            std::string body;
+            if (msgPack) serializeMsgPack(answer, body);
+            else serializeJson(answer, body);
+            return body;
+        }
+    public:
+        uint32_t transmissions = 0;
+        uint32_t traces = 0;
+        uint32_t activatorAnswers = 0;
+        BenchServer(const Options& options) : _options(options) {}
+        Accept accept(uint16_t port) override {
+            (void)port;
+            return sim().chance(_options.serverFail) ? REFUSE : ACCEPT;
+        }
+        bool http(const std::string& request, std::string& response, uint32_t* latency) override {
+            (void)latency;
+            size_t headEnd = request.find("\r\n\r\n");
+            std::string head = request.substr(0, headEnd);
+            std::string body;
+            int code = 404;
+            bool msgPack = false;
+            if (head.compare(0, 12, "POST / HTTP/") == 0) {
+                transmissions++;
+                code = 200;
+                msgPack = head.find("Accept: application/msgpack") != std::string::npos;
+                body = answer(msgPack);
+            }
+            else if (head.compare(0, 17, "POST /trace HTTP/") == 0) {
+                traces++;
+                code = 200;
+            }
+            response = "HTTP/1.0 " + std::to_string(code) + (code == 200 ? " OK" : " Not Found");
+            response += "\r\nContent-Type: ";
+            response += msgPack ? "application/msgpack" : "application/json";
+            response += "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            return true;
+        }
+        bool udp(const std::string& datagram, std::string& answer, uint32_t* latency) override {
+            (void)latency;
+            if (datagram.size() < 5 || (uint8_t)datagram[0] != 0x40 || datagram[1] != 0x02) return false;  // acknowledgements are not answered
+            transmissions++;
+            bool msgPack = datagram.size() > 5 && datagram[5] != '{';
+            answer = {(char)0x60, (char)0x44, datagram[2], datagram[3], (char)0xff};
+            answer += this->answer(msgPack);
+            return true;
+        }
+        void activatorAnswered(const std::string& response) override {
+            (void)response;
+            activatorAnswers++;
+        }
+};
+
+/*
+helper that writes the settings of the options into BrickOS's part of FSmem, with the connection as well unless BrickSetup did it
+*/
+static void configureFSmem(const Options& options, bool connection) {
+    HostDocument fs;
+    if (sim().fsFile.empty() || deserializeJson(fs, sim().fsFile)) fs.to<JsonObject>();
+    if (!fs["os"].is<JsonObject>()) fs.createNestedObject("os");
+    JsonVariant os = fs["os"];
+    if (connection) {
+        os["ssid"] = sim().ssid;
+        os["pass"] = sim().pass;
+        os["url"] = "http://" + sim().serverHost + ":8081";
+        os["id"] = "bench";
+    }
+    os["mp"] = options.msgPack;
+    os["bn"] = options.bn;
+    os["ms"] = options.ms;
+    os["lc"] = options.leaseCache;
+    os["ds"] = options.deepSleep;
+    os["tc"] = options.trace;
+    os["tm"] = true;
+    os["up"] = options.udp ? sim().serverUdpPort : 0;
+    sim().fsFile.clear();
+    serializeJson(fs, sim().fsFile);
+}
+
+/*
+helper that returns the given percentile of values (which get sorted)
+*/
+static uint64_t percentile(std::vector<uint64_t>& values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, (size_t)(p / 100 * values.size()));
+    return values[index];
+}
+
+static double average(const std::vector<uint64_t>& values) {
+    if (values.empty()) return 0;
+    double sum = 0;
+    for (uint64_t value : values) sum += value;
+    return sum / values.size();
+}
+
+static bool parseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        const char* value = hasValue ? argv[i + 1] : "";
+        if (arg == "--msgpack") options->msgPack = true;
+        else if (arg == "--udp") options->udp = true;
+        else if (arg == "--deep-sleep") options->deepSleep = true;
+        else if (arg == "--trace") options->trace = true;
+        else if (arg == "--setup") options->setup = true;
+        else if (!hasValue) return false;
+        else {
+            ++i;
+            if (arg == "--cycles") options->cycles = strtoul(value, nullptr, 10);
+            else if (arg == "--seed") options->seed = strtoul(value, nullptr, 10);
+            else if (arg == "--delay") options->delay = strtoul(value, nullptr, 10);
+            else if (arg == "--change") options->change = max(strtoul(value, nullptr, 10), 1UL);
+            else if (arg == "--bn") options->bn = strtoul(value, nullptr, 10);
+            else if (arg == "--ms") options->ms = strtoul(value, nullptr, 10);
+            else if (arg == "--lease-cache") options->leaseCache = strtoul(value, nullptr, 10);
+            else if (arg == "--trace-out") {
+                options->traceOut = value;
+                options->trace = true;
+            }
+            else if (arg == "--wifi-fail") options->wifiFail = atof(value);
+            else if (arg == "--server-fail") options->serverFail = atof(value);
+            else if (arg == "--udp-loss") options->udpLoss = atof(value);
+            else if (arg == "--answer") options->answer = value;
+            else if (arg == "--request") {
+                for (const char* p = value; *p != '\0';) {
+                    char* end;
+                    options->requests.push_back(strtoul(p, &end, 10));
+                    if (end == p) return false;
+                    p = *end == ',' ? end + 1 : end;
+                }
+            }
+            else if (arg == "--events") options->events = strtoul(value, nullptr, 10);
+            else if (arg == "--heap") options->heap = strtoul(value, nullptr, 10);
+            else if (arg == "--cost") {
+                const char* eq = strchr(value, '=');
+                bool found = false;
+                for (const auto& cost : costNames) {
+                    if (eq == nullptr || strncmp(cost.name, value, eq - value) != 0 || cost.name[eq - value] != '\0') continue;
+                    sim().costs.*cost.cost = strtoul(eq + 1, nullptr, 10);
+                    found = true;
+                }
+                if (!found) return false;
+            }
+            else return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, &options)) {
+        fputs(usage, stderr);
+        return 2;
+    }
+
+    //------------------------------------------
+    // set up the world: a freshly flashed Brick, it's features and BrickServer
+    BenchServer server(options);
+    sim().rng.seed(options.seed);
+    sim().server = &server;
+    sim().heapFree = options.heap;
+    sim().wifiFail = options.wifiFail;
+    sim().udpLoss = options.udpLoss;
+    sim().powerOn();
+    if (options.setup) {
+        sim().setupPin = LOW;
+        sim().serialIn = "\n4\nbench\n5\n" + sim().ssid + "\n" + sim().pass + "\n\n0\n7\n" + sim().serverHost + "\n8081\n9\n";
+    }
+    else configureFSmem(options, true);
+    FeatureAll.delaySeconds = options.delay;
+    uint32_t wakes = 0;
+    FeatureAll.onDeliver = [&](JsonDocument* out_json) {
+        uint32_t step = wakes++ / options.change;
+        (*out_json)["t"] = 20 + (step % 50) / 10.0;
+        (*out_json)["b"] = 3.92;
+    };
+
+    //------------------------------------------
+    // run the cycles
+    std::vector<BootResult> results;
+    results.reserve(options.cycles);
+    std::string traceOut;
+    auto hostStart = std::chrono::steady_clock::now();
+    for (uint32_t cycle = 0; cycle < options.cycles; ++cycle) {
+        sim().events.clear();
+        for (uint8_t i = 0; i < options.events; ++i) {
+            HostDocument event;
+            event["e"] = i;
+            std::string body;
+            if (options.msgPack) serializeMsgPack(event, body);
+            else serializeJson(event, body);
+            sim().events.push_back({5000u + i * 5000u, options.udp, options.msgPack, body});
+        }
+        BootResult result = runBoot();
+        if (result.kind == BOOT_SETUP && options.setup && cycle == 0) {
+            sim().setupPin = HIGH;
+            configureFSmem(options, false);
+        }
+        if (!result.trace.empty() && (result.kind == BOOT_TRANSMIT || traceOut.empty())) traceOut = result.trace;
+        result.trace.clear();
+        results.push_back(result);
+    }
+    double hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - hostStart).count();
+
+    //------------------------------------------
+    // report
+    printf("bricks-bench: %u cycles, %s %s, bn %u, ms %u, delay %u s%s, seed %u\n", options.cycles, options.udp ? "UDP" : "HTTP", options.msgPack ? "MessagePack" : "JSON",
+           options.bn, options.ms, options.delay, options.deepSleep ? ", deep-sleep" : "", options.seed);
+    double hours = sim().now / 3.6e9;
+    printf("simulated %.1f h in %.2f s on the host (%.1f us per cycle)\n\n", hours, hostSeconds, hostSeconds * 1e6 / max(options.cycles, 1u));
+
+    printf("%-10s %7s  %-35s  %-22s  %s\n", "cycle", "count", "awake ms (avg / p50 / p99 / max)", "radio ms (active/light)", "slept s avg");
+    for (uint8_t kind = 0; kind < BOOT_KINDS; ++kind) {
+        std::vector<uint64_t> awake, active, light, slept;
+        for (const BootResult& result : results) {
+            if (result.kind != kind) continue;
+            awake.push_back(result.stats.awakeUs);
+            active.push_back(result.stats.radioUs - result.stats.lightSleepUs);
+            light.push_back(result.stats.lightSleepUs);
+            slept.push_back(result.stats.sleptUs);
+        }
+        if (awake.empty()) continue;
+        double awakeAvg = average(awake);
+        char awakeText[64], radioText[64];
+        snprintf(awakeText, sizeof(awakeText), "%.1f / %.1f / %.1f / %.1f", awakeAvg / 1000, percentile(awake, 50) / 1000.0, percentile(awake, 99) / 1000.0, percentile(awake, 100) / 1000.0);
+        snprintf(radioText, sizeof(radioText), "%.1f / %.1f", average(active) / 1000, average(light) / 1000);
+        printf("%-10s %7zu  %-35s  %-22s  %.1f\n", bootKindNames[kind], awake.size(), awakeText, radioText, average(slept) / 1e6);
+    }
+
+    printf("\nphase us (avg of the cycles that ran it)\n%-10s", "");
+    for (uint8_t kind = 0; kind < BOOT_KINDS; ++kind) printf(" %10s", bootKindNames[kind]);
+    printf("\n");
+    for (uint8_t phase = 0; phase < NahsBricksOS::PHASE_COUNT; ++phase) {
+        printf("%-10s", phaseNames[phase]);
+        for (uint8_t kind = 0; kind < BOOT_KINDS; ++kind) {
+            std::vector<uint64_t> times;
+            for (const BootResult& result : results) {
+                if (result.kind == kind && result.phaseTimes[phase] > 0) times.push_back(result.phaseTimes[phase]);
+            }
+            if (times.empty()) printf(" %10s", "-");
+            else printf(" %10.0f", average(times));
+        }
+        printf("\n");
+    }
+
+    uint32_t heapPeak = 0;
+    uint64_t sent = 0, received = 0, counted = 0, countedReceived = 0, exchanges = 0, datagrams = 0, activatorSent = 0, activatorReceived = 0;
+    uint64_t fsWrites = 0, eepromCommits = 0, rtcWrites = 0, radioUs = 0;
+    uint32_t transmits = 0;
+    for (const BootResult& result : results) {
+        heapPeak = max(heapPeak, result.stats.heapPeak);
+        fsWrites += result.stats.fsWrites;
+        eepromCommits += result.stats.eepromCommits;
+        rtcWrites += result.stats.rtcWrites;
+        radioUs += result.stats.radioUs;
+        activatorSent += result.stats.activatorSent;
+        activatorReceived += result.stats.activatorReceived;
+        if (result.kind != BOOT_TRANSMIT) continue;
+        transmits++;
+        sent += result.stats.serverSent;
+        received += result.stats.serverReceived;
+        counted += result.wireSent;
+        countedReceived += result.wireReceived;
+        exchanges += result.stats.httpExchanges;
+        datagrams += result.stats.udpDatagrams;
+    }
+    printf("\nheap: peak %u bytes used of %u (lowest free %u)\n", heapPeak, options.heap, options.heap - min(heapPeak, options.heap));
+    if (transmits > 0) {
+        printf("wire per transmitting cycle: sent %.1f B, received %.1f B (BrickOS counted %.1f / %.1f), %.2f HTTP exchanges, %.2f datagrams\n",
+               (double)sent / transmits, (double)received / transmits, (double)counted / transmits, (double)countedReceived / transmits,
+               (double)exchanges / transmits, (double)datagrams / transmits);
+    }
+    printf("wire total: BrickServer %llu B sent, %llu B received, Activator %llu B received, %llu B sent (%u answers)\n", (unsigned long long)sent,
+           (unsigned long long)received, (unsigned long long)activatorReceived, (unsigned long long)activatorSent, server.activatorAnswers);
+    printf("BrickServer: %u transmissions, %u traces\n", server.transmissions, server.traces);
+    printf("memories: %llu FSmem writes, %llu EEPROM commits, %llu RTCmem writes, RTCmem %u/%u bytes used\n", (unsigned long long)fsWrites,
+           (unsigned long long)eepromCommits, (unsigned long long)rtcWrites, RTCmem.getSpaceUsed(), RTCmem.getSpaceTotal());
+    printf("radio: %.1f s on per simulated hour\n", hours > 0 ? radioUs / 1e6 / hours : 0);
+
+    if (options.traceOut != nullptr) {
+        if (traceOut.empty() || !writeFile(options.traceOut, traceOut)) {
+            fprintf(stderr, "no trace written to %s\n", options.traceOut);
+            return 1;
+        }
+        printf("trace: %zu bytes written to %s\n", traceOut.size(), options.traceOut);
+    }
+    return 0;
+}
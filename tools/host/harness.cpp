@@ -0,0 +1,126 @@
+#include "harness.h"
+#include <fstream>
+#include <new>
+#include <sstream>
+
+const char* bootKindNames[BOOT_KINDS] = {"sampling", "transmit", "failed", "reset", "setup"};
+
+/*
+runs one boot: reset, setup() of the Brick (as in examples/BasicBrickMain) up to it's restart, deep-sleep or halt
+BrickOS is constructed again on each boot, like all of the Brick's globals are
+*/
+BootResult runBoot() {
+    sim().boot();
+    RTCmem.boot();
+    FSmem.load();
+    BricksOS.~NahsBricksOS();
+    new (&BricksOS) NahsBricksOS();
+
+    SimRestart restart = {false, 0};
+    bool restarted = false;
+    try {
+        BricksOS.setSetupPin(D7);
+        FeatureAll.setBrickType(5);
+        BricksOS.handover();
+    }
+    catch (const SimRestart& r) {
+        restart = r;
+        restarted = true;
+    }
+    catch (const SimHalt& halt) {
+        sim().stats.halted = halt.reason;
+    }
+    sim().endBoot(restarted ? &restart : nullptr);
+
+    BootResult result;
+    static const uint8_t destroyed[4] = {0, 0, 0, 0};
+    if (!sim().stats.halted.empty()) result.kind = BOOT_SETUP;
+    else if (memcmp(sim().rtc, destroyed, 4) == 0) result.kind = BOOT_RESET;
+    else if (!BricksOS._wifiStarted) result.kind = BOOT_SAMPLING;
+    else if (BricksOS.RTCdata->failures > 0) result.kind = BOOT_FAILED;
+    else result.kind = BOOT_TRANSMIT;
+    result.stats = sim().stats;
+    memcpy(result.phaseTimes, BricksOS._phaseTimes, sizeof(result.phaseTimes));
+    result.wireSent = BricksOS.RTCdata->wireSent;
+    result.wireReceived = BricksOS.RTCdata->wireReceived;
+    if (BricksOS._trace != nullptr) {
+        NahsBricksOS::_TraceHeader header = {NahsBricksOS::traceMagic, BricksOS._traceUsed, BricksOS._traceTruncated, BricksOS._traceUptime};
+        result.trace.assign((const char*)&header, sizeof(header));
+        result.trace.append((const char*)BricksOS._trace, BricksOS._traceUsed);
+    }
+    return result;
+}
+
+/*
+helper that splits a trace (header and entries, as kept in EEPROM) into it's entries, returns false if it is not a valid trace
+*/
+bool parseTrace(const std::string& raw, Trace* trace) {
+    NahsBricksOS::_TraceHeader header;
+    if (raw.size() < sizeof(header)) return false;
+    memcpy(&header, raw.data(), sizeof(header));
+    if (header.magic != NahsBricksOS::traceMagic || sizeof(header) + header.used > raw.size()) return false;
+    trace->truncated = header.truncated;
+    trace->uptime = header.uptime;
+    trace->entries.clear();
+    const uint8_t* data = (const uint8_t*)raw.data() + sizeof(header);
+    size_t offset = 0;
+    while (offset + 7 <= header.used) {
+        TraceEntry entry;
+        uint16_t len;
+        entry.type = data[offset];
+        memcpy(&entry.millis, data + offset + 1, 4);
+        memcpy(&len, data + offset + 5, 2);
+        if (offset + 7 + len > header.used) return false;
+        entry.data.assign((const char*)data + offset + 7, len);
+        trace->entries.push_back(entry);
+        offset += 7 + len;
+    }
+    return offset == header.used;
+}
+
+/*
+helper that reads a trace file, either binary (as uploaded by POST /trace) or the hex dump printed by BrickSetup
+*/
+bool readTraceFile(const char* path, std::string* raw) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    std::stringstream content;
+    content << file.rdbuf();
+    *raw = content.str();
+    uint32_t magic = 0;
+    if (raw->size() >= 4) memcpy(&magic, raw->data(), 4);
+    if (magic == NahsBricksOS::traceMagic) return true;
+
+    //------------------------------------------
+    // hex dump: every line consisting of hex digits only belongs to it
+    std::string hex;
+    std::string line;
+    content.clear();
+    content.seekg(0);
+    while (std::getline(content, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        if (line.empty() || line.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) continue;
+        hex += line;
+    }
+    if (hex.empty() || hex.size() % 2 != 0) return false;
+    raw->clear();
+    for (size_t i = 0; i < hex.size(); i += 2) raw->push_back((char)strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+    return true;
+}
+
+bool writeFile(const char* path, const std::string& content) {
+    std::ofstream file(path, std::ios::binary);
+    file << content;
+    return (bool)file;
+}
+
+/*
+helper that returns a MessagePack encoded document (as recorded in traces) as JSON
+*/
+std::string msgPackToJson(const std::string& msgPack) {
+    HostDocument doc;
+    if (deserializeMsgPack(doc, msgPack)) return "<invalid>";
+    std::string json;
+    serializeJson(doc, json);
+    return json;
+}
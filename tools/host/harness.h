@@ -0,0 +1,74 @@
+#ifndef BRICKS_HARNESS_H
+#define BRICKS_HARNESS_H
+
+/*
+runs BrickOS boot by boot in the simulation (see sim.h), shared by bricks-bench and bricks-replay
+BrickOS's internals are opened up to the harness, so it can read the phase timings, RTCdata and the trace of a boot
+*/
+
+#include "sim.h"
+#include <ArduinoJson.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266WebServer.h>
+#include <EEPROM.h>
+#include <nahs-Bricks-Lib-RTCmem.h>
+#include <nahs-Bricks-Lib-FSmem.h>
+#include <nahs-Bricks-Feature-All.h>
+#define private public
+#include <nahs-Bricks-OS.h>
+#undef private
+
+/*
+document of the harness (BrickServer, scenarios), it does not take from the simulated heap
+*/
+class HostDocument : public JsonDocument {
+    public:
+        explicit HostDocument(size_t capacity = 65536) : JsonDocument(capacity) {}
+};
+
+enum BootKind : uint8_t {  // what a boot turned out to be
+    BOOT_SAMPLING,  // reading kept (or suppressed) without starting WiFi
+    BOOT_TRANSMIT,  // transmitted to BrickServer
+    BOOT_FAILED,  // BrickServer could not be reached, sleeping with backoff
+    BOOT_RESET,  // RTCmem got destroyed (OTA update or config reset)
+    BOOT_SETUP,  // BrickSetup got entered (the boot halts once it runs out of Serial input)
+    BOOT_KINDS
+};
+
+extern const char* bootKindNames[BOOT_KINDS];
+extern const char* phaseNames[];  // of BrickOS
+
+/*
+what the harness takes from a boot
+*/
+struct BootResult {
+    BootKind kind;
+    SimStats stats;
+    uint32_t phaseTimes[NahsBricksOS::PHASE_COUNT];  // us of each phase (0 if it did not run)
+    uint16_t wireSent;  // bytes of the transmission as counted by BrickOS
+    uint16_t wireReceived;
+    std::string trace;  // trace of the boot (header and entries) if it got recorded
+};
+
+BootResult runBoot();
+
+//------------------------------------------
+// traces
+struct TraceEntry {
+    uint8_t type;
+    uint32_t millis;
+    std::string data;
+};
+
+struct Trace {
+    bool truncated;
+    uint32_t uptime;
+    std::vector<TraceEntry> entries;
+};
+
+bool parseTrace(const std::string& raw, Trace* trace);
+bool readTraceFile(const char* path, std::string* raw);
+bool writeFile(const char* path, const std::string& content);
+std::string msgPackToJson(const std::string& msgPack);
+
+#endif // BRICKS_HARNESS_H
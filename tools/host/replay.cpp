@@ -0,0 +1,355 @@
+/*
+bricks-replay: feeds a recorded trace (as uploaded by POST /trace or printed by BrickSetup) back through BrickOS
+the cycle is rebuilt from the trace: the Brick's state from the OS keys of it's delivery, the reading of the features,
+the WiFi status as it changed, the answer of BrickServer and the Activator events, each at the millis they were recorded at
+the trace of the replayed cycle is compared with the recorded one, repeated runs have to result in the very same trace
+*/
+
+#include "harness.h"
+#include <chrono>
+
+static const char* usage =
+    "usage: bricks-replay TRACE [options]\n"
+    "  --runs N     replay the cycle N times, each has to result in the same trace (default 1)\n"
+    "  --fs JSON    settings added to BrickOS's FSmem (e.g. '{\"up\":5683,\"mp\":true}'), the trace does not tell them\n"
+    "  --verbose    print BrickOS's Serial output\n";
+
+static const char* osKeys[] = {"id", "m", "pt", "fw", "wb", "fc", "do", "hs", "su", "bl"};  // keys of the delivery added by BrickOS
+static const char* wifiStatusNames[] = {"idle", "no-ssid", "scan-done", "connected", "connect-failed", "connection-lost", "wrong-password", "disconnected"};
+
+/*
+what the replay takes from a trace
+*/
+struct Scenario {
+    Trace trace;
+    bool coldBoot;  // cycle followed an invalid RTCmem
+    bool sampling;  // cycle did not start a transmission
+    HostDocument out;  // first delivery of the cycle
+    bool answered;  // BrickServer answered the transmission
+    std::string in;  // answer of BrickServer as MessagePack
+    std::string fs;  // --fs
+};
+
+/*
+BrickServer as recorded: answers the transmission with the recorded answer, accepts traces and has no OTA image
+it answers "s": 0 while the Brick gets primed by a cold boot
+*/
+class ReplayServer : public SimServer {
+    private:
+        const Scenario& _scenario;
+        /*
+        helper that returns the recorded answer as JSON or MessagePack
+        */
+        std::string answer(bool msgPack) {
+            HostDocument answer;
+            if (priming || deserializeMsgPack(answer, _scenario.in)) answer["s"] = 0;
+            std::string body;
+            if (msgPack) serializeMsgPack(answer, body);
+            else serializeJson(answer, body);
+            return body;
+        }
+    public:
+        bool priming = false;
+        ReplayServer(const Scenario& scenario) : _scenario(scenario) {}
+        Accept accept(uint16_t port) override {
+            (void)port;
+            return priming || _scenario.answered ? ACCEPT : UNREACHABLE;
+        }
+        bool http(const std::string& request, std::string& response, uint32_t* latency) override {
+            (void)latency;
+            std::string head = request.substr(0, request.find("\r\n\r\n"));
+            std::string body;
+            int code = 404;
+            bool msgPack = false;
+            if (head.compare(0, 12, "POST / HTTP/") == 0) {
+                code = 200;
+                msgPack = head.find("Accept: application/msgpack") != std::string::npos;
+                body = answer(msgPack);
+            }
+            else if (head.compare(0, 17, "POST /trace HTTP/") == 0) code = 200;
+            response = "HTTP/1.0 " + std::to_string(code) + (code == 200 ? " OK" : " Not Found");
+            response += "\r\nContent-Type: ";
+            response += msgPack ? "application/msgpack" : "application/json";
+            response += "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            return true;
+        }
+        bool udp(const std::string& datagram, std::string& answer, uint32_t* latency) override {
+            (void)latency;
+            if (!(priming || _scenario.answered) || datagram.size() < 5 || (uint8_t)datagram[0] != 0x40 || datagram[1] != 0x02) return false;
+            bool msgPack = datagram.size() > 5 && datagram[5] != '{';
+            answer = {(char)0x60, (char)0x44, datagram[2], datagram[3], (char)0xff};
+            answer += this->answer(msgPack);
+            return true;
+        }
+};
+
+/*
+helper that builds the scenario of a trace, returns false if it holds no delivery
+*/
+static bool buildScenario(const std::string& raw, Scenario* scenario) {
+    if (!parseTrace(raw, &scenario->trace)) return false;
+    bool outFound = false;
+    bool transmitted = false;
+    scenario->answered = false;
+    for (const TraceEntry& entry : scenario->trace.entries) {
+        if (entry.type == NahsBricksOS::TRACE_OUT && !outFound) outFound = !deserializeMsgPack(scenario->out, entry.data);
+        else if (entry.type == NahsBricksOS::TRACE_IN && !scenario->answered) {
+            scenario->in = entry.data;
+            scenario->answered = true;
+        }
+        else if (entry.type == NahsBricksOS::TRACE_PHASE && !entry.data.empty() && (uint8_t)entry.data[0] >= NahsBricksOS::PHASE_WIFI) transmitted = true;
+    }
+    scenario->coldBoot = scenario->trace.uptime == 0;
+    scenario->sampling = !transmitted && !scenario->answered;
+    return outFound;
+}
+
+/*
+helper that writes BrickOS's settings into FSmem: the connection of the simulation, recording of traces and what the delivery tells
+*/
+static void configureFSmem(const Scenario& scenario) {
+    HostDocument fs;
+    if (sim().fsFile.empty() || deserializeJson(fs, sim().fsFile)) fs.to<JsonObject>();
+    if (!fs["os"].is<JsonObject>()) fs.createNestedObject("os");
+    JsonVariant os = fs["os"];
+    JsonVariant out = scenario.out.root();
+    os["ssid"] = sim().ssid;
+    os["pass"] = sim().pass;
+    os["url"] = "http://" + sim().serverHost + ":8081";
+    os["id"] = out["id"] | "";
+    os["tc"] = true;
+    os["tm"] = out.containsKey("pt");
+    os["mo"] = out.containsKey("m");
+    if (out.containsKey("m")) os["md5"].set(out["m"]);
+    if (out.containsKey("su")) os["ss"].set(out["su"][1]);
+    if (scenario.sampling) os["bn"] = 255;
+    HostDocument extra;
+    if (!scenario.fs.empty() && !deserializeJson(extra, scenario.fs)) {
+        for (JsonPair setting : extra.as<JsonObject>()) os[setting.key().c_str()].set(setting.value());
+    }
+    sim().fsFile.clear();
+    serializeJson(fs, sim().fsFile);
+}
+
+/*
+helper that sets RTCdata (and the backlog) of the primed Brick to the state the delivery tells
+*/
+static void configureRTCmem(const Scenario& scenario) {
+    NahsBricksOS::_RTCdata* data = BricksOS.RTCdata;
+    JsonVariant out = scenario.out.root();
+    data->uptime = scenario.trace.uptime;
+    data->lastTransmit = scenario.trace.uptime;
+    data->leaseStart = scenario.trace.uptime;  // cached lease and IP of BrickServer are taken as fresh
+    data->hostResolved = scenario.trace.uptime;
+    data->failures = out["fc"] | 0;
+    data->docOverflows = out["do"] | 0;
+    data->wakes = scenario.sampling ? 1 : 254;  // a sampling wake is not due yet, any other is
+    data->heartbeatRequested = false;
+    data->otaUpdateRequested = false;
+    data->traceUploadRequested = false;
+    data->sketchMD5Requested = out.containsKey("m");
+    for (uint8_t i = 0; i < NahsBricksOS::PHASE_COUNT; ++i) data->phaseTimes[i] = out["pt"][i] | 0;
+    data->fsWrites = out["fw"][0] | 0;
+    data->fsWritesSkipped = out["fw"][1] | 0;
+    data->fsWriteTime = out["fw"][2] | 0;
+    data->wireSent = out["wb"][0] | 0;
+    data->wireReceived = out["wb"][1] | 0;
+    data->stageActive = out.containsKey("su");
+    data->stageDone = out["su"][0] | 0;
+#if BRICKS_OS_HEAP_STATS
+    NahsBricksOS::_RTCheapStats* heap = BricksOS.RTCheapStats;
+    heap->heapStatsRequested = out.containsKey("hs");
+    if (heap->heapStatsRequested) {
+        heap->heapMin = out["hs"][0];
+        heap->blockMin = out["hs"][1];
+        heap->fragMax = out["hs"][2];
+        heap->stackMin = out["hs"][3];
+        heap->heapMinPhase = out["hs"][4];
+        heap->outDocMax = out["hs"][5];
+        heap->inDocMax = out["hs"][6];
+    }
+#endif
+#if BRICKS_OS_BACKLOG_SIZE > 0
+    NahsBricksOS::_RTCbacklog* backlog = BricksOS.RTCbacklog;
+    backlog->count = 0;
+    backlog->used = 0;
+    for (JsonVariant item : out["bl"].as<JsonArray>()) {
+        HostDocument delivery;
+        delivery.set(item[1]);
+        std::string reading;
+        serializeMsgPack(delivery, reading);
+        if (reading.size() > 255 || backlog->used + 5 + reading.size() > sizeof(backlog->data)) break;
+        uint8_t* entry = backlog->data + backlog->used;
+        uint32_t uptime = scenario.trace.uptime - item[0].as<uint32_t>();
+        memcpy(entry, &uptime, 4);
+        entry[4] = reading.size();
+        memcpy(entry + 5, reading.data(), reading.size());
+        backlog->used += 5 + reading.size();
+        backlog->count++;
+    }
+#endif
+    RTCmem.write();
+}
+
+/*
+helper that replays the scenario once (from power-on), returns the trace of the replayed cycle
+*/
+static std::string replay(const Scenario& scenario, ReplayServer* server, bool verbose) {
+    uint32_t generation = sim().generation;
+    sim() = Sim();
+    sim().generation = generation;
+    sim().server = server;
+    sim().echo = verbose;
+    sim().md5Override = scenario.out.root()["m"] | "";
+    sim().powerOn();
+    configureFSmem(scenario);
+    FeatureAll.onDeliver = [&](JsonDocument* out_json) {
+        for (JsonPair value : scenario.out.as<JsonObject>()) {
+            bool osKey = false;
+            for (const char* key : osKeys) osKey |= strcmp(value.key().c_str(), key) == 0;
+            if (!osKey) (*out_json)[value.key().c_str()].set(value.value());
+        }
+    };
+
+    //------------------------------------------
+    // a warm boot needs a Brick that went through it's cold boot already
+    if (!scenario.coldBoot) {
+        server->priming = true;
+        BootResult primed = runBoot();
+        server->priming = false;
+        if (primed.kind != BOOT_TRANSMIT) {
+            fprintf(stderr, "priming cold boot ended as %s\n", bootKindNames[primed.kind]);
+            return std::string();
+        }
+        configureRTCmem(scenario);
+        configureFSmem(scenario);
+    }
+
+    //------------------------------------------
+    // the cycle as recorded, Activator events come in the way BrickOS is set up to receive them
+    HostDocument fs;
+    deserializeJson(fs, sim().fsFile);
+    bool udp = (fs["os"]["up"] | 0) != 0;
+    for (const TraceEntry& entry : scenario.trace.entries) {
+        if (entry.type == NahsBricksOS::TRACE_WIFI && entry.data.size() == 1) sim().wifiTimeline.push_back(std::make_pair(entry.millis, (uint8_t)entry.data[0]));
+        else if (entry.type == NahsBricksOS::TRACE_ACTIVATOR) sim().events.push_back({entry.millis, udp, true, entry.data});
+    }
+    return runBoot().trace;
+}
+
+/*
+helper that returns the entries of the given type
+*/
+static std::vector<const TraceEntry*> entriesOf(const Trace& trace, uint8_t type) {
+    std::vector<const TraceEntry*> entries;
+    for (const TraceEntry& entry : trace.entries) {
+        if (entry.type == type) entries.push_back(&entry);
+    }
+    return entries;
+}
+
+/*
+helper that compares the entries of a type, the recorded ones have to be the first replayed ones (an uploaded trace ends with the upload)
+prints the first mismatch and returns false
+*/
+static bool compareEntries(const Trace& recorded, const Trace& replayed, uint8_t type, const char* name) {
+    std::vector<const TraceEntry*> expected = entriesOf(recorded, type);
+    std::vector<const TraceEntry*> actual = entriesOf(replayed, type);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (i >= actual.size()) {
+            printf("%s %zu: recorded but not replayed\n", name, i);
+            return false;
+        }
+        if (type == NahsBricksOS::TRACE_PHASE ? expected[i]->data[0] == actual[i]->data[0] : expected[i]->data == actual[i]->data) continue;
+        bool doc = type != NahsBricksOS::TRACE_PHASE && type != NahsBricksOS::TRACE_WIFI;
+        if (type == NahsBricksOS::TRACE_WIFI) {
+            printf("%s %zu: recorded %s, replayed %s\n", name, i, wifiStatusNames[min((uint8_t)expected[i]->data[0], (uint8_t)7)],
+                   wifiStatusNames[min((uint8_t)actual[i]->data[0], (uint8_t)7)]);
+        }
+        else if (doc) printf("%s %zu differs\n  recorded %s\n  replayed %s\n", name, i, msgPackToJson(expected[i]->data).c_str(), msgPackToJson(actual[i]->data).c_str());
+        else printf("%s %zu: recorded %s, replayed %s\n", name, i, phaseNames[(uint8_t)expected[i]->data[0]], phaseNames[(uint8_t)actual[i]->data[0]]);
+        return false;
+    }
+    return true;
+}
+
+/*
+helper that returns the phase and it's duration in us of a phase entry
+*/
+static uint32_t phaseTime(const TraceEntry* entry, uint8_t* phase) {
+    uint32_t us = 0;
+    *phase = entry->data[0];
+    memcpy(&us, entry->data.data() + 1, 4);
+    return us;
+}
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    uint32_t runs = 1;
+    bool verbose = false;
+    bool valid = true;
+    Scenario scenario;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc) runs = max(strtoul(argv[++i], nullptr, 10), 1UL);
+        else if (arg == "--fs" && i + 1 < argc) scenario.fs = argv[++i];
+        else if (arg == "--verbose") verbose = true;
+        else if (path == nullptr && arg.compare(0, 2, "--") != 0) path = argv[i];
+        else valid = false;
+    }
+    if (!valid || path == nullptr) {
+        fputs(usage, stderr);
+        return 2;
+    }
+    std::string raw;
+    if (!readTraceFile(path, &raw) || !buildScenario(raw, &scenario)) {
+        fprintf(stderr, "%s: not a trace with a delivery\n", path);
+        return 2;
+    }
+    printf("trace: %zu entries, uptime %u s%s, %s, %s\n", scenario.trace.entries.size(), scenario.trace.uptime, scenario.trace.truncated ? ", truncated" : "",
+           scenario.coldBoot ? "cold boot" : "warm boot", scenario.sampling ? "sampling" : scenario.answered ? "transmitted" : "not transmitted");
+    printf("delivery: %s\n", msgPackToJson(entriesOf(scenario.trace, NahsBricksOS::TRACE_OUT)[0]->data).c_str());
+
+    //------------------------------------------
+    // replay
+    ReplayServer server(scenario);
+    std::string first;
+    bool deterministic = true;
+    double hostSeconds = 0;
+    for (uint32_t run = 0; run < runs; ++run) {
+        auto hostStart = std::chrono::steady_clock::now();
+        std::string replayed = replay(scenario, &server, verbose);
+        hostSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - hostStart).count();
+        if (run == 0) first = replayed;
+        else if (replayed != first) deterministic = false;
+    }
+    Trace replayed;
+    if (!parseTrace(first, &replayed)) {
+        fprintf(stderr, "the replayed cycle recorded no trace\n");
+        return 1;
+    }
+
+    //------------------------------------------
+    // compare
+    std::vector<const TraceEntry*> recordedPhases = entriesOf(scenario.trace, NahsBricksOS::TRACE_PHASE);
+    std::vector<const TraceEntry*> replayedPhases = entriesOf(replayed, NahsBricksOS::TRACE_PHASE);
+    printf("\n%-10s %12s %12s %12s\n", "phase", "recorded us", "replayed us", "delta us");
+    for (size_t i = 0; i < max(recordedPhases.size(), replayedPhases.size()); ++i) {
+        uint8_t phase = 0;
+        std::string recordedText = "-", replayedText = "-", deltaText = "";
+        uint32_t recordedUs = 0, replayedUs = 0;
+        if (i < recordedPhases.size()) recordedText = std::to_string(recordedUs = phaseTime(recordedPhases[i], &phase));
+        if (i < replayedPhases.size()) replayedText = std::to_string(replayedUs = phaseTime(replayedPhases[i], &phase));
+        if (i < recordedPhases.size() && i < replayedPhases.size()) deltaText = std::to_string((int64_t)replayedUs - recordedUs);
+        printf("%-10s %12s %12s %12s\n", phase < NahsBricksOS::PHASE_COUNT ? phaseNames[phase] : "?", recordedText.c_str(), replayedText.c_str(), deltaText.c_str());
+    }
+    printf("\n");
+    bool matched = compareEntries(scenario.trace, replayed, NahsBricksOS::TRACE_PHASE, "phase");
+    matched &= compareEntries(scenario.trace, replayed, NahsBricksOS::TRACE_WIFI, "wifi status");
+    matched &= compareEntries(scenario.trace, replayed, NahsBricksOS::TRACE_OUT, "delivery");
+    matched &= compareEntries(scenario.trace, replayed, NahsBricksOS::TRACE_IN, "answer");
+    matched &= compareEntries(scenario.trace, replayed, NahsBricksOS::TRACE_ACTIVATOR, "activator event");
+    printf("replay %s the recorded cycle\n", matched ? "matches" : "does not match");
+    if (runs > 1) printf("%u runs %s (%.1f us on the host per run)\n", runs, deterministic ? "replayed the same trace" : "replayed different traces", hostSeconds * 1e6 / runs);
+    return matched && deterministic ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/*
+host stand-in for the ESP8266 Arduino core, only the part used by nahs-Bricks-OS
+time, heap, flash and pins are simulated by the harness (see sim.h), the definitions live in shims/core.cpp
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define LED_BUILTIN 2
+#define D0 16
+#define D1 5
+#define D2 4
+#define D3 0
+#define D4 2
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+#define digitalPinToInterrupt(p) (p)
+
+#define DEC 10
+#define HEX 16
+
+#define IRAM_ATTR
+#define PROGMEM
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+
+#define SPI_FLASH_SEC_SIZE 4096
+#define FLASH_SECTOR_SIZE 4096
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char* dst, const char* src, size_t size);
+#endif
+
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+
+/*
+Arduino's String, backed by std::string
+*/
+class String {
+    private:
+        std::string _s;
+    public:
+        String(const char* s = "") : _s(s != nullptr ? s : "") {}
+        String(const std::string& s) : _s(s) {}
+        String(const __FlashStringHelper* s) : _s(reinterpret_cast<const char*>(s)) {}
+        explicit String(char c) : _s(1, c) {}
+        explicit String(int value, unsigned char base = 10);
+        explicit String(unsigned int value, unsigned char base = 10);
+        explicit String(long value, unsigned char base = 10);
+        explicit String(unsigned long value, unsigned char base = 10);
+        const char* c_str() const { return _s.c_str(); }
+        unsigned int length() const { return _s.length(); }
+        long toInt() const { return atol(_s.c_str()); }
+        const std::string& str() const { return _s; }
+        String& operator+=(const String& other) { _s += other._s; return *this; }
+        String& operator+=(const char* other) { _s += other; return *this; }
+        String& operator+=(char c) { _s += c; return *this; }
+        bool operator==(const String& other) const { return _s == other._s; }
+        bool operator==(const char* other) const { return _s == (other != nullptr ? other : ""); }
+        bool operator!=(const String& other) const { return !(*this == other); }
+        bool operator!=(const char* other) const { return !(*this == other); }
+        friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+        friend String operator+(const String& a, const char* b) { return String(a._s + b); }
+        friend String operator+(const char* a, const String& b) { return String(a + b._s); }
+};
+
+class Print;
+
+/*
+interface of objects that can print themselves
+*/
+class Printable {
+    public:
+        virtual ~Printable() {}
+        virtual size_t printTo(Print& p) const = 0;
+};
+
+/*
+base of everything that can be written to, printing numbers and strings
+*/
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size);
+        size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+        size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+        virtual void flush() {}
+        size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+        size_t print(const String& s) { return write(s.c_str(), s.length()); }
+        size_t print(const char* s) { return write(s); }
+        size_t print(char c) { return write((uint8_t)c); }
+        size_t print(unsigned char value, int base = DEC) { return printNumber(value, base); }
+        size_t print(int value, int base = DEC) { return value < 0 && base == DEC ? print('-') + printNumber(-(long long)value, base) : printNumber((unsigned int)value, base); }
+        size_t print(unsigned int value, int base = DEC) { return printNumber(value, base); }
+        size_t print(long value, int base = DEC) { return value < 0 && base == DEC ? print('-') + printNumber(-(long long)value, base) : printNumber((unsigned long)value, base); }
+        size_t print(unsigned long value, int base = DEC) { return printNumber(value, base); }
+        size_t print(long long value, int base = DEC) { return value < 0 && base == DEC ? print('-') + printNumber(-value, base) : printNumber((unsigned long long)value, base); }
+        size_t print(unsigned long long value, int base = DEC) { return printNumber(value, base); }
+        size_t print(double value, int digits = 2);
+        size_t print(const Printable& p) { return p.printTo(*this); }
+        size_t println() { return write("\r\n"); }
+        template<typename T> size_t println(const T& value) { return print(value) + println(); }
+        template<typename T> size_t println(const T& value, int format) { return print(value, format) + println(); }
+    private:
+        size_t printNumber(unsigned long long value, int base);
+};
+
+/*
+base of everything that can be read from, reads wait up to the timeout like the ESP8266 core does
+*/
+class Stream : public Print {
+    protected:
+        unsigned long _timeout = 1000;
+        unsigned long _startMillis = 0;
+        int timedRead();
+        int timedPeek();
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        void setTimeout(unsigned long timeout) { _timeout = timeout; }
+        unsigned long getTimeout() const { return _timeout; }
+        virtual size_t readBytes(char* buffer, size_t length);
+        size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+        String readStringUntil(char terminator);
+};
+
+/*
+IPv4 address, kept as uint32_t with the first octet in the lowest byte (like lwIP does)
+*/
+class IPAddress : public Printable {
+    private:
+        uint32_t _address;
+    public:
+        IPAddress() : _address(0) {}
+        IPAddress(uint32_t address) : _address(address) {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+        operator uint32_t() const { return _address; }
+        bool operator==(const IPAddress& other) const { return _address == other._address; }
+        bool operator!=(const IPAddress& other) const { return _address != other._address; }
+        uint8_t operator[](int index) const { return _address >> (index * 8); }
+        bool isSet() const { return _address != 0; }
+        bool fromString(const char* address);
+        bool fromString(const String& address) { return fromString(address.c_str()); }
+        String toString() const;
+        size_t printTo(Print& p) const override;
+};
+
+/*
+Serial port, output goes to stdout if the harness echoes it, input comes from the harness
+*/
+class HardwareSerial : public Stream {
+    public:
+        void begin(unsigned long baud) { (void)baud; }
+        size_t write(uint8_t c) override;
+        size_t write(const uint8_t* buffer, size_t size) override;
+        using Print::write;
+        int available() override;
+        int read() override;
+        int peek() override;
+};
+
+extern HardwareSerial Serial;
+
+enum RFMode { RF_DEFAULT = 0, RF_CAL = 1, RF_NO_CAL = 2, RF_DISABLED = 4 };
+
+/*
+the ESP8266 itself: restarts, deep-sleep, heap and flash
+restart and deepSleep end the simulated boot (they throw SimRestart, see sim.h)
+*/
+class EspClass {
+    public:
+        [[noreturn]] void restart();
+        [[noreturn]] void deepSleep(uint64_t time_us, RFMode mode = RF_DEFAULT);
+        uint64_t deepSleepMax();
+        uint32_t getFreeHeap();
+        uint32_t getMaxFreeBlockSize();
+        uint8_t getHeapFragmentation();
+        uint32_t getFreeContStack();
+        uint32_t getSketchSize();
+        uint32_t getFreeSketchSpace();
+        String getSketchMD5();
+        String getChipId();
+        bool flashRead(uint32_t address, uint32_t* data, size_t size);
+        bool flashWrite(uint32_t address, const uint32_t* data, size_t size);
+        bool flashEraseSector(uint32_t sector);
+};
+
+extern EspClass ESP;
+
+#endif // ARDUINO_H
@@ -0,0 +1,848 @@
+#include <ArduinoJson.h>
+
+namespace ArduinoJsonShim {
+
+/*
+helper that resolves a reference to it's node, missing members (and array items) are only added if create is set
+*/
+Node* resolve(JsonDocument* doc, Ref* ref, bool create) {
+    if (ref->node != nullptr) return ref->node;
+    if (!ref->parent) return nullptr;
+    Node* parent = resolve(doc, ref->parent.get(), create);
+    if (parent == nullptr) return nullptr;
+    if (ref->index >= 0) {
+        if (parent->type == Type::Array && (size_t)ref->index < parent->items.size()) return parent->items[ref->index].get();
+        if (!create) return nullptr;
+        if (parent->type == Type::Null) parent->type = Type::Array;
+        if (parent->type != Type::Array) return nullptr;
+        while (parent->items.size() <= (size_t)ref->index) {
+            if (!doc->alloc(ARDUINOJSON_SLOT_SIZE)) return nullptr;
+            parent->items.emplace_back(new Node());
+        }
+        return parent->items[ref->index].get();
+    }
+    if (parent->type == Type::Object) {
+        int i = parent->find(ref->key.c_str());
+        if (i >= 0) return parent->items[i].get();
+    }
+    if (!create) return nullptr;
+    if (parent->type == Type::Null) parent->type = Type::Object;
+    if (parent->type != Type::Object) return nullptr;
+    if (!doc->alloc(ARDUINOJSON_SLOT_SIZE)) return nullptr;
+    if (ref->keyOwned && !doc->allocString(ref->key)) return nullptr;
+    parent->keys.push_back(ref->key);
+    parent->keysOwned.push_back(ref->keyOwned);
+    parent->items.emplace_back(new Node());
+    return parent->items.back().get();
+}
+
+/*
+helper that deep copies src into dst, taking the memory from doc (linked strings stay linked)
+*/
+bool copyNode(JsonDocument* doc, Node* dst, const Node* src) {
+    dst->reset();
+    dst->boolean = src->boolean;
+    dst->sint = src->sint;
+    dst->uint = src->uint;
+    dst->real = src->real;
+    if (src->type == Type::String) {
+        if (src->strOwned && !doc->allocString(src->str)) return false;
+        dst->str = src->str;
+        dst->strOwned = src->strOwned;
+    }
+    dst->type = src->type;
+    for (size_t i = 0; i < src->items.size(); ++i) {
+        if (!doc->alloc(ARDUINOJSON_SLOT_SIZE)) return false;
+        if (src->type == Type::Object) {
+            if (src->keysOwned[i] && !doc->allocString(src->keys[i])) return false;
+            dst->keys.push_back(src->keys[i]);
+            dst->keysOwned.push_back(src->keysOwned[i]);
+        }
+        dst->items.emplace_back(new Node());
+        if (!copyNode(doc, dst->items.back().get(), src->items[i].get())) return false;
+    }
+    return true;
+}
+
+/*
+helper that returns the value of a number (or of a string holding one)
+*/
+bool toNumber(const Node* n, double* value) {
+    switch (n->type) {
+        case Type::Signed: *value = n->sint; return true;
+        case Type::Unsigned: *value = n->uint; return true;
+        case Type::Float: *value = n->real; return true;
+        case Type::String: {
+            char* end;
+            *value = strtod(n->str.c_str(), &end);
+            return end != n->str.c_str();
+        }
+        default: return false;
+    }
+}
+
+/*
+helper that compares two values deeply, numbers are compared by value
+*/
+bool equalNodes(const Node* a, const Node* b) {
+    bool aNull = a == nullptr || a->type == Type::Null;
+    bool bNull = b == nullptr || b->type == Type::Null;
+    if (aNull || bNull) return aNull == bNull;
+    bool aNumber = a->type == Type::Signed || a->type == Type::Unsigned || a->type == Type::Float;
+    bool bNumber = b->type == Type::Signed || b->type == Type::Unsigned || b->type == Type::Float;
+    if (aNumber && bNumber) {
+        if (a->type == Type::Float || b->type == Type::Float) {
+            double x, y;
+            toNumber(a, &x);
+            toNumber(b, &y);
+            return x == y;
+        }
+        if (a->type == b->type) return a->type == Type::Signed ? a->sint == b->sint : a->uint == b->uint;
+        const Node* s = a->type == Type::Signed ? a : b;
+        const Node* u = a->type == Type::Signed ? b : a;
+        return s->sint >= 0 && (uint64_t)s->sint == u->uint;
+    }
+    if (a->type != b->type) return false;
+    switch (a->type) {
+        case Type::Bool: return a->boolean == b->boolean;
+        case Type::String: return a->str == b->str;
+        case Type::Array:
+            if (a->items.size() != b->items.size()) return false;
+            for (size_t i = 0; i < a->items.size(); ++i) if (!equalNodes(a->items[i].get(), b->items[i].get())) return false;
+            return true;
+        case Type::Object:
+            if (a->items.size() != b->items.size()) return false;
+            for (size_t i = 0; i < a->items.size(); ++i) {
+                int j = b->find(a->keys[i].c_str());
+                if (j < 0 || !equalNodes(a->items[i].get(), b->items[j].get())) return false;
+            }
+            return true;
+        default: return false;
+    }
+}
+
+//------------------------------------------
+// serialization
+
+/*
+output of the serializers, counts what it writes (a limited buffer drops what does not fit)
+*/
+class Writer {
+    public:
+        size_t count = 0;
+        virtual ~Writer() {}
+        void put(uint8_t c) { write(&c, 1); }
+        void write(const uint8_t* data, size_t len) {
+            emit(data, len);
+            count += len;
+        }
+        void write(const char* s) { write((const uint8_t*)s, strlen(s)); }
+    protected:
+        virtual void emit(const uint8_t* data, size_t len) = 0;
+};
+
+class PrintWriter : public Writer {
+    private:
+        Print& _out;
+    public:
+        PrintWriter(Print& out) : _out(out) {}
+    protected:
+        void emit(const uint8_t* data, size_t len) override {
+            if (len == 1) _out.write(data[0]);
+            else _out.write(data, len);
+        }
+};
+
+class StringWriter : public Writer {
+    private:
+        std::string& _out;
+    public:
+        StringWriter(std::string& out) : _out(out) {}
+    protected:
+        void emit(const uint8_t* data, size_t len) override { _out.append((const char*)data, len); }
+};
+
+class BufferWriter : public Writer {
+    private:
+        uint8_t* _buffer;
+        size_t _size;
+        size_t _used = 0;
+    public:
+        BufferWriter(void* buffer, size_t size) : _buffer((uint8_t*)buffer), _size(size) {}
+        size_t used() const { return _used; }
+    protected:
+        void emit(const uint8_t* data, size_t len) override {
+            size_t n = min(len, _size - _used);
+            memcpy(_buffer + _used, data, n);
+            _used += n;
+        }
+};
+
+class NullWriter : public Writer {
+    protected:
+        void emit(const uint8_t*, size_t) override {}
+};
+
+/*
+helper that writes a float the way ArduinoJson does (up to 9 significant digits, exponent for large and tiny values)
+*/
+static void writeJsonFloat(Writer& w, double value) {
+    if (std::isnan(value)) return w.write("NaN");
+    if (std::isinf(value)) return w.write(value > 0 ? "Infinity" : "-Infinity");
+    char buffer[32];
+    double magnitude = fabs(value);
+    if (magnitude != 0 && (magnitude >= 1e7 || magnitude < 1e-5)) snprintf(buffer, sizeof(buffer), "%.9g", value);
+    else {
+        snprintf(buffer, sizeof(buffer), "%.9f", value);
+        char* dot = strchr(buffer, '.');
+        if (dot != nullptr) {
+            // keep 9 significant digits, trailing zeros and a trailing dot are dropped
+            int integral = dot - buffer - (buffer[0] == '-' ? 1 : 0);
+            int keep = max(9 - (magnitude >= 1 ? integral : 0), 0);
+            char* end = dot + 1 + min(keep, 9);
+            *end = '\0';
+            while (end > dot + 1 && end[-1] == '0') *--end = '\0';
+            if (end == dot + 1) *dot = '\0';
+        }
+    }
+    w.write(buffer);
+}
+
+static void writeJsonString(Writer& w, const std::string& s) {
+    w.put('"');
+    for (char c : s) {
+        const char* escaped = nullptr;
+        switch (c) {
+            case '"': escaped = "\\\""; break;
+            case '\\': escaped = "\\\\"; break;
+            case '\b': escaped = "\\b"; break;
+            case '\f': escaped = "\\f"; break;
+            case '\n': escaped = "\\n"; break;
+            case '\r': escaped = "\\r"; break;
+            case '\t': escaped = "\\t"; break;
+        }
+        if (escaped != nullptr) w.write(escaped);
+        else w.put(c);
+    }
+    w.put('"');
+}
+
+static void writeJson(Writer& w, const Node* n) {
+    char buffer[24];
+    if (n == nullptr) return w.write("null");
+    switch (n->type) {
+        case Type::Null: return w.write("null");
+        case Type::Bool: return w.write(n->boolean ? "true" : "false");
+        case Type::Signed:
+            snprintf(buffer, sizeof(buffer), "%lld", (long long)n->sint);
+            return w.write(buffer);
+        case Type::Unsigned:
+            snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)n->uint);
+            return w.write(buffer);
+        case Type::Float: return writeJsonFloat(w, n->real);
+        case Type::String: return writeJsonString(w, n->str);
+        case Type::Array:
+            w.put('[');
+            for (size_t i = 0; i < n->items.size(); ++i) {
+                if (i > 0) w.put(',');
+                writeJson(w, n->items[i].get());
+            }
+            return w.put(']');
+        case Type::Object:
+            w.put('{');
+            for (size_t i = 0; i < n->items.size(); ++i) {
+                if (i > 0) w.put(',');
+                writeJsonString(w, n->keys[i]);
+                w.put(':');
+                writeJson(w, n->items[i].get());
+            }
+            return w.put('}');
+    }
+}
+
+static void writeBigEndian(Writer& w, uint64_t value, uint8_t bytes) {
+    for (int i = bytes - 1; i >= 0; --i) w.put(value >> (i * 8));
+}
+
+static void writeMsgPackString(Writer& w, const std::string& s) {
+    size_t n = s.size();
+    if (n < 0x20) w.put(0xa0 | n);
+    else if (n < 0x100) {
+        w.put(0xd9);
+        writeBigEndian(w, n, 1);
+    }
+    else if (n < 0x10000) {
+        w.put(0xda);
+        writeBigEndian(w, n, 2);
+    }
+    else {
+        w.put(0xdb);
+        writeBigEndian(w, n, 4);
+    }
+    w.write((const uint8_t*)s.data(), n);
+}
+
+static void writeMsgPackUnsigned(Writer& w, uint64_t value) {
+    if (value <= 0x7f) w.put(value);
+    else if (value <= 0xff) {
+        w.put(0xcc);
+        writeBigEndian(w, value, 1);
+    }
+    else if (value <= 0xffff) {
+        w.put(0xcd);
+        writeBigEndian(w, value, 2);
+    }
+    else if (value <= 0xffffffff) {
+        w.put(0xce);
+        writeBigEndian(w, value, 4);
+    }
+    else {
+        w.put(0xcf);
+        writeBigEndian(w, value, 8);
+    }
+}
+
+static void writeMsgPackContainer(Writer& w, size_t n, uint8_t fix, uint8_t head16) {
+    if (n < 0x10) w.put(fix | n);
+    else if (n < 0x10000) {
+        w.put(head16);
+        writeBigEndian(w, n, 2);
+    }
+    else {
+        w.put(head16 + 1);
+        writeBigEndian(w, n, 4);
+    }
+}
+
+static void writeMsgPack(Writer& w, const Node* n) {
+    if (n == nullptr) return w.put(0xc0);
+    switch (n->type) {
+        case Type::Null: return w.put(0xc0);
+        case Type::Bool: return w.put(n->boolean ? 0xc3 : 0xc2);
+        case Type::Signed: {
+            int64_t value = n->sint;
+            if (value >= 0) return writeMsgPackUnsigned(w, value);
+            if (value >= -0x20) return w.put(value);
+            if (value >= -0x80) {
+                w.put(0xd0);
+                return writeBigEndian(w, value, 1);
+            }
+            if (value >= -0x8000) {
+                w.put(0xd1);
+                return writeBigEndian(w, value, 2);
+            }
+            if (value >= -0x80000000LL) {
+                w.put(0xd2);
+                return writeBigEndian(w, value, 4);
+            }
+            w.put(0xd3);
+            return writeBigEndian(w, value, 8);
+        }
+        case Type::Unsigned: return writeMsgPackUnsigned(w, n->uint);
+        case Type::Float: {
+            float value32 = n->real;
+            if (value32 == n->real || std::isnan(n->real)) {
+                uint32_t bits;
+                memcpy(&bits, &value32, 4);
+                w.put(0xca);
+                return writeBigEndian(w, bits, 4);
+            }
+            uint64_t bits;
+            memcpy(&bits, &n->real, 8);
+            w.put(0xcb);
+            return writeBigEndian(w, bits, 8);
+        }
+        case Type::String: return writeMsgPackString(w, n->str);
+        case Type::Array:
+            writeMsgPackContainer(w, n->items.size(), 0x90, 0xdc);
+            for (auto& item : n->items) writeMsgPack(w, item.get());
+            return;
+        case Type::Object:
+            writeMsgPackContainer(w, n->items.size(), 0x80, 0xde);
+            for (size_t i = 0; i < n->items.size(); ++i) {
+                writeMsgPackString(w, n->keys[i]);
+                writeMsgPack(w, n->items[i].get());
+            }
+            return;
+    }
+}
+
+std::string toJson(const Node* node) {
+    std::string out;
+    StringWriter w(out);
+    writeJson(w, node);
+    return out;
+}
+
+//------------------------------------------
+// deserialization
+
+/*
+input of the parsers, returns -1 at the end
+*/
+class Reader {
+    public:
+        virtual ~Reader() {}
+        virtual int read() = 0;
+};
+
+class StreamReader : public Reader {
+    private:
+        Stream& _stream;
+    public:
+        StreamReader(Stream& stream) : _stream(stream) {}
+        int read() override {
+            char c;
+            return _stream.readBytes(&c, 1) == 1 ? (uint8_t)c : -1;
+        }
+};
+
+class BufferReader : public Reader {
+    private:
+        const uint8_t* _p;
+        const uint8_t* _end;
+    public:
+        BufferReader(const void* data, size_t size) : _p((const uint8_t*)data), _end((const uint8_t*)data + size) {}
+        int read() override { return _p < _end ? *_p++ : -1; }
+};
+
+typedef DeserializationError::Code Code;
+
+/*
+parser of JSON, like ArduinoJson it stops right after the value (a number consumes the character behind it)
+*/
+class JsonParser {
+    private:
+        JsonDocument& _doc;
+        Reader& _in;
+        int _current = -2;  // character peeked (-2 if none)
+        int peek() {
+            if (_current == -2) _current = _in.read();
+            return _current;
+        }
+        int next() {
+            int c = peek();
+            _current = -2;
+            return c;
+        }
+        int skipSpace() {
+            while (peek() == ' ' || peek() == '\t' || peek() == '\r' || peek() == '\n') next();
+            return peek();
+        }
+        Code parseString(std::string& out) {
+            int quote = next();
+            while (true) {
+                int c = next();
+                if (c < 0) return DeserializationError::IncompleteInput;
+                if (c == quote) return DeserializationError::Ok;
+                if (c == '\\') {
+                    c = next();
+                    switch (c) {
+                        case -1: return DeserializationError::IncompleteInput;
+                        case 'b': c = '\b'; break;
+                        case 'f': c = '\f'; break;
+                        case 'n': c = '\n'; break;
+                        case 'r': c = '\r'; break;
+                        case 't': c = '\t'; break;
+                        case 'u': {
+                            unsigned code = 0;
+                            for (int i = 0; i < 4; ++i) {
+                                int h = next();
+                                if (h < 0) return DeserializationError::IncompleteInput;
+                                if (!isxdigit(h)) return DeserializationError::InvalidInput;
+                                code = code * 16 + (isdigit(h) ? h - '0' : (tolower(h) - 'a' + 10));
+                            }
+                            if (code < 0x80) out += (char)code;
+                            else if (code < 0x800) {
+                                out += (char)(0xc0 | code >> 6);
+                                out += (char)(0x80 | (code & 0x3f));
+                            }
+                            else {
+                                out += (char)(0xe0 | code >> 12);
+                                out += (char)(0x80 | ((code >> 6) & 0x3f));
+                                out += (char)(0x80 | (code & 0x3f));
+                            }
+                            continue;
+                        }
+                    }
+                }
+                out += (char)c;
+            }
+        }
+        Code parseValue(Node* n, uint8_t depth) {
+            int c = skipSpace();
+            if (c < 0) return DeserializationError::IncompleteInput;
+            if (c == '{' || c == '[') {
+                if (depth == 0) return DeserializationError::TooDeep;
+                bool object = c == '{';
+                n->type = object ? Type::Object : Type::Array;
+                next();
+                if (skipSpace() == (object ? '}' : ']')) {
+                    next();
+                    return DeserializationError::Ok;
+                }
+                while (true) {
+                    if (!_doc.alloc(ARDUINOJSON_SLOT_SIZE)) return DeserializationError::NoMemory;
+                    if (object) {
+                        c = skipSpace();
+                        if (c < 0) return DeserializationError::IncompleteInput;
+                        if (c != '"' && c != '\'') return DeserializationError::InvalidInput;
+                        std::string key;
+                        Code error = parseString(key);
+                        if (error != DeserializationError::Ok) return error;
+                        if (!_doc.allocString(key)) return DeserializationError::NoMemory;
+                        c = skipSpace();
+                        if (c < 0) return DeserializationError::IncompleteInput;
+                        if (c != ':') return DeserializationError::InvalidInput;
+                        next();
+                        n->keys.push_back(key);
+                        n->keysOwned.push_back(true);
+                    }
+                    n->items.emplace_back(new Node());
+                    Code error = parseValue(n->items.back().get(), depth - 1);
+                    if (error != DeserializationError::Ok) return error;
+                    c = skipSpace();
+                    if (c < 0) return DeserializationError::IncompleteInput;
+                    next();
+                    if (c == (object ? '}' : ']')) return DeserializationError::Ok;
+                    if (c != ',') return DeserializationError::InvalidInput;
+                }
+            }
+            if (c == '"' || c == '\'') {
+                std::string s;
+                Code error = parseString(s);
+                if (error != DeserializationError::Ok) return error;
+                if (!_doc.allocString(s)) return DeserializationError::NoMemory;
+                n->type = Type::String;
+                n->str = s;
+                n->strOwned = true;
+                return DeserializationError::Ok;
+            }
+            std::string token;
+            while (peek() >= 0 && (isalnum(peek()) || peek() == '-' || peek() == '+' || peek() == '.')) token += (char)next();
+            if (token.empty()) return DeserializationError::InvalidInput;
+            if (token == "true" || token == "false") {
+                n->type = Type::Bool;
+                n->boolean = token == "true";
+                return DeserializationError::Ok;
+            }
+            if (token == "null") return DeserializationError::Ok;
+            if (token == "NaN" || token == "Infinity" || token == "-Infinity") {
+                n->type = Type::Float;
+                n->real = token == "NaN" ? NAN : (token[0] == '-' ? -INFINITY : INFINITY);
+                return DeserializationError::Ok;
+            }
+            char* end;
+            errno = 0;
+            if (token.find_first_of(".eE") == std::string::npos) {
+                if (token[0] == '-') {
+                    long long value = strtoll(token.c_str(), &end, 10);
+                    if (*end == '\0' && errno == 0) {
+                        n->type = Type::Signed;
+                        n->sint = value;
+                        return DeserializationError::Ok;
+                    }
+                }
+                else {
+                    unsigned long long value = strtoull(token.c_str(), &end, 10);
+                    if (*end == '\0' && errno == 0) {
+                        n->type = Type::Unsigned;
+                        n->uint = value;
+                        return DeserializationError::Ok;
+                    }
+                }
+            }
+            double value = strtod(token.c_str(), &end);
+            if (*end != '\0') return DeserializationError::InvalidInput;
+            n->type = Type::Float;
+            n->real = value;
+            return DeserializationError::Ok;
+        }
+    public:
+        JsonParser(JsonDocument& doc, Reader& in) : _doc(doc), _in(in) {}
+        DeserializationError parse() {
+            _doc.clear();
+            if (skipSpace() < 0) return DeserializationError::EmptyInput;
+            return parseValue(&_doc._root, ARDUINOJSON_DEFAULT_NESTING_LIMIT);
+        }
+};
+
+/*
+parser of MessagePack
+*/
+class MsgPackParser {
+    private:
+        JsonDocument& _doc;
+        Reader& _in;
+        bool readBytes(void* data, size_t len) {
+            uint8_t* p = (uint8_t*)data;
+            for (size_t i = 0; i < len; ++i) {
+                int c = _in.read();
+                if (c < 0) return false;
+                p[i] = c;
+            }
+            return true;
+        }
+        bool readBigEndian(uint64_t* value, uint8_t bytes) {
+            uint8_t data[8];
+            if (!readBytes(data, bytes)) return false;
+            *value = 0;
+            for (uint8_t i = 0; i < bytes; ++i) *value = *value << 8 | data[i];
+            return true;
+        }
+        Code readString(std::string& out, size_t len) {
+            out.resize(len);
+            if (!readBytes(&out[0], len)) return DeserializationError::IncompleteInput;
+            return _doc.allocString(out) ? DeserializationError::Ok : DeserializationError::NoMemory;
+        }
+        Code readContainer(Node* n, size_t count, bool object, uint8_t depth) {
+            if (depth == 0) return DeserializationError::TooDeep;
+            n->type = object ? Type::Object : Type::Array;
+            for (size_t i = 0; i < count; ++i) {
+                if (!_doc.alloc(ARDUINOJSON_SLOT_SIZE)) return DeserializationError::NoMemory;
+                if (object) {
+                    Node key;
+                    Code error = parseValue(&key, depth - 1);
+                    if (error != DeserializationError::Ok) return error;
+                    if (key.type != Type::String) return DeserializationError::InvalidInput;
+                    n->keys.push_back(key.str);
+                    n->keysOwned.push_back(true);
+                }
+                n->items.emplace_back(new Node());
+                Code error = parseValue(n->items.back().get(), depth - 1);
+                if (error != DeserializationError::Ok) return error;
+            }
+            return DeserializationError::Ok;
+        }
+    public:
+        MsgPackParser(JsonDocument& doc, Reader& in) : _doc(doc), _in(in) {}
+        Code parseValue(Node* n, uint8_t depth, int first = -2) {
+            int c = first != -2 ? first : _in.read();
+            if (c < 0) return DeserializationError::IncompleteInput;
+            uint64_t value;
+            if (c <= 0x7f) {
+                n->type = Type::Unsigned;
+                n->uint = c;
+                return DeserializationError::Ok;
+            }
+            if (c >= 0xe0) {
+                n->type = Type::Signed;
+                n->sint = (int8_t)c;
+                return DeserializationError::Ok;
+            }
+            if (c >= 0xa0 && c <= 0xbf) {
+                n->type = Type::String;
+                n->strOwned = true;
+                return readString(n->str, c & 0x1f);
+            }
+            if (c >= 0x90 && c <= 0x9f) return readContainer(n, c & 0x0f, false, depth);
+            if (c >= 0x80 && c <= 0x8f) return readContainer(n, c & 0x0f, true, depth);
+            switch (c) {
+                case 0xc0: return DeserializationError::Ok;
+                case 0xc2: case 0xc3:
+                    n->type = Type::Bool;
+                    n->boolean = c == 0xc3;
+                    return DeserializationError::Ok;
+                case 0xca: case 0xcb: {
+                    if (!readBigEndian(&value, c == 0xca ? 4 : 8)) return DeserializationError::IncompleteInput;
+                    n->type = Type::Float;
+                    if (c == 0xca) {
+                        uint32_t bits = value;
+                        float f;
+                        memcpy(&f, &bits, 4);
+                        n->real = f;
+                    }
+                    else memcpy(&n->real, &value, 8);
+                    return DeserializationError::Ok;
+                }
+                case 0xcc: case 0xcd: case 0xce: case 0xcf:
+                    if (!readBigEndian(&value, 1 << (c - 0xcc))) return DeserializationError::IncompleteInput;
+                    n->type = Type::Unsigned;
+                    n->uint = value;
+                    return DeserializationError::Ok;
+                case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+                    uint8_t bytes = 1 << (c - 0xd0);
+                    if (!readBigEndian(&value, bytes)) return DeserializationError::IncompleteInput;
+                    n->type = Type::Signed;
+                    n->sint = bytes == 8 ? (int64_t)value : (int64_t)(value << (64 - bytes * 8)) >> (64 - bytes * 8);
+                    return DeserializationError::Ok;
+                }
+                case 0xd9: case 0xda: case 0xdb:
+                    if (!readBigEndian(&value, 1 << (c - 0xd9))) return DeserializationError::IncompleteInput;
+                    n->type = Type::String;
+                    n->strOwned = true;
+                    return readString(n->str, value);
+                case 0xdc: case 0xdd:
+                    if (!readBigEndian(&value, c == 0xdc ? 2 : 4)) return DeserializationError::IncompleteInput;
+                    return readContainer(n, value, false, depth);
+                case 0xde: case 0xdf:
+                    if (!readBigEndian(&value, c == 0xde ? 2 : 4)) return DeserializationError::IncompleteInput;
+                    return readContainer(n, value, true, depth);
+            }
+            return DeserializationError::InvalidInput;
+        }
+        DeserializationError parse() {
+            _doc.clear();
+            int first = _in.read();
+            if (first < 0) return DeserializationError::EmptyInput;
+            return parseValue(&_doc._root, ARDUINOJSON_DEFAULT_NESTING_LIMIT, first);
+        }
+};
+
+}  // namespace ArduinoJsonShim
+
+using namespace ArduinoJsonShim;
+
+const char* DeserializationError::c_str() const {
+    static const char* names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+    return names[_code];
+}
+
+void JsonVariant::remove(const char* key) const {
+    Node* n = node();
+    if (n == nullptr || n->type != Type::Object) return;
+    int i = n->find(key);
+    if (i < 0) return;
+    n->keys.erase(n->keys.begin() + i);
+    n->keysOwned.erase(n->keysOwned.begin() + i);
+    n->items.erase(n->items.begin() + i);
+}
+
+JsonArray JsonVariant::createNestedArray(const char* key) const { return (*this)[key].to<JsonArray>(); }
+JsonObject JsonVariant::createNestedObject(const char* key) const { return (*this)[key].to<JsonObject>(); }
+
+JsonArray JsonVariant::createNestedArray() const {
+    Node* n = node(true);
+    if (n == nullptr) return JsonArray();
+    if (n->type == Type::Null) n->type = Type::Array;
+    if (n->type != Type::Array || !_doc->alloc(ARDUINOJSON_SLOT_SIZE)) return JsonArray();
+    n->items.emplace_back(new Node());
+    n->items.back()->type = Type::Array;
+    return JsonArray(_doc, n->items.back().get());
+}
+
+JsonObject JsonVariant::createNestedObject() const {
+    Node* n = node(true);
+    if (n == nullptr) return JsonObject();
+    if (n->type == Type::Null) n->type = Type::Array;
+    if (n->type != Type::Array || !_doc->alloc(ARDUINOJSON_SLOT_SIZE)) return JsonObject();
+    n->items.emplace_back(new Node());
+    n->items.back()->type = Type::Object;
+    return JsonObject(_doc, n->items.back().get());
+}
+
+size_t serializeJson(const JsonDocument& src, Print& out) {
+    PrintWriter w(out);
+    writeJson(w, &src._root);
+    return w.count;
+}
+
+size_t serializeJson(const JsonVariant& src, Print& out) {
+    PrintWriter w(out);
+    writeJson(w, src.node());
+    return w.count;
+}
+
+size_t serializeJson(const JsonDocument& src, char* buffer, size_t size) {
+    if (size == 0) return 0;
+    BufferWriter w(buffer, size - 1);
+    writeJson(w, &src._root);
+    buffer[w.used()] = '\0';
+    return w.used();
+}
+
+size_t serializeJson(const JsonDocument& src, std::string& out) {
+    StringWriter w(out);
+    writeJson(w, &src._root);
+    return w.count;
+}
+
+size_t serializeJson(const JsonVariant& src, std::string& out) {
+    StringWriter w(out);
+    writeJson(w, src.node());
+    return w.count;
+}
+
+size_t measureJson(const JsonDocument& src) {
+    NullWriter w;
+    writeJson(w, &src._root);
+    return w.count;
+}
+
+size_t measureJson(const JsonVariant& src) {
+    NullWriter w;
+    writeJson(w, src.node());
+    return w.count;
+}
+
+size_t serializeMsgPack(const JsonDocument& src, Print& out) {
+    PrintWriter w(out);
+    writeMsgPack(w, &src._root);
+    return w.count;
+}
+
+size_t serializeMsgPack(const JsonVariant& src, Print& out) {
+    PrintWriter w(out);
+    writeMsgPack(w, src.node());
+    return w.count;
+}
+
+size_t serializeMsgPack(const JsonDocument& src, void* buffer, size_t size) {
+    BufferWriter w(buffer, size);
+    writeMsgPack(w, &src._root);
+    return w.used();
+}
+
+size_t serializeMsgPack(const JsonDocument& src, std::string& out) {
+    StringWriter w(out);
+    writeMsgPack(w, &src._root);
+    return w.count;
+}
+
+size_t measureMsgPack(const JsonDocument& src) {
+    NullWriter w;
+    writeMsgPack(w, &src._root);
+    return w.count;
+}
+
+size_t measureMsgPack(const JsonVariant& src) {
+    NullWriter w;
+    writeMsgPack(w, src.node());
+    return w.count;
+}
+
+DeserializationError deserializeJson(JsonDocument& doc, Stream& input) {
+    StreamReader reader(input);
+    return JsonParser(doc, reader).parse();
+}
+
+DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t size) {
+    BufferReader reader(input, size);
+    return JsonParser(doc, reader).parse();
+}
+
+DeserializationError deserializeJson(JsonDocument& doc, const char* input) {
+    return deserializeJson(doc, input, strlen(input));
+}
+
+DeserializationError deserializeJson(JsonDocument& doc, const std::string& input) {
+    return deserializeJson(doc, input.data(), input.size());
+}
+
+DeserializationError deserializeMsgPack(JsonDocument& doc, Stream& input) {
+    StreamReader reader(input);
+    return MsgPackParser(doc, reader).parse();
+}
+
+DeserializationError deserializeMsgPack(JsonDocument& doc, const char* input, size_t size) {
+    BufferReader reader(input, size);
+    return MsgPackParser(doc, reader).parse();
+}
+
+DeserializationError deserializeMsgPack(JsonDocument& doc, const uint8_t* input, size_t size) {
+    return deserializeMsgPack(doc, (const char*)input, size);
+}
+
+DeserializationError deserializeMsgPack(JsonDocument& doc, const std::string& input) {
+    return deserializeMsgPack(doc, input.data(), input.size());
+}
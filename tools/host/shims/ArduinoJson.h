@@ -0,0 +1,588 @@
+#ifndef ARDUINOJSON_H
+#define ARDUINOJSON_H
+
+/*
+host stand-in for the part of ArduinoJson 6 used by nahs-Bricks-OS
+documents account their memory like ArduinoJson does on ESP8266 (a 16 byte slot per value, copied strings deduplicated, nothing reclaimed by remove)
+so capacities, memoryUsage() and overflows behave as on the Brick, DynamicJsonDocuments take their capacity from the simulated heap
+serializers and parsers live in shims/ArduinoJson.cpp
+*/
+
+#include <Arduino.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#define ARDUINOJSON_SLOT_SIZE 16
+#define JSON_ARRAY_SIZE(n) ((n) * ARDUINOJSON_SLOT_SIZE)
+#define JSON_OBJECT_SIZE(n) ((n) * ARDUINOJSON_SLOT_SIZE)
+#define ARDUINOJSON_DEFAULT_NESTING_LIMIT 10
+
+bool simHeapAlloc(size_t size);  // provided by the simulation, false if the heap has no block that large
+void simHeapFree(size_t size);
+
+namespace ArduinoJsonShim {
+
+enum class Type : uint8_t { Null, Bool, Signed, Unsigned, Float, String, Array, Object };
+
+/*
+a value of a document, arrays and objects own their children
+*/
+struct Node {
+    Type type = Type::Null;
+    bool boolean = false;
+    int64_t sint = 0;
+    uint64_t uint = 0;
+    double real = 0;
+    std::string str;
+    bool strOwned = false;  // string got copied into the document (linked otherwise)
+    std::vector<std::unique_ptr<Node>> items;  // array items or object values
+    std::vector<std::string> keys;  // object keys, parallel to items
+    std::vector<bool> keysOwned;
+    void reset() {
+        type = Type::Null;
+        str.clear();
+        items.clear();
+        keys.clear();
+        keysOwned.clear();
+    }
+    int find(const char* key) const {
+        for (size_t i = 0; i < keys.size(); ++i) if (keys[i] == key) return i;
+        return -1;
+    }
+};
+
+/*
+lazy path to a value, so reading a missing member does not create it
+*/
+struct Ref {
+    std::shared_ptr<Ref> parent;
+    Node* node = nullptr;  // fixed node (if set, parent is ignored)
+    std::string key;
+    bool keyOwned = false;
+    int index = -1;  // array index (key is used if negative)
+};
+
+}  // namespace ArduinoJsonShim
+
+class JsonDocument;
+class JsonVariant;
+class JsonObject;
+class JsonArray;
+
+/*
+string of a key, as returned by JsonPair
+*/
+class JsonString {
+    private:
+        const char* _s;
+    public:
+        JsonString(const char* s = nullptr) : _s(s) {}
+        const char* c_str() const { return _s; }
+        bool isNull() const { return _s == nullptr; }
+        size_t size() const { return _s != nullptr ? strlen(_s) : 0; }
+};
+
+/*
+result of deserialization
+*/
+class DeserializationError {
+    public:
+        enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+        DeserializationError(Code code = Ok) : _code(code) {}
+        explicit operator bool() const { return _code != Ok; }
+        Code code() const { return _code; }
+        const char* c_str() const;
+        friend bool operator==(const DeserializationError& a, Code b) { return a._code == b; }
+        friend bool operator!=(const DeserializationError& a, Code b) { return a._code != b; }
+        friend bool operator==(const DeserializationError& a, const DeserializationError& b) { return a._code == b._code; }
+    private:
+        Code _code;
+};
+
+namespace ArduinoJsonShim {
+Node* resolve(JsonDocument* doc, Ref* ref, bool create);
+bool copyNode(JsonDocument* doc, Node* dst, const Node* src);
+bool equalNodes(const Node* a, const Node* b);
+std::string toJson(const Node* node);
+
+template<typename T> struct Converter;
+}  // namespace ArduinoJsonShim
+
+/*
+reference to a value of a document (also serving as ArduinoJson's MemberProxy and ElementProxy)
+*/
+class JsonVariant {
+    public:
+        JsonDocument* _doc = nullptr;
+        std::shared_ptr<ArduinoJsonShim::Ref> _ref;
+
+        JsonVariant() {}
+        JsonVariant(JsonDocument* doc, ArduinoJsonShim::Node* node) : _doc(doc) {
+            if (node != nullptr) {
+                _ref = std::make_shared<ArduinoJsonShim::Ref>();
+                _ref->node = node;
+            }
+        }
+        JsonVariant(const JsonVariant& parent, const char* key, bool keyOwned) : _doc(parent._doc) {
+            _ref = std::make_shared<ArduinoJsonShim::Ref>();
+            _ref->parent = parent._ref;
+            _ref->key = key != nullptr ? key : "";
+            _ref->keyOwned = keyOwned;
+        }
+        JsonVariant(const JsonVariant& parent, int index) : _doc(parent._doc) {
+            _ref = std::make_shared<ArduinoJsonShim::Ref>();
+            _ref->parent = parent._ref;
+            _ref->index = index;
+        }
+        JsonVariant(const JsonVariant& other) = default;
+        JsonVariant& operator=(const JsonVariant& other) = default;
+
+        ArduinoJsonShim::Node* node(bool create = false) const {
+            if (!_ref) return nullptr;
+            return ArduinoJsonShim::resolve(_doc, _ref.get(), create);
+        }
+
+        //------------------------------------------
+        // reading
+        bool isNull() const {
+            ArduinoJsonShim::Node* n = node();
+            return n == nullptr || n->type == ArduinoJsonShim::Type::Null;
+        }
+        template<typename T> T as() const { return ArduinoJsonShim::Converter<T>::from(_doc, node()); }
+        template<typename T> bool is() const { return ArduinoJsonShim::Converter<T>::is(node()); }
+        template<typename T, typename = typename std::enable_if<!std::is_pointer<T>::value || std::is_same<T, const char*>::value>::type>
+        operator T() const { return as<T>(); }
+        const char* operator|(const char* fallback) const {
+            ArduinoJsonShim::Node* n = node();
+            return n != nullptr && n->type == ArduinoJsonShim::Type::String ? n->str.c_str() : fallback;
+        }
+        template<typename T> T operator|(const T& fallback) const { return is<T>() ? as<T>() : fallback; }
+        size_t size() const {
+            ArduinoJsonShim::Node* n = node();
+            return n != nullptr && (n->type == ArduinoJsonShim::Type::Array || n->type == ArduinoJsonShim::Type::Object) ? n->items.size() : 0;
+        }
+        bool containsKey(const char* key) const {
+            ArduinoJsonShim::Node* n = node();
+            return n != nullptr && n->type == ArduinoJsonShim::Type::Object && n->find(key) >= 0;
+        }
+        bool containsKey(const String& key) const { return containsKey(key.c_str()); }
+        JsonVariant operator[](const char* key) const { return JsonVariant(*this, key, false); }
+        JsonVariant operator[](char* key) const { return JsonVariant(*this, key, true); }
+        JsonVariant operator[](const String& key) const { return JsonVariant(*this, key.c_str(), true); }
+        JsonVariant operator[](int index) const { return JsonVariant(*this, index); }
+        JsonVariant operator[](size_t index) const { return JsonVariant(*this, (int)index); }
+
+        //------------------------------------------
+        // writing
+        template<typename T> bool set(const T& value) const;
+        template<typename T> JsonVariant& operator=(const T& value) {
+            set(value);
+            return *this;
+        }
+        JsonVariant& operator=(const char* value) {
+            set(value);
+            return *this;
+        }
+        template<typename T> T to() const;
+        void remove(const char* key) const;
+        void remove(const String& key) const { remove(key.c_str()); }
+        JsonArray createNestedArray(const char* key) const;
+        JsonArray createNestedArray() const;
+        JsonObject createNestedObject(const char* key) const;
+        JsonObject createNestedObject() const;
+        template<typename T> bool add(const T& value) const;
+        void clear() const {
+            ArduinoJsonShim::Node* n = node();
+            if (n != nullptr) n->reset();
+        }
+};
+
+typedef JsonVariant JsonVariantConst;
+
+/*
+key-value pair of an object, as iterated
+*/
+class JsonPair {
+    private:
+        JsonString _key;
+        JsonVariant _value;
+    public:
+        JsonPair(const char* key, const JsonVariant& value) : _key(key), _value(value) {}
+        JsonString key() const { return _key; }
+        JsonVariant value() const { return _value; }
+};
+
+typedef JsonPair JsonPairConst;
+
+/*
+iterator over the items of an array or the members of an object
+*/
+template<typename Item>
+class JsonIterator {
+    private:
+        JsonDocument* _doc;
+        ArduinoJsonShim::Node* _node;
+        size_t _index;
+    public:
+        JsonIterator(JsonDocument* doc, ArduinoJsonShim::Node* node, size_t index) : _doc(doc), _node(node), _index(index) {}
+        bool operator!=(const JsonIterator& other) const { return _index != other._index; }
+        JsonIterator& operator++() {
+            ++_index;
+            return *this;
+        }
+        Item operator*() const;
+};
+
+template<> inline JsonVariant JsonIterator<JsonVariant>::operator*() const { return JsonVariant(_doc, _node->items[_index].get()); }
+template<> inline JsonPair JsonIterator<JsonPair>::operator*() const { return JsonPair(_node->keys[_index].c_str(), JsonVariant(_doc, _node->items[_index].get())); }
+
+/*
+reference to an array of a document
+*/
+class JsonArray : public JsonVariant {
+    public:
+        JsonArray() {}
+        JsonArray(JsonDocument* doc, ArduinoJsonShim::Node* node) : JsonVariant(doc, node != nullptr && node->type == ArduinoJsonShim::Type::Array ? node : nullptr) {}
+        JsonIterator<JsonVariant> begin() const { return JsonIterator<JsonVariant>(_doc, node(), 0); }
+        JsonIterator<JsonVariant> end() const { return JsonIterator<JsonVariant>(_doc, node(), size()); }
+};
+
+typedef JsonArray JsonArrayConst;
+
+/*
+reference to an object of a document
+*/
+class JsonObject : public JsonVariant {
+    public:
+        JsonObject() {}
+        JsonObject(JsonDocument* doc, ArduinoJsonShim::Node* node) : JsonVariant(doc, node != nullptr && node->type == ArduinoJsonShim::Type::Object ? node : nullptr) {}
+        JsonIterator<JsonPair> begin() const { return JsonIterator<JsonPair>(_doc, node(), 0); }
+        JsonIterator<JsonPair> end() const { return JsonIterator<JsonPair>(_doc, node(), size()); }
+        using JsonVariant::operator=;
+};
+
+typedef JsonObject JsonObjectConst;
+
+/*
+document with a fixed capacity, all of it's values live in it's memory pool
+*/
+class JsonDocument {
+    public:
+        ArduinoJsonShim::Node _root;
+        size_t _capacity = 0;
+        size_t _used = 0;
+        bool _overflowed = false;
+        std::unordered_set<std::string> _strings;  // copied strings, each is only stored once
+
+        size_t capacity() const { return _capacity; }
+        size_t memoryUsage() const { return _used; }
+        bool overflowed() const { return _overflowed; }
+        void clear() {
+            _root.reset();
+            _used = 0;
+            _overflowed = false;
+            _strings.clear();
+        }
+        bool isNull() const { return _root.type == ArduinoJsonShim::Type::Null; }
+        size_t size() const { return root().size(); }
+        JsonVariant root() const { return JsonVariant(const_cast<JsonDocument*>(this), const_cast<ArduinoJsonShim::Node*>(&_root)); }
+        template<typename T> T as() const { return root().as<T>(); }
+        template<typename T> bool is() const { return root().is<T>(); }
+        template<typename T> T to() {
+            clear();
+            return root().to<T>();
+        }
+        template<typename T> bool set(const T& value) {
+            clear();
+            return root().set(value);
+        }
+        JsonVariant operator[](const char* key) { return root()[key]; }
+        JsonVariant operator[](const String& key) { return root()[key]; }
+        JsonVariant operator[](int index) { return root()[index]; }
+        bool containsKey(const char* key) const { return root().containsKey(key); }
+        void remove(const char* key) { root().remove(key); }
+        JsonArray createNestedArray(const char* key) { return root().createNestedArray(key); }
+        JsonArray createNestedArray() { return root().createNestedArray(); }
+        JsonObject createNestedObject(const char* key) { return root().createNestedObject(key); }
+        template<typename T> bool add(const T& value) { return root().add(value); }
+
+        //------------------------------------------
+        // memory pool
+        bool alloc(size_t size) {
+            if (_used + size > _capacity) {
+                _overflowed = true;
+                return false;
+            }
+            _used += size;
+            return true;
+        }
+        bool allocString(const std::string& s) {
+            if (_strings.count(s) > 0) return true;
+            if (!alloc(s.size() + 1)) return false;
+            _strings.insert(s);
+            return true;
+        }
+    protected:
+        explicit JsonDocument(size_t capacity) : _capacity(capacity) {}
+        JsonDocument(const JsonDocument&) = delete;
+        JsonDocument& operator=(const JsonDocument&) = delete;
+        void moveFrom(JsonDocument& other) {
+            _root = std::move(other._root);
+            other._root.reset();
+            _capacity = other._capacity;
+            _used = other._used;
+            _overflowed = other._overflowed;
+            _strings = std::move(other._strings);
+            other._capacity = 0;
+            other._used = 0;
+            other._strings.clear();
+        }
+};
+
+/*
+document with it's memory pool on the heap
+*/
+class DynamicJsonDocument : public JsonDocument {
+    public:
+        explicit DynamicJsonDocument(size_t capacity) : JsonDocument(simHeapAlloc(capacity) ? capacity : 0) {}
+        DynamicJsonDocument(const DynamicJsonDocument& src) : DynamicJsonDocument(src._capacity) { copyFrom(src); }
+        DynamicJsonDocument(DynamicJsonDocument&& src) : JsonDocument(0) { moveFrom(src); }
+        ~DynamicJsonDocument() { simHeapFree(_capacity); }
+        DynamicJsonDocument& operator=(DynamicJsonDocument&& src) {
+            if (&src == this) return *this;
+            simHeapFree(_capacity);
+            moveFrom(src);
+            return *this;
+        }
+        DynamicJsonDocument& operator=(const DynamicJsonDocument& src) {
+            if (&src == this) return *this;
+            clear();
+            copyFrom(src);
+            return *this;
+        }
+    private:
+        void copyFrom(const JsonDocument& src) {
+            if (!ArduinoJsonShim::copyNode(this, &_root, &src._root)) _overflowed = true;
+        }
+};
+
+/*
+document with it's memory pool on the stack
+*/
+template<size_t N>
+class StaticJsonDocument : public JsonDocument {
+    public:
+        StaticJsonDocument() : JsonDocument(N) {}
+};
+
+namespace ArduinoJsonShim {
+
+template<typename T>
+bool assign(JsonDocument* doc, Node* n, const T& value) {
+    typedef typename std::decay<T>::type U;
+    if constexpr (std::is_base_of<JsonVariant, U>::value) {
+        const Node* src = value.node();
+        if (src == n) return true;
+        if (src == nullptr) {
+            n->reset();
+            return true;
+        }
+        Node copy;
+        if (!copyNode(doc, &copy, src)) return false;
+        *n = std::move(copy);
+        return true;
+    }
+    else if constexpr (std::is_base_of<JsonDocument, U>::value) {
+        Node copy;
+        if (!copyNode(doc, &copy, &value._root)) return false;
+        *n = std::move(copy);
+        return true;
+    }
+    else {
+        n->reset();
+        if constexpr (std::is_same<U, bool>::value) {
+            n->type = Type::Bool;
+            n->boolean = value;
+        }
+        else if constexpr (std::is_integral<U>::value && std::is_signed<U>::value) {
+            n->type = Type::Signed;
+            n->sint = value;
+        }
+        else if constexpr (std::is_integral<U>::value) {
+            n->type = Type::Unsigned;
+            n->uint = value;
+        }
+        else if constexpr (std::is_floating_point<U>::value) {
+            n->type = Type::Float;
+            n->real = value;
+        }
+        else if constexpr (std::is_same<U, const char*>::value) {
+            if (value == nullptr) return true;
+            n->type = Type::String;
+            n->str = value;
+        }
+        else if constexpr (std::is_same<U, char*>::value || std::is_same<U, String>::value || std::is_same<U, std::string>::value) {
+            std::string s = std::string(String(value).c_str());
+            if (!doc->allocString(s)) return false;
+            n->type = Type::String;
+            n->str = s;
+            n->strOwned = true;
+        }
+        else if constexpr (std::is_same<U, std::nullptr_t>::value) {
+        }
+        else {
+            static_assert(!sizeof(U), "type is not supported by the ArduinoJson stand-in");
+        }
+        return true;
+    }
+}
+
+bool toNumber(const Node* n, double* value);
+
+template<typename T>
+struct Converter {
+    static_assert(std::is_arithmetic<T>::value, "type is not supported by the ArduinoJson stand-in");
+    static T from(JsonDocument*, const Node* n) {
+        if (n == nullptr) return 0;
+        if constexpr (std::is_same<T, bool>::value) {
+            switch (n->type) {
+                case Type::Bool: return n->boolean;
+                case Type::Signed: return n->sint != 0;
+                case Type::Unsigned: return n->uint != 0;
+                case Type::Float: return n->real != 0;
+                default: return false;
+            }
+        }
+        else if constexpr (std::is_floating_point<T>::value) {
+            double value;
+            return toNumber(n, &value) ? (T)value : 0;
+        }
+        else {
+            if (n->type == Type::Signed) return fits(n->sint) ? (T)n->sint : 0;
+            if (n->type == Type::Unsigned) return fits(n->uint) ? (T)n->uint : 0;
+            if (n->type == Type::Bool) return n->boolean;
+            double value;
+            if (!toNumber(n, &value)) return 0;
+            return value >= (double)std::numeric_limits<T>::lowest() && value <= (double)std::numeric_limits<T>::max() ? (T)value : 0;
+        }
+    }
+    static bool is(const Node* n) {
+        if (n == nullptr) return false;
+        if constexpr (std::is_same<T, bool>::value) return n->type == Type::Bool;
+        else if constexpr (std::is_floating_point<T>::value) return n->type == Type::Signed || n->type == Type::Unsigned || n->type == Type::Float;
+        else return (n->type == Type::Signed && fits(n->sint)) || (n->type == Type::Unsigned && fits(n->uint));
+    }
+    template<typename V> static bool fits(V value) {
+        if constexpr (std::is_signed<V>::value) {
+            if (value < 0) return std::is_signed<T>::value && (int64_t)value >= (int64_t)std::numeric_limits<T>::lowest();
+            return (uint64_t)value <= (uint64_t)std::numeric_limits<T>::max();
+        }
+        else return value <= (uint64_t)std::numeric_limits<T>::max();
+    }
+};
+
+template<> struct Converter<const char*> {
+    static const char* from(JsonDocument*, const Node* n) { return n != nullptr && n->type == Type::String ? n->str.c_str() : nullptr; }
+    static bool is(const Node* n) { return n != nullptr && n->type == Type::String; }
+};
+
+template<> struct Converter<String> {
+    static String from(JsonDocument*, const Node* n) {
+        if (n != nullptr && n->type == Type::String) return String(n->str.c_str());
+        return String(toJson(n).c_str());
+    }
+    static bool is(const Node* n) { return n != nullptr && n->type == Type::String; }
+};
+
+template<> struct Converter<JsonVariant> {
+    static JsonVariant from(JsonDocument* doc, Node* n) { return JsonVariant(doc, n); }
+    static bool is(const Node*) { return true; }
+};
+
+template<> struct Converter<JsonArray> {
+    static JsonArray from(JsonDocument* doc, Node* n) { return JsonArray(doc, n); }
+    static bool is(const Node* n) { return n != nullptr && n->type == Type::Array; }
+};
+
+template<> struct Converter<JsonObject> {
+    static JsonObject from(JsonDocument* doc, Node* n) { return JsonObject(doc, n); }
+    static bool is(const Node* n) { return n != nullptr && n->type == Type::Object; }
+};
+
+template<typename T>
+bool equals(const Node* n, const T& other) {
+    typedef typename std::decay<T>::type U;
+    if constexpr (std::is_base_of<JsonVariant, U>::value) return equalNodes(n, other.node());
+    else if constexpr (std::is_same<U, const char*>::value || std::is_same<U, char*>::value) return n != nullptr && n->type == Type::String && n->str == other;
+    else if constexpr (std::is_same<U, String>::value) return n != nullptr && n->type == Type::String && n->str == other.c_str();
+    else if constexpr (std::is_same<U, bool>::value) return n != nullptr && n->type == Type::Bool && n->boolean == other;
+    else if constexpr (std::is_arithmetic<U>::value) {
+        double value;
+        return n != nullptr && n->type != Type::String && toNumber(n, &value) && value == (double)other;
+    }
+    else static_assert(!sizeof(U), "type is not supported by the ArduinoJson stand-in");
+}
+
+}  // namespace ArduinoJsonShim
+
+template<typename T> bool JsonVariant::set(const T& value) const {
+    ArduinoJsonShim::Node* n = node(true);
+    if (n == nullptr) return false;
+    return ArduinoJsonShim::assign(_doc, n, value);
+}
+
+template<typename T> T JsonVariant::to() const {
+    ArduinoJsonShim::Node* n = node(true);
+    if (n == nullptr) return T();
+    n->reset();
+    if (std::is_same<T, JsonArray>::value) n->type = ArduinoJsonShim::Type::Array;
+    else if (std::is_same<T, JsonObject>::value) n->type = ArduinoJsonShim::Type::Object;
+    return ArduinoJsonShim::Converter<T>::from(_doc, n);
+}
+
+template<typename T> bool JsonVariant::add(const T& value) const {
+    ArduinoJsonShim::Node* n = node(true);
+    if (n == nullptr) return false;
+    if (n->type == ArduinoJsonShim::Type::Null) n->type = ArduinoJsonShim::Type::Array;
+    if (n->type != ArduinoJsonShim::Type::Array || !_doc->alloc(ARDUINOJSON_SLOT_SIZE)) return false;
+    n->items.emplace_back(new ArduinoJsonShim::Node());
+    return ArduinoJsonShim::assign(_doc, n->items.back().get(), value);
+}
+
+template<typename T> bool operator==(const JsonVariant& a, const T& b) { return ArduinoJsonShim::equals(a.node(), b); }
+template<typename T> bool operator!=(const JsonVariant& a, const T& b) { return !(a == b); }
+inline bool operator==(const JsonVariant& a, const char* b) { return ArduinoJsonShim::equals(a.node(), b); }
+inline bool operator!=(const JsonVariant& a, const char* b) { return !(a == b); }
+
+//------------------------------------------
+// serialization, src is a document or a variant
+size_t serializeJson(const JsonDocument& src, Print& out);
+size_t serializeJson(const JsonVariant& src, Print& out);
+size_t serializeJson(const JsonDocument& src, char* buffer, size_t size);
+size_t serializeJson(const JsonDocument& src, std::string& out);
+size_t serializeJson(const JsonVariant& src, std::string& out);
+size_t measureJson(const JsonDocument& src);
+size_t measureJson(const JsonVariant& src);
+size_t serializeMsgPack(const JsonDocument& src, Print& out);
+size_t serializeMsgPack(const JsonVariant& src, Print& out);
+size_t serializeMsgPack(const JsonDocument& src, void* buffer, size_t size);
+size_t serializeMsgPack(const JsonDocument& src, std::string& out);
+size_t measureMsgPack(const JsonDocument& src);
+size_t measureMsgPack(const JsonVariant& src);
+
+//------------------------------------------
+// deserialization, reading from a Stream takes one byte at a time by readBytes (so it's timeout applies)
+DeserializationError deserializeJson(JsonDocument& doc, Stream& input);
+DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t size);
+DeserializationError deserializeJson(JsonDocument& doc, const char* input);
+DeserializationError deserializeJson(JsonDocument& doc, const std::string& input);
+DeserializationError deserializeMsgPack(JsonDocument& doc, Stream& input);
+DeserializationError deserializeMsgPack(JsonDocument& doc, const char* input, size_t size);
+DeserializationError deserializeMsgPack(JsonDocument& doc, const uint8_t* input, size_t size);
+DeserializationError deserializeMsgPack(JsonDocument& doc, const std::string& input);
+
+#endif // ARDUINOJSON_H
@@ -0,0 +1,43 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+
+/*
+host stand-in for the ESP8266's EEPROM emulation on a flash sector (kept by the simulation across boots)
+like on the ESP8266, a commit erases the whole sector and writes back only the bytes begun with
+*/
+
+#include <Arduino.h>
+#include <vector>
+
+class EEPROMClass {
+    private:
+        std::vector<uint8_t> _data;
+        bool _dirty = false;
+    public:
+        void begin(size_t size);
+        uint8_t read(int address) { return address >= 0 && (size_t)address < _data.size() ? _data[address] : 0; }
+        void write(int address, uint8_t value);
+        bool commit();
+        bool end();
+        uint8_t* getDataPtr() {
+            _dirty = true;
+            return _data.data();
+        }
+        const uint8_t* getConstDataPtr() const { return _data.data(); }
+        size_t length() { return _data.size(); }
+        template<typename T> T& get(int address, T& value) {
+            if (address >= 0 && address + sizeof(T) <= _data.size()) memcpy((uint8_t*)&value, _data.data() + address, sizeof(T));
+            return value;
+        }
+        template<typename T> const T& put(int address, const T& value) {
+            if (address >= 0 && address + sizeof(T) <= _data.size()) {
+                memcpy(_data.data() + address, (const uint8_t*)&value, sizeof(T));
+                _dirty = true;
+            }
+            return value;
+        }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // EEPROM_H
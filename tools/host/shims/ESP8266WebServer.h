@@ -0,0 +1,55 @@
+#ifndef ESP8266WEBSERVER_H
+#define ESP8266WEBSERVER_H
+
+/*
+host stand-in for the web server of BrickSetup's webSetup, requests are queued by the harness (see SimWebRequest)
+*/
+
+#include <ESP8266WiFi.h>
+#include <functional>
+#include <map>
+#include <vector>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+/*
+request to webSetup, handled by the next handleClient
+*/
+struct SimWebRequest {
+    HTTPMethod method;
+    std::string uri;
+    std::map<std::string, std::string> args;
+};
+
+/*
+what webSetup answered last
+*/
+struct SimWebResponse {
+    int code = 0;
+    std::string type;
+    std::string content;
+    std::vector<std::pair<std::string, std::string>> headers;
+};
+
+class ESP8266WebServer {
+    public:
+        typedef std::function<void(void)> THandlerFunction;
+        static std::vector<SimWebRequest> requests;  // queued by the harness
+        static SimWebResponse response;
+        ESP8266WebServer(int port = 80) { (void)port; }
+        void on(const char* uri, THandlerFunction handler) { _handlers[uri] = handler; }
+        void onNotFound(THandlerFunction handler) { _notFound = handler; }
+        void begin() {}
+        void handleClient();
+        HTTPMethod method() { return _request.method; }
+        String arg(const char* name);
+        void send(int code, const char* contentType, const String& content);
+        void sendHeader(const String& name, const String& value, bool first = false);
+    private:
+        std::map<std::string, THandlerFunction> _handlers;
+        THandlerFunction _notFound;
+        SimWebRequest _request;
+        std::vector<std::pair<std::string, std::string>> _headers;
+};
+
+#endif // ESP8266WEBSERVER_H
@@ -0,0 +1,113 @@
+#ifndef ESP8266WIFI_H
+#define ESP8266WIFI_H
+
+/*
+host stand-in for the ESP8266 WiFi stack, only the part used by nahs-Bricks-OS
+association, DHCP, DNS and the exchanges with BrickServer take simulated time (see sim.h), the definitions live in shims/network.cpp
+*/
+
+#include <Arduino.h>
+#include <memory>
+
+enum WiFiMode_t { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 };
+enum WiFiSleepType_t { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 };
+enum wl_status_t {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_WRONG_PASSWORD = 6,
+    WL_DISCONNECTED = 7
+};
+
+/*
+base of TCP clients, as used by BrickOS's ChunkedClientPrint and CountingStream
+*/
+class Client : public Stream {
+    public:
+        virtual int connect(IPAddress ip, uint16_t port) = 0;
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+        using Print::write;
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int read(uint8_t* buffer, size_t size) = 0;
+        virtual int peek() = 0;
+        virtual void stop() = 0;
+        virtual uint8_t connected() = 0;
+        virtual operator bool() = 0;
+};
+
+struct SimConnection;
+
+/*
+TCP connection, either to BrickServer (the server's answer is fetched once the Brick starts reading) or of an Activator event accepted by WiFiServer
+*/
+class WiFiClient : public Client {
+    private:
+        std::shared_ptr<SimConnection> _conn;
+    public:
+        WiFiClient() {}
+        explicit WiFiClient(std::shared_ptr<SimConnection> conn) : _conn(conn) {}
+        int connect(IPAddress ip, uint16_t port) override;
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t* buffer, size_t size) override;
+        using Print::write;
+        int available() override;
+        int read() override;
+        int read(uint8_t* buffer, size_t size) override;
+        int peek() override;
+        void stop() override;
+        uint8_t connected() override;
+        operator bool() override { return connected(); }
+        void setNoDelay(bool noDelay) { (void)noDelay; }
+};
+
+/*
+TCP server, accepts the Activator events sent via HTTP
+*/
+class WiFiServer {
+    private:
+        uint16_t _port;
+        uint32_t _generation = 0;  // boot the server got begun in
+    public:
+        WiFiServer(uint16_t port) : _port(port) {}
+        void begin();
+        void setNoDelay(bool noDelay) { (void)noDelay; }
+        WiFiClient available();
+};
+
+class ESP8266WiFiClass {
+    public:
+        bool forceSleepWake();
+        bool forceSleepBegin(uint32_t sleepUs = 0);
+        void persistent(bool persistent) { (void)persistent; }
+        bool mode(WiFiMode_t mode);
+        bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0, IPAddress dns2 = (uint32_t)0);
+        wl_status_t begin(const char* ssid, const char* passphrase = nullptr, int32_t channel = 0, const uint8_t* bssid = nullptr, bool connect = true);
+        wl_status_t status();
+        bool disconnect(bool wifioff = false);
+        IPAddress localIP();
+        IPAddress gatewayIP();
+        IPAddress subnetMask();
+        IPAddress dnsIP(uint8_t index = 0);
+        uint8_t* BSSID();
+        uint8_t* BSSID(uint8_t index);
+        int32_t channel();
+        int32_t channel(uint8_t index);
+        int32_t RSSI(uint8_t index);
+        int8_t scanNetworks(bool async = false, bool showHidden = false, uint8_t channel = 0, uint8_t* ssid = nullptr);
+        void scanDelete();
+        int hostByName(const char* host, IPAddress& result);
+        bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0);
+        bool softAP(const char* ssid, const char* psk = nullptr);
+        bool softAPConfig(IPAddress localIP, IPAddress gateway, IPAddress subnet);
+        IPAddress softAPIP();
+        String macAddress();
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif // ESP8266WIFI_H
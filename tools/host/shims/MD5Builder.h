@@ -0,0 +1,26 @@
+#ifndef MD5BUILDER_H
+#define MD5BUILDER_H
+
+/*
+host stand-in for the ESP8266's MD5Builder (a plain MD5, it's time is accounted by the callers' flash reads)
+*/
+
+#include <Arduino.h>
+
+class MD5Builder {
+    private:
+        uint32_t _state[4];
+        uint64_t _length;
+        uint8_t _buffer[64];
+        uint8_t _digest[16];
+        void transform(const uint8_t* block);
+    public:
+        void begin();
+        void add(const uint8_t* data, uint16_t len);
+        void add(const char* data) { add((const uint8_t*)data, strlen(data)); }
+        void calculate();
+        void getBytes(uint8_t* output) { memcpy(output, _digest, 16); }
+        String toString();
+};
+
+#endif // MD5BUILDER_H
@@ -0,0 +1,24 @@
+#ifndef UPDATER_H
+#define UPDATER_H
+
+/*
+host stand-in for the ESP8266's OTA updater, the simulation has no OTA partition so updates are refused (BrickOS then restarts)
+*/
+
+#include <Arduino.h>
+
+class UpdaterClass {
+    public:
+        bool begin(size_t size) { (void)size; return false; }
+        size_t write(uint8_t* data, size_t len) { (void)data; (void)len; return 0; }
+        size_t writeStream(Stream& data) { (void)data; return 0; }
+        bool setMD5(const char* expected) { (void)expected; return true; }
+        bool end(bool evenIfRemaining = false) { (void)evenIfRemaining; return false; }
+        bool isRunning() { return false; }
+        void clearError() {}
+        size_t remaining() { return 0; }
+};
+
+extern UpdaterClass Update;
+
+#endif // UPDATER_H
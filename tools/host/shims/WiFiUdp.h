@@ -0,0 +1,40 @@
+#ifndef WIFIUDP_H
+#define WIFIUDP_H
+
+/*
+host stand-in for the ESP8266's UDP socket, datagrams to BrickServer are answered by the simulation (see sim.h)
+*/
+
+#include <ESP8266WiFi.h>
+
+class WiFiUDP : public Stream {
+    private:
+        uint16_t _port = 0;  // local port bound (0 if not bound)
+        uint32_t _generation = 0;  // boot the socket got bound in
+        IPAddress _sendIP;
+        uint16_t _sendPort = 0;
+        std::string _sending;  // datagram being written
+        std::string _packet;  // datagram being read
+        size_t _pos = 0;
+        IPAddress _remoteIP;
+        uint16_t _remotePort = 0;
+        bool alive();
+    public:
+        uint8_t begin(uint16_t port);
+        void stop();
+        int beginPacket(IPAddress ip, uint16_t port);
+        int endPacket();
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t* buffer, size_t size) override;
+        using Print::write;
+        int parsePacket();
+        int available() override;
+        int read() override;
+        int read(unsigned char* buffer, size_t len);
+        int read(char* buffer, size_t len) { return read((unsigned char*)buffer, len); }
+        int peek() override;
+        IPAddress remoteIP() { return _remoteIP; }
+        uint16_t remotePort() { return _remotePort; }
+};
+
+#endif // WIFIUDP_H
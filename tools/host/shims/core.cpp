@@ -0,0 +1,430 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Updater.h>
+#include <MD5Builder.h>
+#include <eboot_command.h>
+#include "sim.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+EEPROMClass EEPROM;
+UpdaterClass Update;
+
+//------------------------------------------
+// time, random and pins
+uint32_t millis() {
+    return sim().millis();
+}
+
+uint32_t micros() {
+    return sim().micros();
+}
+
+void delay(unsigned long ms) {
+    sim().delay((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    sim().advance(us);
+}
+
+void yield() {
+    sim().advance(sim().costs.yield);
+}
+
+long random(long howbig) {
+    if (howbig <= 0) return 0;
+    return sim().rng() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    sim().rng.seed(seed);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+int digitalRead(uint8_t pin) {
+    (void)pin;
+    return sim().setupPin;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    (void)pin;
+    (void)val;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode) {
+    (void)pin;
+    (void)handler;
+    (void)mode;
+}
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char* dst, const char* src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = min(len, size - 1);
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+
+//------------------------------------------
+// String
+static std::string formatNumber(unsigned long long value, unsigned char base, bool negative) {
+    std::string digits;
+    if (base < 2) base = 10;
+    do {
+        uint8_t digit = value % base;
+        digits.insert(digits.begin(), digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value > 0);
+    if (negative) digits.insert(digits.begin(), '-');
+    return digits;
+}
+
+String::String(int value, unsigned char base) : String((long)value, base) {}
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+String::String(long value, unsigned char base) : _s(value < 0 && base == 10 ? formatNumber(-(long long)value, base, true) : formatNumber((unsigned long)value, base, false)) {}
+String::String(unsigned long value, unsigned char base) : _s(formatNumber(value, base, false)) {}
+
+//------------------------------------------
+// Print and Stream
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::printNumber(unsigned long long value, int base) {
+    char buffer[72];
+    char* p = buffer + sizeof(buffer) - 1;
+    *p = '\0';
+    if (base < 2) base = 10;
+    do {
+        char digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value > 0);
+    return write(p);
+}
+
+size_t Print::print(double value, int digits) {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return write(buffer);
+}
+
+int Stream::timedRead() {
+    _startMillis = millis();
+    do {
+        int c = read();
+        if (c >= 0) return c;
+        if (_timeout == 0) return -1;
+        yield();
+    } while (millis() - _startMillis < _timeout);
+    return -1;
+}
+
+int Stream::timedPeek() {
+    _startMillis = millis();
+    do {
+        int c = peek();
+        if (c >= 0) return c;
+        if (_timeout == 0) return -1;
+        yield();
+    } while (millis() - _startMillis < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int c = timedRead();
+        if (c < 0) break;
+        *buffer++ = (char)c;
+        count++;
+    }
+    return count;
+}
+
+String Stream::readStringUntil(char terminator) {
+    std::string s;
+    int c = timedRead();
+    while (c >= 0 && c != terminator) {
+        s += (char)c;
+        c = timedRead();
+    }
+    return String(s);
+}
+
+//------------------------------------------
+// IPAddress
+bool IPAddress::fromString(const char* address) {
+    uint32_t octets[4];
+    char tail;
+    if (address == nullptr || sscanf(address, "%u.%u.%u.%u%c", &octets[0], &octets[1], &octets[2], &octets[3], &tail) != 4) return false;
+    for (uint32_t octet : octets) if (octet > 255) return false;
+    *this = IPAddress(octets[0], octets[1], octets[2], octets[3]);
+    return true;
+}
+
+String IPAddress::toString() const {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buffer);
+}
+
+size_t IPAddress::printTo(Print& p) const {
+    return p.print(toString());
+}
+
+//------------------------------------------
+// Serial, output is kept by the simulation (and echoed if enabled)
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    sim().serialOut.append((const char*)buffer, size);
+    if (sim().echo) fwrite(buffer, 1, size, stdout);
+    return size;
+}
+
+int HardwareSerial::available() {
+    return sim().serialIn.size();
+}
+
+int HardwareSerial::read() {
+    if (sim().serialIn.empty()) return -1;
+    uint8_t c = sim().serialIn[0];
+    sim().serialIn.erase(0, 1);
+    return c;
+}
+
+int HardwareSerial::peek() {
+    return sim().serialIn.empty() ? -1 : (uint8_t)sim().serialIn[0];
+}
+
+//------------------------------------------
+// ESP
+void EspClass::restart() {
+    throw SimRestart{false, 0};
+}
+
+void EspClass::deepSleep(uint64_t time_us, RFMode mode) {
+    (void)mode;
+    throw SimRestart{true, time_us};
+}
+
+uint64_t EspClass::deepSleepMax() {
+    return 12000000000ULL;  // about 3.3h, depends on the RTC clock calibration on a Brick
+}
+
+uint32_t EspClass::getFreeHeap() {
+    return sim().heapFree - sim().heapUsed;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize() {
+    return getFreeHeap();  // the simulated heap does not fragment
+}
+
+uint8_t EspClass::getHeapFragmentation() {
+    return 0;
+}
+
+uint32_t EspClass::getFreeContStack() {
+    return 2500;  // the host can not measure the Brick's stack
+}
+
+uint32_t EspClass::getSketchSize() {
+    return sim().sketchSize;
+}
+
+uint32_t EspClass::getFreeSketchSpace() {
+    return sim().freeSketchSpace;
+}
+
+/*
+MD5 of the sketch, it is calculated once per boot (like the ESP8266 core caches it)
+*/
+String EspClass::getSketchMD5() {
+    static uint32_t generation = 0;
+    if (!sim().md5Override.empty()) return String(sim().md5Override);
+    if (sim().md5Cache.empty()) {
+        MD5Builder md5;
+        md5.begin();
+        for (uint32_t offset = 0; offset < sim().sketchSize; offset += 0x8000) {
+            md5.add(sim().flash.data() + offset, min(sim().sketchSize - offset, (uint32_t)0x8000));
+        }
+        md5.calculate();
+        sim().md5Cache = md5.toString().str();
+    }
+    if (generation != sim().generation) {
+        generation = sim().generation;
+        sim().advance((uint64_t)sim().sketchSize * (sim().costs.md5KB + sim().costs.flashReadKB) / 1024);
+    }
+    return String(sim().md5Cache);
+}
+
+String EspClass::getChipId() {
+    return String("00a1b2c3");
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t* data, size_t size) {
+    if ((address & 3) != 0 || address + size > sim().flash.size()) return false;
+    memcpy(data, sim().flash.data() + address, size);
+    sim().advance((size * sim().costs.flashReadKB + 1023) / 1024);
+    return true;
+}
+
+bool EspClass::flashWrite(uint32_t address, const uint32_t* data, size_t size) {
+    if ((address & 3) != 0 || address + size > sim().flash.size()) return false;
+    memcpy(sim().flash.data() + address, data, size);
+    return true;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+    uint32_t address = sector * FLASH_SECTOR_SIZE;
+    if (address + FLASH_SECTOR_SIZE > sim().flash.size()) return false;
+    memset(sim().flash.data() + address, 0xff, FLASH_SECTOR_SIZE);
+    sim().advance(sim().costs.flashWriteSector);
+    return true;
+}
+
+//------------------------------------------
+// EEPROM
+void EEPROMClass::begin(size_t size) {
+    size = min(size, (size_t)SPI_FLASH_SEC_SIZE);
+    _data.assign(sim().eeprom.begin(), sim().eeprom.begin() + size);
+    _dirty = false;
+    sim().advance(sim().costs.eepromBegin);
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    if (address < 0 || (size_t)address >= _data.size() || _data[address] == value) return;
+    _data[address] = value;
+    _dirty = true;
+}
+
+bool EEPROMClass::commit() {
+    if (_data.empty()) return false;
+    if (!_dirty) return true;
+    sim().eeprom.assign(SPI_FLASH_SEC_SIZE, 0xff);
+    std::copy(_data.begin(), _data.end(), sim().eeprom.begin());
+    _dirty = false;
+    sim().advance(sim().costs.eepromCommit);
+    sim().stats.eepromCommits++;
+    return true;
+}
+
+bool EEPROMClass::end() {
+    bool ok = commit();
+    _data.clear();
+    return ok;
+}
+
+//------------------------------------------
+// eboot
+void eboot_command_write(struct eboot_command* cmd) {
+    (void)cmd;
+    sim().ebootCommand = true;
+}
+
+//------------------------------------------
+// MD5 (RFC 1321)
+static const uint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+static const uint8_t md5R[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+void MD5Builder::transform(const uint8_t* block) {
+    uint32_t m[16];
+    for (uint8_t i = 0; i < 16; ++i) m[i] = block[i * 4] | block[i * 4 + 1] << 8 | block[i * 4 + 2] << 16 | (uint32_t)block[i * 4 + 3] << 24;
+    uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    for (uint8_t i = 0; i < 64; ++i) {
+        uint32_t f;
+        uint8_t g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        uint32_t rotated = a + f + md5K[i] + m[g];
+        a = d;
+        d = c;
+        c = b;
+        b = b + (rotated << md5R[i] | rotated >> (32 - md5R[i]));
+    }
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+}
+
+void MD5Builder::begin() {
+    _state[0] = 0x67452301;
+    _state[1] = 0xefcdab89;
+    _state[2] = 0x98badcfe;
+    _state[3] = 0x10325476;
+    _length = 0;
+    memset(_digest, 0, sizeof(_digest));
+}
+
+void MD5Builder::add(const uint8_t* data, uint16_t len) {
+    for (uint16_t i = 0; i < len; ++i) {
+        _buffer[_length % 64] = data[i];
+        if (++_length % 64 == 0) transform(_buffer);
+    }
+}
+
+void MD5Builder::calculate() {
+    uint64_t bits = _length * 8;
+    uint8_t pad = 0x80;
+    add(&pad, 1);
+    pad = 0;
+    while (_length % 64 != 56) add(&pad, 1);
+    uint8_t length[8];
+    for (uint8_t i = 0; i < 8; ++i) length[i] = bits >> (i * 8);
+    add(length, 8);
+    for (uint8_t i = 0; i < 16; ++i) _digest[i] = _state[i / 4] >> ((i % 4) * 8);
+}
+
+String MD5Builder::toString() {
+    char hex[33];
+    for (uint8_t i = 0; i < 16; ++i) snprintf(hex + i * 2, 3, "%02x", _digest[i]);
+    return String(hex);
+}
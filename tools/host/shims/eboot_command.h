@@ -0,0 +1,21 @@
+#ifndef EBOOT_COMMAND_H
+#define EBOOT_COMMAND_H
+
+/*
+host stand-in for the eboot command, writing it is only recorded by the simulation (see Sim::ebootCommand)
+*/
+
+#include <stdint.h>
+
+#define ACTION_COPY_RAW 0x00000002
+
+struct eboot_command {
+    uint32_t magic;
+    uint32_t action;
+    uint32_t args[29];
+    uint32_t crc32;
+};
+
+void eboot_command_write(struct eboot_command* cmd);
+
+#endif // EBOOT_COMMAND_H
@@ -0,0 +1,136 @@
+#include <nahs-Bricks-Lib-RTCmem.h>
+#include <nahs-Bricks-Lib-FSmem.h>
+#include <nahs-Bricks-Lib-SerHelp.h>
+#include <nahs-Bricks-Feature-All.h>
+#include <ESP8266WebServer.h>
+#include "sim.h"
+
+NahsBricksLibRTCmem RTCmem;
+NahsBricksLibSerHelp SerHelp;
+NahsBricksFeatureAll FeatureAll;
+
+//------------------------------------------
+// RTCmem, the header is magic (4 bytes), bytes used (2 bytes) and a checksum of them (2 bytes)
+static const uint32_t rtcMagic = 0x52544301;  // marks valid data in RTC memory
+
+uint8_t* simRtcMemory() {
+    return sim().rtc;
+}
+
+void simRtcOverflow(size_t needed) {
+    fprintf(stderr, "RTCmem overflow: %u of %u bytes registered\n", (unsigned)needed, (unsigned)NahsBricksLibRTCmem::size);
+    abort();
+}
+
+/*
+helper that returns the checksum of the used RTC memory (Fletcher-16)
+*/
+static uint16_t rtcChecksum(uint16_t used) {
+    uint16_t a = 0, b = 0;
+    for (uint16_t i = 0; i < used; ++i) {
+        a = (a + sim().rtc[NahsBricksLibRTCmem::headerSize + i]) % 255;
+        b = (b + a) % 255;
+    }
+    return b << 8 | a;
+}
+
+void NahsBricksLibRTCmem::boot() {
+    uint32_t magic;
+    uint16_t used, checksum;
+    memcpy(&magic, sim().rtc, 4);
+    memcpy(&used, sim().rtc + 4, 2);
+    memcpy(&checksum, sim().rtc + 6, 2);
+    _valid = magic == rtcMagic && headerSize + used <= size && checksum == rtcChecksum(used);
+    _used = 0;
+}
+
+void NahsBricksLibRTCmem::write() {
+    uint16_t checksum = rtcChecksum(_used);
+    memcpy(sim().rtc, &rtcMagic, 4);
+    memcpy(sim().rtc + 4, &_used, 2);
+    memcpy(sim().rtc + 6, &checksum, 2);
+    sim().advance(sim().costs.rtcWrite);
+    sim().stats.rtcWrites++;
+}
+
+void NahsBricksLibRTCmem::destroy() {
+    memset(sim().rtc, 0, 4);
+    _valid = false;
+}
+
+//------------------------------------------
+// FSmem
+NahsBricksLibFSmem& simFSmem() {
+    static NahsBricksLibFSmem fsmem;
+    return fsmem;
+}
+
+JsonObject NahsBricksLibFSmem::registerData(const char* name) {
+    if (!_doc.is<JsonObject>()) _doc.to<JsonObject>();
+    JsonVariant data = _doc[name];
+    if (!data.is<JsonObject>()) data.to<JsonObject>();
+    return data.as<JsonObject>();
+}
+
+bool NahsBricksLibFSmem::write() {
+    sim().fsFile.clear();
+    serializeJson(_doc, sim().fsFile);
+    sim().advance(sim().costs.fsWrite + (uint64_t)sim().fsFile.size() * sim().costs.fsWriteByte);
+    sim().stats.fsWrites++;
+    return true;
+}
+
+void NahsBricksLibFSmem::destroy() {
+    for (auto& data : _doc._root.items) {
+        data->reset();
+        data->type = ArduinoJsonShim::Type::Object;
+    }
+}
+
+void NahsBricksLibFSmem::load() {
+    _doc.clear();
+    if (sim().fsFile.empty() || deserializeJson(_doc, sim().fsFile) || !_doc.is<JsonObject>()) _doc.to<JsonObject>();
+}
+
+//------------------------------------------
+// SerHelp
+String NahsBricksLibSerHelp::readLine(bool echo) {
+    sim().advance(1000);
+    size_t end = sim().serialIn.find('\n');
+    if (end == std::string::npos) {
+        if (!ESP8266WebServer::requests.empty()) return String('\n');  // nothing typed, BrickSetup polls on
+        throw SimHalt{"BrickSetup ran out of Serial input"};
+    }
+    std::string line = sim().serialIn.substr(0, end);
+    sim().serialIn.erase(0, end + 1);
+    if (echo) Serial.println(line.c_str());
+    return String(line);
+}
+
+void NahsBricksLibSerHelp::printlnBool(bool value) {
+    Serial.println(value ? "true" : "false");
+}
+
+//------------------------------------------
+// FeatureAll
+void NahsBricksFeatureAll::begin() {
+    sim().advance(sim().costs.featureBegin);
+}
+
+void NahsBricksFeatureAll::start() {
+    sim().advance(sim().costs.featureStart);
+}
+
+void NahsBricksFeatureAll::deliver(JsonDocument* out_json) {
+    sim().advance(sim().costs.featureDeliver);
+    if (onDeliver) onDeliver(out_json);
+}
+
+void NahsBricksFeatureAll::feedback(JsonDocument* in_json) {
+    sim().advance(sim().costs.featureFeedback);
+    if (onFeedback) onFeedback(in_json);
+}
+
+void NahsBricksFeatureAll::end() {
+    sim().advance(sim().costs.featureEnd);
+}
@@ -0,0 +1,40 @@
+#ifndef NAHS_BRICKS_FEATURE_ALL_H
+#define NAHS_BRICKS_FEATURE_ALL_H
+
+/*
+host stand-in for nahs-Bricks-Feature-All, the features are played by the harness through onDeliver and onFeedback
+each call takes the simulated time given by SimCosts
+*/
+
+#include <ArduinoJson.h>
+#include <functional>
+
+class NahsBricksFeatureAll {
+    private:
+        uint8_t _osVersion = 0;
+        uint8_t _brickType = 0;
+    public:
+        uint16_t delaySeconds = 60;  // s between cycles, as returned by getDelay
+        std::function<void(JsonDocument*)> onDeliver;  // adds the reading of the features
+        std::function<void(JsonDocument*)> onFeedback;  // gets the answers of BrickServer and Activator events
+        void setOsVersion(uint8_t version) { _osVersion = version; }
+        uint8_t getOsVersion() { return _osVersion; }
+        void setBrickType(uint8_t type) { _brickType = type; }
+        uint8_t getBrickType() { return _brickType; }
+        void begin();
+        void start();
+        void deliver(JsonDocument* out_json);
+        void feedback(JsonDocument* in_json);
+        void end();
+        uint16_t getDelay() { return delaySeconds; }
+        bool handoverBrickSetupToFeature(uint8_t feature) { (void)feature; return false; }
+        void printBrickSetupFeatureMenu(uint8_t offset) { (void)offset; }
+        void printBrickSetupFeatureList() {}
+        void printBrickSetupVersionList() {}
+        void printFSdata() {}
+        void printRTCdata() {}
+};
+
+extern NahsBricksFeatureAll FeatureAll;
+
+#endif // NAHS_BRICKS_FEATURE_ALL_H
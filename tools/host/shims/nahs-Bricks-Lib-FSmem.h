@@ -0,0 +1,26 @@
+#ifndef NAHS_BRICKS_LIB_FSMEM_H
+#define NAHS_BRICKS_LIB_FSMEM_H
+
+/*
+host stand-in for nahs-Bricks-Lib-FSmem on the simulated FSmem file (JSON, kept across boots)
+FSmem is reached through simFSmem(), so it exists before the constructors of other global objects register their data
+*/
+
+#include <ArduinoJson.h>
+
+class NahsBricksLibFSmem {
+    private:
+        StaticJsonDocument<2048> _doc;
+    public:
+        JsonObject registerData(const char* name);
+        bool write();
+        void destroy();
+        void load();  // harness: reads the file, registered objects have to be registered again
+        JsonDocument& doc() { return _doc; }
+};
+
+NahsBricksLibFSmem& simFSmem();
+
+#define FSmem simFSmem()
+
+#endif // NAHS_BRICKS_LIB_FSMEM_H
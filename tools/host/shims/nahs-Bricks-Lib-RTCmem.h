@@ -0,0 +1,37 @@
+#ifndef NAHS_BRICKS_LIB_RTCMEM_H
+#define NAHS_BRICKS_LIB_RTCMEM_H
+
+/*
+host stand-in for nahs-Bricks-Lib-RTCmem on the simulated RTC memory (512 bytes, kept across restarts and deep-sleep, garbage on power-on)
+it has no constructor, so it is ready for the registerData calls made by constructors of other global objects
+*/
+
+#include <Arduino.h>
+
+uint8_t* simRtcMemory();
+void simRtcOverflow(size_t needed);
+
+class NahsBricksLibRTCmem {
+    private:
+        uint16_t _used;  // bytes registered behind the header
+        bool _valid;  // memory held valid data at boot (and got not destroyed since)
+    public:
+        static const uint16_t headerSize = 8;  // magic, bytes used and checksum
+        static const uint16_t size = 512;  // bytes of RTC memory
+        template<typename T> T* registerData() {
+            uint16_t offset = headerSize + _used;
+            _used += (sizeof(T) + 3) & ~3UL;
+            if (headerSize + _used > size) simRtcOverflow(headerSize + _used);
+            return (T*)(simRtcMemory() + offset);
+        }
+        bool isValid() { return _valid; }
+        void write();
+        void destroy();
+        uint16_t getSpaceUsed() { return headerSize + _used; }
+        uint16_t getSpaceTotal() { return size; }
+        void boot();  // harness: checks the memory for valid data, registrations start over
+};
+
+extern NahsBricksLibRTCmem RTCmem;
+
+#endif // NAHS_BRICKS_LIB_RTCMEM_H
@@ -0,0 +1,19 @@
+#ifndef NAHS_BRICKS_LIB_SERHELP_H
+#define NAHS_BRICKS_LIB_SERHELP_H
+
+/*
+host stand-in for nahs-Bricks-Lib-SerHelp, lines are read from the simulated Serial input
+running out of input halts the boot (see SimHalt), as BrickSetup would wait forever
+*/
+
+#include <Arduino.h>
+
+class NahsBricksLibSerHelp {
+    public:
+        String readLine(bool echo = true);
+        void printlnBool(bool value);
+};
+
+extern NahsBricksLibSerHelp SerHelp;
+
+#endif // NAHS_BRICKS_LIB_SERHELP_H
@@ -0,0 +1,498 @@
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <ESP8266WebServer.h>
+#include "sim.h"
+
+ESP8266WiFiClass WiFi;
+
+//------------------------------------------
+// state of the WiFi stack, it starts over on each boot
+static struct {
+    uint32_t generation = 0;
+    bool begun = false;  // begin got called (and no disconnect since)
+    uint64_t connectAt = 0;  // now the connection gets established (0 if it never does)
+    int ap = -1;  // index of the AP associated to
+    bool staticIP = false;  // config set the IP (static or cached lease), DHCP is skipped
+    IPAddress ip, gateway, subnet, dns;
+    std::vector<int> scan;  // APs found by the last scan
+} station;
+
+/*
+helper that returns the WiFi state of the current boot
+*/
+static decltype(station)& wifi() {
+    if (station.generation != sim().generation) {
+        station = decltype(station)();
+        station.generation = sim().generation;
+    }
+    return station;
+}
+
+/*
+helper that returns the millis of the current boot, without the cost of a millis() call
+*/
+static uint32_t bootMillis() {
+    return (sim().now - sim().bootAt) / 1000;
+}
+
+bool ESP8266WiFiClass::forceSleepWake() {
+    if (!sim().radioOn) {
+        sim().setRadio(true);
+        sim().advance(sim().costs.wake);
+    }
+    return true;
+}
+
+bool ESP8266WiFiClass::forceSleepBegin(uint32_t sleepUs) {
+    (void)sleepUs;
+    disconnect();
+    sim().setRadio(false);
+    return true;
+}
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode) {
+    if (mode == WIFI_OFF) disconnect();
+    return true;
+}
+
+bool ESP8266WiFiClass::config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+    (void)dns2;
+    wifi().staticIP = localIP.isSet();
+    wifi().ip = localIP;
+    wifi().gateway = gateway;
+    wifi().subnet = subnet;
+    wifi().dns = dns1.isSet() ? dns1 : gateway;
+    return true;
+}
+
+/*
+starts to associate: with bssid and channel only that AP is tried (quick), without the strongest AP is searched for on all channels (full)
+DHCP follows unless config set the IP, the connection never gets established if the boot is failing or the credentials are wrong
+*/
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel, const uint8_t* bssid, bool connect) {
+    wifi().begun = connect;
+    wifi().connectAt = 0;
+    wifi().ap = -1;
+    if (!connect || sim().wifiFailing || ssid == nullptr || sim().ssid != ssid || sim().pass != (passphrase != nullptr ? passphrase : "")) return WL_DISCONNECTED;
+    uint64_t assoc = sim().costs.assocFull;
+    for (size_t i = 0; i < sim().aps.size(); ++i) {
+        const SimAP& ap = sim().aps[i];
+        if (bssid != nullptr) {
+            if (memcmp(ap.bssid, bssid, 6) != 0 || ap.channel != channel) continue;
+            assoc = sim().costs.assocQuick;
+        }
+        if (wifi().ap < 0 || ap.rssi > sim().aps[wifi().ap].rssi) wifi().ap = i;
+    }
+    if (wifi().ap < 0) return WL_DISCONNECTED;
+    if (!wifi().staticIP) {
+        assoc += sim().costs.dhcp;
+        wifi().ip = IPAddress(192, 168, 1, 100);
+        wifi().gateway = IPAddress(192, 168, 1, 1);
+        wifi().subnet = IPAddress(255, 255, 255, 0);
+        wifi().dns = IPAddress(192, 168, 1, 1);
+    }
+    wifi().connectAt = sim().now + assoc;
+    return WL_DISCONNECTED;
+}
+
+/*
+status of the connection, a replayed timeline of statuses takes precedence over the simulated association
+*/
+wl_status_t ESP8266WiFiClass::status() {
+    if (!wifi().begun) return WL_DISCONNECTED;
+    if (!sim().wifiTimeline.empty()) {
+        uint8_t status = WL_DISCONNECTED;
+        for (const auto& change : sim().wifiTimeline) {
+            if (change.first > bootMillis()) break;
+            status = change.second;
+        }
+        return (wl_status_t)status;
+    }
+    return wifi().connectAt != 0 && sim().now >= wifi().connectAt ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff) {
+    wifi().begun = false;
+    wifi().connectAt = 0;
+    if (wifioff) sim().setRadio(false);
+    return true;
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+    return status() == WL_CONNECTED ? wifi().ip : IPAddress();
+}
+
+IPAddress ESP8266WiFiClass::gatewayIP() {
+    return status() == WL_CONNECTED ? wifi().gateway : IPAddress();
+}
+
+IPAddress ESP8266WiFiClass::subnetMask() {
+    return status() == WL_CONNECTED ? wifi().subnet : IPAddress();
+}
+
+IPAddress ESP8266WiFiClass::dnsIP(uint8_t index) {
+    return status() == WL_CONNECTED && index == 0 ? wifi().dns : IPAddress();
+}
+
+uint8_t* ESP8266WiFiClass::BSSID() {
+    static uint8_t none[6];
+    return wifi().ap >= 0 ? sim().aps[wifi().ap].bssid : none;
+}
+
+uint8_t* ESP8266WiFiClass::BSSID(uint8_t index) {
+    static uint8_t none[6];
+    return index < wifi().scan.size() ? sim().aps[wifi().scan[index]].bssid : none;
+}
+
+int32_t ESP8266WiFiClass::channel() {
+    return wifi().ap >= 0 ? sim().aps[wifi().ap].channel : 0;
+}
+
+int32_t ESP8266WiFiClass::channel(uint8_t index) {
+    return index < wifi().scan.size() ? sim().aps[wifi().scan[index]].channel : 0;
+}
+
+int32_t ESP8266WiFiClass::RSSI(uint8_t index) {
+    return index < wifi().scan.size() ? sim().aps[wifi().scan[index]].rssi : 0;
+}
+
+/*
+scans the given channel (all 13 if 0) for APs of the simulated SSID, every channel takes costs.scanChannel
+*/
+int8_t ESP8266WiFiClass::scanNetworks(bool async, bool showHidden, uint8_t channel, uint8_t* ssid) {
+    (void)async;
+    (void)showHidden;
+    sim().advance((uint64_t)sim().costs.scanChannel * (channel == 0 ? 13 : 1));
+    wifi().scan.clear();
+    if (ssid != nullptr && sim().ssid != (const char*)ssid) return 0;
+    for (size_t i = 0; i < sim().aps.size(); ++i) {
+        if (channel == 0 || sim().aps[i].channel == channel) wifi().scan.push_back(i);
+    }
+    return wifi().scan.size();
+}
+
+void ESP8266WiFiClass::scanDelete() {
+    wifi().scan.clear();
+}
+
+/*
+resolves BrickServer's host name (the only one known to the simulated DNS)
+*/
+int ESP8266WiFiClass::hostByName(const char* host, IPAddress& result) {
+    if (status() != WL_CONNECTED) return 0;
+    sim().advance(sim().costs.dns);
+    if (sim().serverHost != host) return 0;
+    result = sim().serverIP;
+    return 1;
+}
+
+bool ESP8266WiFiClass::setSleepMode(WiFiSleepType_t type, uint8_t listenInterval) {
+    (void)listenInterval;
+    sim().lightSleep = sim().radioOn && type == WIFI_LIGHT_SLEEP;
+    return true;
+}
+
+bool ESP8266WiFiClass::softAP(const char* ssid, const char* psk) {
+    (void)ssid;
+    (void)psk;
+    return true;
+}
+
+bool ESP8266WiFiClass::softAPConfig(IPAddress localIP, IPAddress gateway, IPAddress subnet) {
+    (void)localIP;
+    (void)gateway;
+    (void)subnet;
+    return true;
+}
+
+IPAddress ESP8266WiFiClass::softAPIP() {
+    return IPAddress(192, 168, 4, 1);
+}
+
+String ESP8266WiFiClass::macAddress() {
+    return String("02:00:00:A1:B2:C3");
+}
+
+//------------------------------------------
+// TCP
+struct SimConnection {
+    uint32_t generation;
+    bool toServer;  // connection to BrickServer (Activator event accepted by WiFiServer otherwise)
+    bool open = true;
+    bool exchanged = false;  // request got passed to BrickServer
+    bool closing = true;  // peer closes the connection once all of in got sent
+    std::string out;  // bytes written by the Brick
+    std::string in;  // bytes sent to the Brick
+    size_t pos = 0;  // bytes of in read by the Brick
+    uint64_t inAt = 0;  // now the first byte of in arrives
+};
+
+/*
+helper that passes the request to BrickServer once the Brick starts to wait for the answer
+the answer arrives after a round trip and BrickServer's latency, byte by byte at wire speed
+*/
+static void exchange(SimConnection* conn) {
+    if (!conn->toServer || conn->exchanged || conn->out.empty() || !conn->open) return;
+    conn->exchanged = true;
+    uint32_t latency = sim().costs.server;
+    if (sim().server == nullptr || !sim().server->http(conn->out, conn->in, &latency)) {
+        conn->in.clear();
+        conn->closing = false;  // BrickServer is silent, the connection stays open until the Brick gives up
+        return;
+    }
+    conn->inAt = sim().now + sim().costs.rtt + latency;
+    sim().stats.httpExchanges++;
+    sim().stats.serverReceived += conn->in.size();
+}
+
+/*
+helper that returns the bytes of in that arrived by now
+*/
+static size_t arrived(const SimConnection* conn) {
+    if (conn->in.empty() || sim().now < conn->inAt) return 0;
+    uint64_t bytes = (sim().now - conn->inAt) / max(sim().costs.wireByte, (uint32_t)1) + 1;
+    return min((uint64_t)conn->in.size(), bytes);
+}
+
+/*
+connects to BrickServer, which can only be reached over the WiFi connection and by it's IP
+*/
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+    stop();
+    if (WiFi.status() != WL_CONNECTED) return 0;
+    SimServer::Accept accept = ip == sim().serverIP && sim().server != nullptr ? sim().server->accept(port) : SimServer::UNREACHABLE;
+    if (accept == SimServer::UNREACHABLE) {
+        sim().delay((uint64_t)_timeout * 1000);
+        return 0;
+    }
+    sim().advance(sim().costs.rtt);
+    if (accept == SimServer::REFUSE) return 0;
+    _conn = std::make_shared<SimConnection>();
+    _conn->generation = sim().generation;
+    _conn->toServer = true;
+    return 1;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+    if (!_conn || !_conn->open || _conn->generation != sim().generation) return 0;
+    _conn->out.append((const char*)buffer, size);
+    sim().advance((uint64_t)size * sim().costs.wireByte);
+    if (_conn->toServer) sim().stats.serverSent += size;
+    else sim().stats.activatorSent += size;
+    return size;
+}
+
+int WiFiClient::available() {
+    if (!_conn || !_conn->open || _conn->generation != sim().generation) return 0;
+    exchange(_conn.get());
+    return arrived(_conn.get()) - _conn->pos;
+}
+
+int WiFiClient::read() {
+    if (available() <= 0) return -1;
+    return (uint8_t)_conn->in[_conn->pos++];
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+    size_t n = min((size_t)max(available(), 0), size);
+    if (n == 0) return -1;
+    memcpy(buffer, _conn->in.data() + _conn->pos, n);
+    _conn->pos += n;
+    return n;
+}
+
+int WiFiClient::peek() {
+    if (available() <= 0) return -1;
+    return (uint8_t)_conn->in[_conn->pos];
+}
+
+/*
+closes the connection, the answer of the Brick to an Activator event is passed to BrickServer
+*/
+void WiFiClient::stop() {
+    if (!_conn) return;
+    if (_conn->open && !_conn->toServer && _conn->generation == sim().generation && sim().server != nullptr) sim().server->activatorAnswered(_conn->out);
+    _conn->open = false;
+    _conn.reset();
+}
+
+/*
+connected as long as unread bytes are left, or the peer has not closed the connection yet
+*/
+uint8_t WiFiClient::connected() {
+    if (!_conn || !_conn->open || _conn->generation != sim().generation) return 0;
+    exchange(_conn.get());
+    if (_conn->pos < _conn->in.size()) return 1;
+    if (!_conn->toServer || !_conn->exchanged || !_conn->closing) return 1;
+    return arrived(_conn.get()) < _conn->in.size();
+}
+
+void WiFiServer::begin() {
+    _generation = sim().generation;
+}
+
+/*
+accepts the next Activator event sent via HTTP that is due, as a POST / with the event as body
+*/
+WiFiClient WiFiServer::available() {
+    if (_generation != sim().generation || WiFi.status() != WL_CONNECTED) return WiFiClient();
+    uint32_t ms = bootMillis();
+    for (SimEvent& event : sim().events) {
+        if (event.sent || event.udp || event.at > ms) continue;
+        event.sent = true;
+        auto conn = std::make_shared<SimConnection>();
+        conn->generation = sim().generation;
+        conn->toServer = false;
+        conn->in = "POST / HTTP/1.0\r\nContent-Type: ";
+        conn->in += event.msgPack ? "application/msgpack" : "application/json";
+        conn->in += "\r\nContent-Length: " + std::to_string(event.body.size()) + "\r\nConnection: close\r\n\r\n" + event.body;
+        conn->inAt = sim().now;
+        sim().stats.activatorReceived += conn->in.size();
+        return WiFiClient(conn);
+    }
+    return WiFiClient();
+}
+
+//------------------------------------------
+// UDP
+bool WiFiUDP::alive() {
+    if (_generation != sim().generation) {
+        _port = 0;
+        _packet.clear();
+        _pos = 0;
+    }
+    return _port != 0;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+    _port = port;
+    _generation = sim().generation;
+    _packet.clear();
+    _pos = 0;
+    return 1;
+}
+
+void WiFiUDP::stop() {
+    _port = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+    _sendIP = ip;
+    _sendPort = port;
+    _sending.clear();
+    return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+    _sending.append((const char*)buffer, size);
+    return size;
+}
+
+/*
+sends the datagram, those to BrickServer are answered by it (acknowledgements of Activator events included)
+each direction gets lost with the probability udpLoss
+*/
+int WiFiUDP::endPacket() {
+    if (WiFi.status() != WL_CONNECTED) return 0;
+    sim().advance((uint64_t)_sending.size() * sim().costs.wireByte);
+    bool ack = !_sending.empty() && (uint8_t)_sending[0] == 0x60;
+    if (ack) sim().stats.activatorSent += _sending.size();
+    else {
+        sim().stats.serverSent += _sending.size();
+        sim().stats.udpDatagrams++;
+    }
+    if (_sendIP != sim().serverIP || sim().server == nullptr || sim().chance(sim().udpLoss)) return 1;
+    std::string answer;
+    uint32_t latency = sim().costs.server;
+    if (!sim().server->udp(_sending, answer, &latency) || answer.empty() || sim().chance(sim().udpLoss)) return 1;
+    uint64_t at = sim().now + sim().costs.rtt + latency + (uint64_t)answer.size() * sim().costs.wireByte;
+    sim().inbox.push_back({at, sim().serverIP, _sendPort, _port, answer});
+    return 1;
+}
+
+/*
+takes the next datagram that arrived for the bound port, due Activator events sent via UDP arrive as confirmable POST
+*/
+int WiFiUDP::parsePacket() {
+    if (!alive() || WiFi.status() != WL_CONNECTED) return 0;
+    uint32_t ms = bootMillis();
+    for (SimEvent& event : sim().events) {
+        if (event.sent || !event.udp || event.at > ms) continue;
+        static uint16_t messageId = 0x4000;
+        messageId++;
+        event.sent = true;
+        std::string datagram = {(char)0x40, (char)0x02, (char)(messageId >> 8), (char)messageId, (char)0xff};
+        sim().inbox.push_back({sim().now, sim().serverIP, sim().serverUdpPort, _port, datagram + event.body});
+    }
+    for (auto it = sim().inbox.begin(); it != sim().inbox.end(); ++it) {
+        if (it->at > sim().now || it->dstPort != _port) continue;
+        _packet = it->data;
+        _pos = 0;
+        _remoteIP = it->srcIP;
+        _remotePort = it->srcPort;
+        sim().inbox.erase(it);
+        if (!_packet.empty() && (uint8_t)_packet[0] == 0x40) sim().stats.activatorReceived += _packet.size();
+        else sim().stats.serverReceived += _packet.size();
+        return _packet.size();
+    }
+    _packet.clear();
+    _pos = 0;
+    return 0;
+}
+
+int WiFiUDP::available() {
+    return _packet.size() - _pos;
+}
+
+int WiFiUDP::read() {
+    if (_pos >= _packet.size()) return -1;
+    return (uint8_t)_packet[_pos++];
+}
+
+int WiFiUDP::read(unsigned char* buffer, size_t len) {
+    size_t n = min(len, _packet.size() - _pos);
+    memcpy(buffer, _packet.data() + _pos, n);
+    _pos += n;
+    return n;
+}
+
+int WiFiUDP::peek() {
+    if (_pos >= _packet.size()) return -1;
+    return (uint8_t)_packet[_pos];
+}
+
+//------------------------------------------
+// webSetup
+std::vector<SimWebRequest> ESP8266WebServer::requests;
+SimWebResponse ESP8266WebServer::response;
+
+/*
+serves the next queued request by the handler registered for it's URI
+*/
+void ESP8266WebServer::handleClient() {
+    sim().advance(sim().costs.yield);
+    if (requests.empty()) return;
+    _request = requests.front();
+    requests.erase(requests.begin());
+    auto handler = _handlers.find(_request.uri);
+    if (handler != _handlers.end()) handler->second();
+    else if (_notFound) _notFound();
+}
+
+String ESP8266WebServer::arg(const char* name) {
+    auto value = _request.args.find(name);
+    return String(value != _request.args.end() ? value->second : std::string());
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const String& content) {
+    response.code = code;
+    response.type = contentType;
+    response.content = content.str();
+    response.headers = _headers;
+    _headers.clear();
+}
+
+void ESP8266WebServer::sendHeader(const String& name, const String& value, bool first) {
+    if (first) _headers.insert(_headers.begin(), std::make_pair(name.str(), value.str()));
+    else _headers.push_back(std::make_pair(name.str(), value.str()));
+}
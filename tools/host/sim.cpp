@@ -0,0 +1,140 @@
+#include "sim.h"
+#include <map>
+
+Sim::Sim() : eeprom(SPI_FLASH_SEC_SIZE, 0xff), rng(1) {
+    memset(rtc, 0xa5, sizeof(rtc));
+    aps.push_back({{0x02, 0x00, 0x00, 0x00, 0x00, 0x01}, 6, -61});
+    aps.push_back({{0x02, 0x00, 0x00, 0x00, 0x00, 0x02}, 11, -74});
+}
+
+Sim& sim() {
+    static Sim world;
+    return world;
+}
+
+/*
+helper that lets time pass, the radio's time is accounted as long as it is powered
+*/
+void Sim::advance(uint64_t us) {
+    now += us;
+    if (radioOn) stats.radioUs += us;
+}
+
+uint32_t Sim::millis() {
+    advance(costs.clock);
+    return (now - bootAt) / 1000;
+}
+
+uint32_t Sim::micros() {
+    advance(costs.clock);
+    return now - bootAt;
+}
+
+/*
+helper that delays by us, long delays with radio off are slept (they are what sleepAndRestart does without deep-sleep)
+*/
+void Sim::delay(uint64_t us) {
+    if (!radioOn && us >= 100000) stats.sleptUs += us;
+    else if (radioOn && lightSleep) stats.lightSleepUs += us;
+    advance(us);
+}
+
+void Sim::setRadio(bool on) {
+    radioOn = on;
+    if (!on) lightSleep = false;
+}
+
+bool Sim::chance(double p) {
+    return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+/*
+first power-up of a freshly flashed Brick: RTC memory holds garbage, EEPROM is erased (FSmem is kept as set up)
+*/
+void Sim::powerOn() {
+    memset(rtc, 0xa5, sizeof(rtc));
+    eeprom.assign(SPI_FLASH_SEC_SIZE, 0xff);
+    makeSketch();
+}
+
+//------------------------------------------
+// heap blocks taken by malloc of BrickOS (it is built with malloc and free renamed to these), they are released on the next boot
+static std::map<void*, std::pair<size_t, uint32_t>> heapBlocks;  // block -> size, generation
+
+extern "C" void* simMalloc(size_t size) {
+    if (!sim().heapAlloc(size)) return nullptr;
+    void* block = malloc(size);
+    heapBlocks[block] = std::make_pair(size, sim().generation);
+    return block;
+}
+
+extern "C" void simFree(void* block) {
+    auto it = heapBlocks.find(block);
+    if (it == heapBlocks.end()) return;
+    if (it->second.second == sim().generation) sim().heapFreed(it->second.first);
+    free(block);
+    heapBlocks.erase(it);
+}
+
+bool simHeapAlloc(size_t size) {
+    return sim().heapAlloc(size);
+}
+
+void simHeapFree(size_t size) {
+    sim().heapFreed(size);
+}
+
+bool Sim::heapAlloc(size_t size) {
+    if (heapUsed + size > heapFree) return false;
+    heapUsed += size;
+    if (heapUsed > stats.heapPeak) stats.heapPeak = heapUsed;
+    return true;
+}
+
+void Sim::heapFreed(size_t size) {
+    heapUsed -= min((size_t)heapUsed, size);
+}
+
+/*
+starts a boot: the reset takes costs.boot with the radio powered, millis() starts at setup()
+*/
+void Sim::boot() {
+    generation++;
+    stats = SimStats();
+    for (auto& block : heapBlocks) free(block.first);
+    heapBlocks.clear();
+    heapUsed = 0;
+    inbox.clear();
+    if (flash.empty()) makeSketch();
+    bootStart = now;
+    setRadio(true);
+    advance(costs.boot);
+    bootAt = now;
+    wifiFailing = chance(wifiFail);
+}
+
+/*
+ends a boot by restart (or deep-sleep, which is slept right away)
+*/
+void Sim::endBoot(const SimRestart* restart) {
+    if (restart != nullptr && restart->deepSleep) {
+        stats.deepSleep = true;
+        setRadio(false);
+    }
+    stats.awakeUs = now - bootStart - stats.sleptUs;
+    if (restart != nullptr && restart->deepSleep) {
+        now += restart->sleepUs;
+        stats.sleptUs += restart->sleepUs;
+    }
+    setRadio(false);
+}
+
+/*
+helper that fills the sketch part of flash with content seeded by sketchVersion, the free flash area is erased
+*/
+void Sim::makeSketch() {
+    flash.assign(sketchSize + freeSketchSpace, 0xff);
+    std::mt19937 content(sketchVersion);
+    for (uint32_t i = 0; i < sketchSize; ++i) flash[i] = content();
+    md5Cache.clear();
+}
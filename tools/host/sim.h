@@ -0,0 +1,205 @@
+#ifndef BRICKS_SIM_H
+#define BRICKS_SIM_H
+
+/*
+virtual world the shims run BrickOS in: a clock in us, the heap, the memories kept across boots (RTC, EEPROM, FSmem file, flash),
+the APs around, BrickServer and the Activator events sent to the Brick
+nothing in here takes real time, every call of the shims advances the clock by what it costs on a Brick (see SimCosts)
+*/
+
+#include <Arduino.h>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+thrown by ESP.restart and ESP.deepSleep, ends the boot (the harness starts the next one)
+*/
+struct SimRestart {
+    bool deepSleep;
+    uint64_t sleepUs;  // us slept in deep-sleep before the next boot
+};
+
+/*
+thrown if the simulated Brick gets stuck (BrickSetup ran out of Serial input, RTCmem overflow), ends the boot
+*/
+struct SimHalt {
+    std::string reason;
+};
+
+/*
+simulated durations in us, the defaults are what a Wemos D1 mini takes in a typical home network
+*/
+struct SimCosts {
+    uint32_t boot = 70000;  // reset to setup() (ROM bootloader, eboot, SDK init, FSmem load)
+    uint32_t clock = 1;  // each millis() or micros() call, so busy loops advance the clock
+    uint32_t yield = 50;  // each yield()
+    uint32_t fsWrite = 40000;  // each FSmem write
+    uint32_t fsWriteByte = 20;  // each byte of a FSmem write
+    uint32_t rtcWrite = 100;  // each RTCmem write
+    uint32_t eepromBegin = 500;  // EEPROM.begin reading the sector
+    uint32_t eepromCommit = 45000;  // EEPROM commit (erase and write of the sector)
+    uint32_t flashReadKB = 25;  // each KB read from flash
+    uint32_t flashWriteSector = 45000;  // erase and write of a flash sector
+    uint32_t md5KB = 350;  // each KB hashed by MD5
+    uint32_t featureBegin = 2000;  // FeatureAll.begin
+    uint32_t featureStart = 1000;  // FeatureAll.start
+    uint32_t featureDeliver = 15000;  // FeatureAll.deliver (reading the sensors)
+    uint32_t featureFeedback = 500;  // FeatureAll.feedback
+    uint32_t featureEnd = 500;  // FeatureAll.end
+    uint32_t wake = 2000;  // WiFi.forceSleepWake powering up the radio
+    uint32_t assocQuick = 250000;  // association to a given AP on a given channel
+    uint32_t assocFull = 2200000;  // association with WiFi-Discover (scan of all channels included)
+    uint32_t dhcp = 400000;  // DHCP after association (skipped with static IP or cached lease)
+    uint32_t scanChannel = 120000;  // scan of one channel
+    uint32_t dns = 30000;  // resolving BrickServer's host name
+    uint32_t rtt = 8000;  // round trip to BrickServer (and the TCP handshake)
+    uint32_t wireByte = 4;  // each byte sent or received
+    uint32_t server = 2000;  // BrickServer processing a request
+};
+
+/*
+AP of the simulated WiFi
+*/
+struct SimAP {
+    uint8_t bssid[6];
+    uint8_t channel;
+    int32_t rssi;
+};
+
+/*
+Activator event sent to the Brick at millis at (of the boot it is queued for), via HTTP or UDP
+*/
+struct SimEvent {
+    uint32_t at;
+    bool udp;
+    bool msgPack;  // body is MessagePack (JSON otherwise)
+    std::string body;
+    bool sent = false;
+};
+
+/*
+datagram on it's way to the Brick, it arrives at us at
+*/
+struct SimDatagram {
+    uint64_t at;
+    IPAddress srcIP;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    std::string data;
+};
+
+/*
+BrickServer (and the pusher of Activator events) as seen by the simulated Brick
+*/
+class SimServer {
+    public:
+        enum Accept { ACCEPT, REFUSE, UNREACHABLE };
+        virtual ~SimServer() {}
+        virtual Accept accept(uint16_t port) { (void)port; return ACCEPT; }
+        // request is complete (head and body), returns false if the server does not answer at all
+        // latency is the us the server takes to process the request (on top of the round trip and the wire)
+        virtual bool http(const std::string& request, std::string& response, uint32_t* latency) = 0;
+        // datagram sent by the Brick to BrickServer's UDP port, returns false if it is not answered
+        virtual bool udp(const std::string& datagram, std::string& answer, uint32_t* latency) { (void)datagram; (void)answer; (void)latency; return false; }
+        // answer of the Brick to an Activator event sent via HTTP
+        virtual void activatorAnswered(const std::string& response) { (void)response; }
+};
+
+/*
+what happened during one boot
+*/
+struct SimStats {
+    uint64_t awakeUs = 0;  // reset to restart or deep-sleep, time slept with radio off not included
+    uint64_t radioUs = 0;  // radio powered (boot and light sleep included)
+    uint64_t lightSleepUs = 0;  // part of radioUs spent in light sleep (delays with WIFI_LIGHT_SLEEP)
+    uint64_t sleptUs = 0;  // slept with radio off (long delays and deep-sleep)
+    uint32_t serverSent = 0;  // bytes on the wire to BrickServer (HTTP head and body, datagrams)
+    uint32_t serverReceived = 0;
+    uint32_t activatorSent = 0;  // bytes on the wire of Activator events (answers and acknowledgements sent)
+    uint32_t activatorReceived = 0;
+    uint16_t httpExchanges = 0;  // HTTP requests to BrickServer answered
+    uint16_t udpDatagrams = 0;  // datagrams sent to BrickServer
+    uint16_t fsWrites = 0;
+    uint16_t eepromCommits = 0;
+    uint16_t rtcWrites = 0;
+    uint32_t heapPeak = 0;  // bytes of heap used at most
+    bool deepSleep = false;  // boot ended in deep-sleep
+    std::string halted;  // reason if the boot got stuck
+};
+
+class Sim {
+    public:
+        SimCosts costs;
+        uint64_t now = 0;  // us since power-on
+        uint64_t bootStart = 0;  // now of the reset
+        uint64_t bootAt = 0;  // now of setup(), millis() counts from here
+        uint32_t generation = 0;  // number of boots, shim objects outliving a boot reset themselves when it changes
+        SimStats stats;
+
+        //------------------------------------------
+        // heap
+        uint32_t heapFree = 40000;  // bytes of heap free at setup()
+        uint32_t heapUsed = 0;
+
+        //------------------------------------------
+        // memories kept across boots
+        uint8_t rtc[512];
+        std::vector<uint8_t> eeprom;  // the EEPROM sector
+        std::string fsFile;  // FSmem as JSON
+        std::vector<uint8_t> flash;  // sketch followed by the free flash area
+        uint32_t sketchSize = 400000;
+        uint32_t freeSketchSpace = 600000;
+        uint32_t sketchVersion = 1;  // seeds the sketch's content, a new version is a newly flashed sketch
+        std::string md5Override;  // returned by ESP.getSketchMD5 if set (replay of a recorded MD5)
+        std::string md5Cache;
+        bool ebootCommand = false;  // eboot command got written
+
+        //------------------------------------------
+        // WiFi
+        std::string ssid = "bricks";
+        std::string pass = "bricks-pass";
+        std::vector<SimAP> aps;
+        double wifiFail = 0;  // probability of a boot not getting a WiFi connection
+        bool wifiFailing = false;  // this boot does not get a WiFi connection
+        std::vector<std::pair<uint32_t, uint8_t>> wifiTimeline;  // status by millis (replay), overrides the simulated connection if not empty
+        bool radioOn = false;
+        bool lightSleep = false;  // radio is in light sleep while delaying
+
+        //------------------------------------------
+        // network
+        SimServer* server = nullptr;
+        std::string serverHost = "brickserver.local";
+        IPAddress serverIP = IPAddress(192, 168, 1, 10);
+        uint16_t serverUdpPort = 5683;  // source port of Activator events sent via UDP
+        double udpLoss = 0;  // probability of a datagram getting lost (each direction)
+        std::vector<SimEvent> events;  // Activator events of the current boot
+        std::vector<SimDatagram> inbox;  // datagrams on their way to the Brick
+
+        //------------------------------------------
+        // Serial and pins
+        std::string serialIn;  // lines read by SerHelp
+        std::string serialOut;
+        bool echo = false;  // Serial output goes to stdout
+        uint8_t setupPin = HIGH;  // level of the setup pin (LOW enters BrickSetup)
+
+        std::mt19937 rng;
+
+        Sim();
+        void advance(uint64_t us);
+        uint32_t millis();
+        uint32_t micros();
+        void delay(uint64_t us);
+        void setRadio(bool on);
+        bool chance(double p);
+        void powerOn();
+        void boot();
+        void endBoot(const SimRestart* restart);
+        bool heapAlloc(size_t size);
+        void heapFreed(size_t size);
+        void makeSketch();
+};
+
+Sim& sim();
+
+#endif // BRICKS_SIM_H
@@ -0,0 +1,26 @@
+#ifndef BRICKS_SIMHEAP_H
+#define BRICKS_SIMHEAP_H
+
+/*
+force-included (-include) into the sources of BrickOS, so it's malloc and free take from the simulated heap (see sim.cpp)
+the standard headers are included first, the renaming must not reach their declarations
+*/
+
+#include <stdlib.h>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+extern "C" void* simMalloc(size_t size);
+extern "C" void simFree(void* block);
+
+#define malloc simMalloc
+#define free simFree
+
+#endif // BRICKS_SIMHEAP_H